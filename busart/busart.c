@@ -7,6 +7,7 @@
 #include "ring.h"
 #include "busart.h"
 #include "peripherals.h"
+#include "fmt.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -27,16 +28,6 @@
 #endif
 
 
-#ifndef BUSART_LINE_BUFFER_SIZE
-#define BUSART_LINE_BUFFER_SIZE 82
-#endif
-
-
-#ifndef BUSART_SPRINTF_BUFFER_SIZE
-#define BUSART_SPRINTF_BUFFER_SIZE 128
-#endif
-
-
 
 struct busart_dev_struct
 {
@@ -294,53 +285,127 @@ busart_putc (busart_t busart, char ch)
 }
 
 
+/* Copy size bytes to offset within space reserved in a ring buffer.  */
+static void
+busart_segments_copy (ring_segment_t *segments, ring_size_t offset,
+                      const char *src, ring_size_t size)
+{
+    ring_size_t num;
+
+    if (offset < segments[0].size)
+    {
+        num = segments[0].size - offset;
+        if (num > size)
+            num = size;
+        memcpy (segments[0].data + offset, src, num);
+        offset += num;
+        src += num;
+        size -= num;
+    }
+    if (size)
+        memcpy (segments[1].data + offset - segments[0].size, src, size);
+}
+
+
+/** Copy as much text as fits into the transmit ring buffer, sending a
+    carriage return before each newline.  The text is copied straight
+    into the free space of the ring buffer.  Return the number of
+    characters of text consumed.  */
+static ssize_t
+busart_write_text_nonblock (busart_t busart, const void *data, size_t size)
+{
+    busart_dev_t *dev = busart;
+    ring_segment_t segments[2];
+    const char *str = data;
+    const char *nl;
+    ring_size_t space;
+    ring_size_t used;
+    size_t count;
+    size_t num;
+
+    /* Reserve all the free space since each newline takes two.  */
+    space = ring_write_reserve (&dev->tx_ring, (ring_size_t) -1, segments);
+
+    used = 0;
+    count = 0;
+    while (count < size)
+    {
+        nl = memchr (str + count, '\n', size - count);
+        num = nl ? (size_t) (nl - str) - count : size - count;
+        if (num > (size_t) (space - used))
+            num = space - used;
+
+        busart_segments_copy (segments, used, str + count, num);
+        used += num;
+        count += num;
+
+        /* Stop if the ring is full or there is not room for CR LF.  */
+        if (!nl || str + count != nl || space - used < 2)
+            break;
+
+        busart_segments_copy (segments, used, "\r\n", 2);
+        used += 2;
+        count++;
+    }
+
+    ring_write_commit (&dev->tx_ring, used);
+
+    dev->tx_irq_enable ();
+
+    if (count == 0 && size != 0)
+    {
+        /* Would block.  */
+        errno = EAGAIN;
+        return -1;
+    }
+    return count;
+}
+
+
+/** Write text, sending a carriage return before each newline.  Block
+    until all the text has been transferred to the transmit ring
+    buffer or until timeout occurs.  */
+static int
+busart_write_text (void *busart, const char *str, size_t size)
+{
+    busart_dev_t *dev = busart;
+
+    if (sys_write_timeout (busart, str, size, dev->write_timeout_us,
+                           (void *)busart_write_text_nonblock)
+        != (ssize_t) size)
+        return -1;
+    return 0;
+}
+
+
 /** Write string.  */
 int
 busart_puts (busart_t busart, const char *str)
 {
-    while (*str)
-        if (busart_putc (busart, *str++) < 0)
-            return -1;
+    if (busart_write_text (busart, str, strlen (str)) < 0)
+        return -1;
     return 1;
 }
 
 
 /* Non-blocking equivalent to fgets.  Returns 0 if a line is not
-   available otherwise return pointer to buffer.  Note, this keeps its
-   own buffer of an incomplete line so cannot be interspersed with
-   busart_getc.  */
+   available otherwise return pointer to buffer.  An incomplete line
+   is left in the receive ring buffer unless it has size - 1
+   characters or fills the ring buffer.  */
 char *
 busart_gets (busart_t busart, char *buffer, int size)
 {
-    static char line_buffer[BUSART_LINE_BUFFER_SIZE] = "";
-    static int count = 0;
-    int c;
-    int i;
-
-    while (1)
-    {
-        c = busart_getc (busart);
-        if (c == -1)
-            return 0;
-
-        line_buffer[count] = c;
-        count++;
-        if (c == '\n' || count >= size)
-            break;
-    }
-
-    if (size > count)
-        size = count;
+    busart_dev_t *dev = busart;
+    ring_size_t num;
 
-    for (i = 0; i < size; i++)
-        buffer[i] = line_buffer[i];
-    buffer[i] = 0;
+    if (size < 2)
+        return 0;
 
-    /* Could use ring buffer to avoid copying.  */
-    for (i = count - size - 1; i >= 0; i--)
-        line_buffer[i] = line_buffer[i + count];
-    count -= size;
+    num = ring_read_until (&dev->rx_ring, '\n', buffer, size - 1);
+    if (!num)
+        return 0;
 
+    buffer[num] = 0;
     return buffer;
 }
 
@@ -348,16 +413,12 @@ busart_gets (busart_t busart, char *buffer, int size)
 int
 busart_printf (busart_t busart, const char *fmt, ...)
 {
-    // FIXME, long strings can overflow the buffer and thus be truncated.
-    char buffer[BUSART_SPRINTF_BUFFER_SIZE];
     va_list ap;
     int ret;
 
     va_start (ap, fmt);
-    ret = vsnprintf (buffer, sizeof (buffer), fmt, ap);
+    ret = fmt_vprintf (busart_write_text, busart, fmt, ap);
     va_end (ap);
-
-    busart_puts (busart, buffer);
     return ret;
 }
 
@@ -120,6 +120,9 @@ char *
 busart_gets (busart_t busart, char *buffer, int size);
 
 
+/* Formatted write, see fmt.h for the supported conversions.  This
+   blocks until the output is buffered.  Returns the number of
+   characters or -1 for error.  */
 int
 busart_printf (busart_t busart, const char *fmt, ...);
 
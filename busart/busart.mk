@@ -4,7 +4,7 @@ VPATH += $(BUSART_DIR)
 INCLUDES += -I$(BUSART_DIR)
 
 PERIPHERALS += usart
-DRIVERS += ring
+DRIVERS += ring fmt
 
 SRC += busart.c
 
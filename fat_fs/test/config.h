@@ -11,6 +11,7 @@ extern "C" {
 typedef int bool;
 
 #define __packed__ __attribute__((packed))
+#define __unused__ __attribute__((unused))
 
 
 #ifdef __cplusplus
@@ -1,27 +1,24 @@
 #include <stdio.h>
 #include "fat_file.h"
 #include "fat_debug.h"
+#include "file_msd.h"
 
 
 static uint16_t
 dev_read (void *arg, uint32_t addr, void *buffer, uint16_t size)
 {
-    FILE *fs = arg;
+    msd_t *msd = arg;
 
-    fseek (fs, addr, SEEK_SET);
-
-    return fread (buffer, 1, size, fs);
+    return msd_read (msd, addr, buffer, size);
 }
 
 
 static uint16_t
 dev_write (void *arg, uint32_t addr, const void *buffer, uint16_t size)
 {
-    FILE *fs = arg;
-
-    fseek (fs, addr, SEEK_SET);
+    msd_t *msd = arg;
 
-    return fwrite (buffer, 1, size, fs);
+    return msd_write (msd, addr, buffer, size);
 }
 
 
@@ -29,17 +26,20 @@ int main (int argc, char **argv)
 {
     fat_t fat_info;
     fat_t *fat = &fat_info;
-    FILE *fs;
+    file_msd_cfg_t cfg = {0};
+    msd_t *msd;
 
-    if (argc < 1)
+    if (argc < 2)
         return 3;
 
     /* The file must be a formatted FAT file system.  */
-    fs = fopen (argv[1], "r+");
-    if (!fs)
+    cfg.filename = argv[1];
+    cfg.mmap = 1;
+    msd = file_msd_init (&cfg);
+    if (!msd)
         return 1;
 
-    if (!fat_init (fat, fs, dev_read, dev_write))
+    if (!fat_init (fat, msd, dev_read, dev_write))
         return 2;
 
     fat_debug_partition (fat);
@@ -48,6 +48,6 @@ int main (int argc, char **argv)
 
     fat_debug_rootdir_dump (fat);
 
-    fclose (fs);
+    msd_shutdown (msd);
     return 0;
 }
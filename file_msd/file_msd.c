@@ -0,0 +1,280 @@
+/** @file   file_msd.c
+    @brief  Mass storage device backed by a host file.
+    @note   This is for host (hosted) builds only.
+*/
+
+/* For fallocate.  */
+#define _GNU_SOURCE
+
+#include "file_msd.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* This emulates a block device using a disk image file so that the
+   filesystem, USB MSD, and caching code can be exercised and
+   benchmarked on a host machine.
+
+   In the default mode, pread/pwrite are used.  In mmap mode, the
+   file is mapped into memory and accessed with memcpy; this avoids
+   the system call overhead so that the cost of the layers above
+   dominates.
+
+   Unless partial accesses are enabled, the address and size of each
+   access must be a multiple of block_bytes, otherwise the access
+   fails (as for an SD card).  Latency and errors can be injected to
+   emulate slow or flaky media.
+
+   Discarded regions are punched out of the file where the host
+   supports it so that they read back as zeros.  */
+
+
+#ifndef FILE_MSD_DEVICES_NUM
+#define FILE_MSD_DEVICES_NUM 4
+#endif
+
+#define FILE_MSD_BLOCK_BYTES 512
+
+
+typedef struct
+{
+    msd_t msd;
+    int fd;
+    uint8_t *mem;
+    uint32_t read_delay_us;
+    uint32_t write_delay_us;
+    uint32_t read_error_period;
+    uint32_t write_error_period;
+    uint32_t read_count;
+    uint32_t write_count;
+} file_msd_dev_t;
+
+
+static uint8_t file_msd_devices_num = 0;
+static file_msd_dev_t file_msd_devices[FILE_MSD_DEVICES_NUM];
+
+
+static bool
+file_msd_access_ok (file_msd_dev_t *dev, msd_addr_t addr, msd_size_t size,
+                    bool partial)
+{
+    if (addr + size > dev->msd.media_bytes)
+        return 0;
+
+    if (!partial && (addr % dev->msd.block_bytes
+                     || size % dev->msd.block_bytes))
+        return 0;
+
+    return 1;
+}
+
+
+static msd_addr_t
+file_msd_probe (void *handle)
+{
+    file_msd_dev_t *dev = handle;
+
+    return dev->msd.media_bytes;
+}
+
+
+static msd_size_t
+file_msd_read (void *handle, msd_addr_t addr, void *buffer, msd_size_t size)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (!file_msd_access_ok (dev, addr, size, dev->msd.flags.partial_read))
+        return 0;
+
+    if (dev->read_delay_us)
+        usleep (dev->read_delay_us);
+
+    dev->read_count++;
+    if (dev->read_error_period
+        && dev->read_count % dev->read_error_period == 0)
+        return 0;
+
+    if (dev->mem)
+    {
+        memcpy (buffer, dev->mem + addr, size);
+        return size;
+    }
+
+    if (pread (dev->fd, buffer, size, addr) != size)
+        return 0;
+
+    return size;
+}
+
+
+static msd_size_t
+file_msd_write (void *handle, msd_addr_t addr, const void *buffer,
+                msd_size_t size)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (!file_msd_access_ok (dev, addr, size, dev->msd.flags.partial_write))
+        return 0;
+
+    if (dev->write_delay_us)
+        usleep (dev->write_delay_us);
+
+    dev->write_count++;
+    if (dev->write_error_period
+        && dev->write_count % dev->write_error_period == 0)
+        return 0;
+
+    if (dev->mem)
+    {
+        memcpy (dev->mem + addr, buffer, size);
+        return size;
+    }
+
+    if (pwrite (dev->fd, buffer, size, addr) != size)
+        return 0;
+
+    return size;
+}
+
+
+static msd_status_t
+file_msd_status_get (void *handle)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (dev->fd < 0)
+        return MSD_STATUS_NODEVICE;
+
+    return MSD_STATUS_READY;
+}
+
+
+static void
+file_msd_shutdown (void *handle)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (dev->mem)
+    {
+        msync (dev->mem, dev->msd.media_bytes, MS_SYNC);
+        munmap (dev->mem, dev->msd.media_bytes);
+        dev->mem = 0;
+    }
+
+    if (dev->fd >= 0)
+    {
+        close (dev->fd);
+        dev->fd = -1;
+    }
+}
+
+
+static bool
+file_msd_flush (void *handle)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (dev->mem)
+        return msync (dev->mem, dev->msd.media_bytes, MS_SYNC) == 0;
+
+    return fsync (dev->fd) == 0;
+}
+
+
+static bool
+file_msd_discard (void *handle, msd_addr_t addr, msd_addr_t size)
+{
+    file_msd_dev_t *dev = handle;
+
+    if (addr + size > dev->msd.media_bytes)
+        return 0;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    return fallocate (dev->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      addr, size) == 0;
+#else
+    /* Discarding is only advisory.  */
+    return 1;
+#endif
+}
+
+
+static const msd_ops_t file_msd_ops =
+{
+    .probe = file_msd_probe,
+    .read = file_msd_read,
+    .write = file_msd_write,
+    .status_get = file_msd_status_get,
+    .shutdown = file_msd_shutdown,
+    .flush = file_msd_flush,
+    .discard = file_msd_discard,
+};
+
+
+msd_t *
+file_msd_init (const file_msd_cfg_t *cfg)
+{
+    file_msd_dev_t *dev;
+    struct stat st;
+    msd_addr_t media_bytes;
+
+    if (file_msd_devices_num >= FILE_MSD_DEVICES_NUM)
+        return 0;
+    dev = file_msd_devices + file_msd_devices_num;
+
+    memset (dev, 0, sizeof (*dev));
+    dev->fd = open (cfg->filename, O_RDWR | O_CREAT, 0644);
+    if (dev->fd < 0)
+        return 0;
+
+    if (fstat (dev->fd, &st) < 0)
+    {
+        close (dev->fd);
+        return 0;
+    }
+
+    media_bytes = cfg->media_bytes;
+    if (!media_bytes)
+        media_bytes = st.st_size;
+
+    /* Extend the file if necessary; the new space reads as zero.  */
+    if ((msd_addr_t)st.st_size < media_bytes
+        && ftruncate (dev->fd, media_bytes) < 0)
+    {
+        close (dev->fd);
+        return 0;
+    }
+
+    if (cfg->mmap && media_bytes)
+    {
+        dev->mem = mmap (0, media_bytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, dev->fd, 0);
+        if (dev->mem == MAP_FAILED)
+        {
+            close (dev->fd);
+            return 0;
+        }
+    }
+
+    dev->read_delay_us = cfg->read_delay_us;
+    dev->write_delay_us = cfg->write_delay_us;
+    dev->read_error_period = cfg->read_error_period;
+    dev->write_error_period = cfg->write_error_period;
+
+    dev->msd.handle = dev;
+    dev->msd.ops = &file_msd_ops;
+    dev->msd.media_bytes = media_bytes;
+    dev->msd.block_bytes = cfg->block_bytes ? cfg->block_bytes
+        : FILE_MSD_BLOCK_BYTES;
+    dev->msd.flags.removable = 0;
+    dev->msd.flags.volatile1 = 0;
+    dev->msd.flags.partial_read = cfg->partial_read;
+    dev->msd.flags.partial_write = cfg->partial_write;
+    dev->msd.name = "File";
+
+    file_msd_devices_num++;
+    return &dev->msd;
+}
@@ -0,0 +1,47 @@
+/** @file   file_msd.h
+    @brief  Mass storage device backed by a host file.
+    @note   This is for host (hosted) builds only.
+*/
+
+#ifndef FILE_MSD_H
+#define FILE_MSD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include "config.h"
+#include "msd.h"
+
+
+typedef struct
+{
+    /* Name of disk image file.  This is created if it does not exist.  */
+    const char *filename;
+    /* Size of the medium; if zero, the size of the file is used.
+       The file is extended if it is smaller.  */
+    msd_addr_t media_bytes;
+    /* Block size; if zero, 512 is used.  */
+    msd_size_t block_bytes;
+    /* Set to map the file into memory rather than use pread/pwrite.  */
+    bool mmap;
+    /* Allow accesses that are not multiples of block_bytes.  */
+    bool partial_read;
+    bool partial_write;
+    /* Emulated access latency in microseconds.  */
+    uint32_t read_delay_us;
+    uint32_t write_delay_us;
+    /* Fail every Nth read/write; zero to disable error injection.  */
+    uint32_t read_error_period;
+    uint32_t write_error_period;
+} file_msd_cfg_t;
+
+
+msd_t *file_msd_init (const file_msd_cfg_t *cfg);
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
@@ -0,0 +1,6 @@
+FILE_MSD_DIR = $(DRIVER_DIR)/file_msd
+
+VPATH += $(FILE_MSD_DIR)
+INCLUDES += -I$(FILE_MSD_DIR)
+
+SRC += file_msd.c msd.c
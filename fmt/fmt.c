@@ -0,0 +1,687 @@
+/** @file   fmt.c
+    @brief  Streaming formatted output.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "fmt.h"
+
+
+#if FMT_LONG_LONG
+typedef unsigned long long fmt_uint_t;
+typedef long long fmt_int_t;
+#else
+typedef unsigned long fmt_uint_t;
+typedef long fmt_int_t;
+#endif
+
+
+enum
+{
+    FMT_LEFT = 1,
+    FMT_ZERO = 2,
+    FMT_PLUS = 4,
+    FMT_SPACE = 8,
+    FMT_ALT = 16,
+    FMT_UPPER = 32
+};
+
+
+enum
+{
+    FMT_LENGTH_NONE,
+    FMT_LENGTH_CHAR,
+    FMT_LENGTH_SHORT,
+    FMT_LENGTH_LONG,
+    FMT_LENGTH_LONG_LONG,
+    FMT_LENGTH_SIZE,
+    FMT_LENGTH_INTMAX,
+    FMT_LENGTH_LONG_DOUBLE
+};
+
+
+/* Enough for a 64-bit number in octal or the integer and fractional
+   parts of %f.  */
+#define FMT_BUFFER_SIZE 32
+
+
+/* %f values from this up are printed with an exponent so that the
+   integer part fits in the buffer.  */
+#define FMT_FIXED_MAX 1e20
+
+
+/* Integer parts of %f too big for a fmt_uint_t are converted in
+   pieces of nine digits; three are enough for FMT_FIXED_MAX.  */
+#define FMT_WHOLE_BASE 1000000000UL
+#define FMT_WHOLE_PIECES 3
+
+
+/* Floating point conversions that are not supported; their
+   arguments are skipped.  */
+#if FMT_FLOAT
+#define FMT_FLOAT_UNSUPPORTED "eEgGaA"
+#else
+#define FMT_FLOAT_UNSUPPORTED "fFeEgGaA"
+#endif
+
+
+typedef struct
+{
+    fmt_sink_t sink;
+    void *arg;
+    int count;
+} fmt_out_t;
+
+
+static int
+fmt_emit (fmt_out_t *out, const char *str, size_t size)
+{
+    if (!size)
+        return 0;
+
+    if (out->sink (out->arg, str, size) < 0)
+        return -1;
+
+    out->count += size;
+    return 0;
+}
+
+
+static int
+fmt_pad (fmt_out_t *out, char ch, int num)
+{
+    char buffer[8];
+    int size;
+
+    if (num <= 0)
+        return 0;
+
+    memset (buffer, ch, sizeof (buffer));
+    for (; num > 0; num -= size)
+    {
+        size = num < (int) sizeof (buffer) ? num : (int) sizeof (buffer);
+        if (fmt_emit (out, buffer, size) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/* Convert value to digits, working backwards from end.  Return a
+   pointer to the first digit.  */
+static char *
+fmt_digits (fmt_uint_t value, unsigned int base, bool upper, char *end)
+{
+    const char *digits;
+    unsigned int shift;
+
+    digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    if (base == 10)
+    {
+        do
+        {
+            *--end = digits[value % 10];
+            value /= 10;
+        } while (value);
+        return end;
+    }
+
+    shift = base == 16 ? 4 : 3;
+    do
+    {
+        *--end = digits[value & (base - 1)];
+        value >>= shift;
+    } while (value);
+    return end;
+}
+
+
+/* Output a field of at least width characters comprising the prefix
+   (sign or 0x), zeros, and the string.  */
+static int
+fmt_field (fmt_out_t *out, const char *prefix, const char *str, int size,
+           int zeros, int width, int flags)
+{
+    int prefix_size;
+    int pad;
+
+    prefix_size = strlen (prefix);
+    pad = width - prefix_size - zeros - size;
+
+    if (!(flags & FMT_LEFT))
+    {
+        if (flags & FMT_ZERO)
+        {
+            if (pad > 0)
+                zeros += pad;
+        }
+        else if (fmt_pad (out, ' ', pad) < 0)
+            return -1;
+    }
+
+    if (fmt_emit (out, prefix, prefix_size) < 0
+        || fmt_pad (out, '0', zeros) < 0
+        || fmt_emit (out, str, size) < 0)
+        return -1;
+
+    if (flags & FMT_LEFT)
+        return fmt_pad (out, ' ', pad);
+    return 0;
+}
+
+
+#if FMT_FLOAT
+/* Return the largest whole number not greater than the non-negative
+   value, without needing the maths library.  */
+static double
+fmt_floor (double value)
+{
+    double whole;
+
+    /* Values from 2^52 up have no fractional part.  */
+    if (value >= 4503599627370496.0)
+        return value;
+
+    whole = (value + 4503599627370496.0) - 4503599627370496.0;
+    if (whole > value)
+        whole -= 1;
+    return whole;
+}
+
+
+/* Double the number held in pieces and add bit.  */
+static void
+fmt_whole_double (unsigned long *pieces, unsigned long bit)
+{
+    int i;
+
+    for (i = 0; i < FMT_WHOLE_PIECES; i++)
+    {
+        pieces[i] = pieces[i] * 2 + bit;
+        bit = pieces[i] >= FMT_WHOLE_BASE;
+        if (bit)
+            pieces[i] -= FMT_WHOLE_BASE;
+    }
+}
+
+
+/* Convert the whole number value, less than FMT_FIXED_MAX, to
+   decimal exactly, working backwards from end.  Return a pointer to
+   the first digit.  */
+static char *
+fmt_whole (double value, char *end)
+{
+    unsigned long pieces[FMT_WHOLE_PIECES];
+    double bit;
+    int shift;
+    int top;
+    int i;
+    int j;
+
+    /* Doubles from 2^53 up are even so halving them is exact.  */
+    for (shift = 0; value >= 9007199254740992.0; shift++)
+        value /= 2;
+
+    /* Move the bits into the pieces, most significant first.  */
+    memset (pieces, 0, sizeof (pieces));
+    for (bit = 4503599627370496.0; bit >= 1; bit /= 2)
+    {
+        if (value >= bit)
+        {
+            value -= bit;
+            fmt_whole_double (pieces, 1);
+        }
+        else
+            fmt_whole_double (pieces, 0);
+    }
+    for (; shift; shift--)
+        fmt_whole_double (pieces, 0);
+
+    for (top = FMT_WHOLE_PIECES - 1; top && !pieces[top]; top--)
+        continue;
+
+    for (i = 0; i < top; i++)
+    {
+        for (j = 0; j < 9; j++)
+        {
+            *--end = '0' + pieces[i] % 10;
+            pieces[i] /= 10;
+        }
+    }
+    return fmt_digits (pieces[top], 10, 0, end);
+}
+
+
+/* Convert the finite, non-negative value to fixed-point notation,
+   working backwards from end.  Values too large for the buffer are
+   given an exponent.  Return a pointer to the first character.  */
+static char *
+fmt_fixed (double value, int precision, int flags, char *end)
+{
+    double ipart;
+    fmt_uint_t fpart;
+    fmt_uint_t scale;
+    int exponent;
+    int i;
+
+    exponent = -1;
+    if (value >= FMT_FIXED_MAX)
+    {
+        for (exponent = 0; value >= 10; exponent++)
+            value /= 10;
+    }
+
+    scale = 1;
+    for (i = 0; i < precision; i++)
+        scale *= 10;
+
+    /* Round to nearest, with ties to even as for printf.  */
+    ipart = fmt_floor (value);
+    value = (value - ipart) * scale;
+    fpart = value;
+    value -= fpart;
+    if (value > 0.5
+        || (value == 0.5
+            && (precision ? fpart & 1 : ipart != 2 * fmt_floor (ipart / 2))))
+        fpart++;
+    if (fpart >= scale)
+    {
+        fpart -= scale;
+        ipart++;
+        if (exponent >= 0 && ipart >= 10)
+        {
+            ipart = 1;
+            exponent++;
+        }
+    }
+
+    if (exponent >= 0)
+    {
+        end = fmt_digits (exponent, 10, 0, end);
+        if (exponent < 10)
+            *--end = '0';
+        *--end = '+';
+        *--end = (flags & FMT_UPPER) ? 'E' : 'e';
+    }
+
+    for (i = 0; i < precision; i++)
+    {
+        *--end = '0' + fpart % 10;
+        fpart /= 10;
+    }
+    if (precision || (flags & FMT_ALT))
+        *--end = '.';
+
+    if (ipart >= (double) (fmt_uint_t) -1)
+        return fmt_whole (ipart, end);
+    return fmt_digits (ipart, 10, 0, end);
+}
+#endif
+
+
+int
+fmt_vprintf (fmt_sink_t sink, void *arg, const char *fmt, va_list ap)
+{
+    fmt_out_t out;
+    char buffer[FMT_BUFFER_SIZE];
+    char *end = buffer + sizeof (buffer);
+    const char *start;
+    const char *prefix;
+    const char *str;
+    fmt_uint_t value;
+    fmt_int_t svalue;
+    unsigned int base;
+    int flags;
+    int width;
+    int precision;
+    int length;
+    int size;
+    int zeros;
+    char ch;
+
+    out.sink = sink;
+    out.arg = arg;
+    out.count = 0;
+
+    while (*fmt)
+    {
+        /* Output literal text up to the next conversion.  */
+        str = strchr (fmt, '%');
+        if (!str)
+        {
+            if (fmt_emit (&out, fmt, strlen (fmt)) < 0)
+                return -1;
+            break;
+        }
+        if (fmt_emit (&out, fmt, str - fmt) < 0)
+            return -1;
+
+        start = str;
+        fmt = str + 1;
+
+        flags = 0;
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+                flags |= FMT_LEFT;
+            else if (*fmt == '0')
+                flags |= FMT_ZERO;
+            else if (*fmt == '+')
+                flags |= FMT_PLUS;
+            else if (*fmt == ' ')
+                flags |= FMT_SPACE;
+            else if (*fmt == '#')
+                flags |= FMT_ALT;
+            else
+                break;
+        }
+
+        width = 0;
+        if (*fmt == '*')
+        {
+            width = va_arg (ap, int);
+            if (width < 0)
+            {
+                flags |= FMT_LEFT;
+                width = -width;
+            }
+            fmt++;
+        }
+        else
+        {
+            for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                width = width * 10 + *fmt - '0';
+        }
+
+        precision = -1;
+        if (*fmt == '.')
+        {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*')
+            {
+                precision = va_arg (ap, int);
+                fmt++;
+            }
+            else
+            {
+                for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                    precision = precision * 10 + *fmt - '0';
+            }
+        }
+
+        length = FMT_LENGTH_NONE;
+        switch (*fmt)
+        {
+        case 'h':
+            fmt++;
+            length = FMT_LENGTH_SHORT;
+            if (*fmt == 'h')
+            {
+                fmt++;
+                length = FMT_LENGTH_CHAR;
+            }
+            break;
+
+        case 'l':
+            fmt++;
+            length = FMT_LENGTH_LONG;
+            if (*fmt == 'l')
+            {
+                fmt++;
+                length = FMT_LENGTH_LONG_LONG;
+            }
+            break;
+
+        case 'z':
+        case 't':
+            fmt++;
+            length = FMT_LENGTH_SIZE;
+            break;
+
+        case 'j':
+            fmt++;
+            length = FMT_LENGTH_INTMAX;
+            break;
+
+        case 'L':
+            fmt++;
+            length = FMT_LENGTH_LONG_DOUBLE;
+            break;
+        }
+
+        ch = *fmt;
+        if (!ch)
+        {
+            /* Incomplete conversion at end of format.  */
+            if (fmt_emit (&out, start, fmt - start) < 0)
+                return -1;
+            break;
+        }
+        fmt++;
+
+        prefix = "";
+        base = 10;
+        switch (ch)
+        {
+        case '%':
+            if (fmt_emit (&out, "%", 1) < 0)
+                return -1;
+            continue;
+
+        case 'c':
+            buffer[0] = va_arg (ap, int);
+            if (fmt_field (&out, "", buffer, 1, 0, width,
+                           flags & ~FMT_ZERO) < 0)
+                return -1;
+            continue;
+
+        case 's':
+            str = va_arg (ap, const char *);
+            if (!str)
+                str = "(null)";
+            if (precision < 0)
+                size = strlen (str);
+            else
+            {
+                const char *nul;
+
+                nul = memchr (str, 0, precision);
+                size = nul ? nul - str : precision;
+            }
+            if (fmt_field (&out, "", str, size, 0, width,
+                           flags & ~FMT_ZERO) < 0)
+                return -1;
+            continue;
+
+#if FMT_FLOAT
+        case 'f':
+        case 'F':
+            {
+                double dvalue;
+
+                if (length == FMT_LENGTH_LONG_DOUBLE)
+                    dvalue = va_arg (ap, long double);
+                else
+                    dvalue = va_arg (ap, double);
+                if (precision < 0)
+                    precision = 6;
+                if (precision > FMT_PRECISION_MAX)
+                    precision = FMT_PRECISION_MAX;
+                if (ch == 'F')
+                    flags |= FMT_UPPER;
+
+                /* Use the sign bit so that -0.0 is negative.  */
+                if (signbit (dvalue))
+                {
+                    prefix = "-";
+                    dvalue = -dvalue;
+                }
+                else if (flags & FMT_PLUS)
+                    prefix = "+";
+                else if (flags & FMT_SPACE)
+                    prefix = " ";
+
+                if (isnan (dvalue) || isinf (dvalue))
+                {
+                    /* No zero padding for nan or inf.  */
+                    if (isnan (dvalue))
+                        str = (flags & FMT_UPPER) ? "NAN" : "nan";
+                    else
+                        str = (flags & FMT_UPPER) ? "INF" : "inf";
+                    flags &= ~FMT_ZERO;
+                    size = 3;
+                }
+                else
+                {
+                    str = fmt_fixed (dvalue, precision, flags, end);
+                    size = end - str;
+                }
+
+                if (fmt_field (&out, prefix, str, size, 0, width, flags) < 0)
+                    return -1;
+            }
+            continue;
+#endif
+
+        case 'd':
+        case 'i':
+            switch (length)
+            {
+            case FMT_LENGTH_CHAR:
+                svalue = (signed char) va_arg (ap, int);
+                break;
+            case FMT_LENGTH_SHORT:
+                svalue = (short) va_arg (ap, int);
+                break;
+            case FMT_LENGTH_LONG:
+                svalue = va_arg (ap, long);
+                break;
+            case FMT_LENGTH_LONG_LONG:
+                svalue = va_arg (ap, long long);
+                break;
+            case FMT_LENGTH_SIZE:
+                svalue = va_arg (ap, ptrdiff_t);
+                break;
+            case FMT_LENGTH_INTMAX:
+                svalue = va_arg (ap, intmax_t);
+                break;
+            default:
+                svalue = va_arg (ap, int);
+                break;
+            }
+            if (svalue < 0)
+            {
+                prefix = "-";
+                value = -(fmt_uint_t) svalue;
+            }
+            else
+            {
+                value = svalue;
+                if (flags & FMT_PLUS)
+                    prefix = "+";
+                else if (flags & FMT_SPACE)
+                    prefix = " ";
+            }
+            break;
+
+        case 'X':
+            flags |= FMT_UPPER;
+            /* Fall through.  */
+        case 'x':
+            base = 16;
+            /* Fall through.  */
+        case 'o':
+            if (ch == 'o')
+                base = 8;
+            /* Fall through.  */
+        case 'u':
+            switch (length)
+            {
+            case FMT_LENGTH_CHAR:
+                value = (unsigned char) va_arg (ap, unsigned int);
+                break;
+            case FMT_LENGTH_SHORT:
+                value = (unsigned short) va_arg (ap, unsigned int);
+                break;
+            case FMT_LENGTH_LONG:
+                value = va_arg (ap, unsigned long);
+                break;
+            case FMT_LENGTH_LONG_LONG:
+                value = va_arg (ap, unsigned long long);
+                break;
+            case FMT_LENGTH_SIZE:
+                value = va_arg (ap, size_t);
+                break;
+            case FMT_LENGTH_INTMAX:
+                value = va_arg (ap, uintmax_t);
+                break;
+            default:
+                value = va_arg (ap, unsigned int);
+                break;
+            }
+            if ((flags & FMT_ALT) && base == 16 && value)
+                prefix = (flags & FMT_UPPER) ? "0X" : "0x";
+            break;
+
+        case 'p':
+            value = (uintptr_t) va_arg (ap, void *);
+            base = 16;
+            prefix = "0x";
+            break;
+
+        default:
+            /* Skip the argument of an unsupported floating point
+               conversion so that those following get theirs.  */
+            if (strchr (FMT_FLOAT_UNSUPPORTED, ch))
+            {
+                if (length == FMT_LENGTH_LONG_DOUBLE)
+                    (void) va_arg (ap, long double);
+                else
+                    (void) va_arg (ap, double);
+            }
+            /* Output unknown conversions as is.  */
+            if (fmt_emit (&out, start, fmt - start) < 0)
+                return -1;
+            continue;
+        }
+
+        /* A zero value with zero precision has no digits.  */
+        if (!value && !precision)
+            str = end;
+        else
+            str = fmt_digits (value, base, flags & FMT_UPPER, end);
+        size = end - str;
+
+        zeros = 0;
+        if (precision >= 0)
+        {
+            flags &= ~FMT_ZERO;
+            if (precision > size)
+                zeros = precision - size;
+        }
+        if ((flags & FMT_ALT) && base == 8 && !zeros
+            && (!size || *str != '0'))
+            zeros = 1;
+
+        if (fmt_field (&out, prefix, str, size, zeros, width, flags) < 0)
+            return -1;
+    }
+
+    return out.count;
+}
+
+
+int
+fmt_printf (fmt_sink_t sink, void *arg, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start (ap, fmt);
+    ret = fmt_vprintf (sink, arg, fmt, ap);
+    va_end (ap);
+    return ret;
+}
@@ -0,0 +1,87 @@
+/** @file   fmt.h
+    @brief  Streaming formatted output.
+
+    This is a compact replacement for vsnprintf.  Rather than
+    formatting into a buffer, the output is passed in pieces to a sink
+    function, say one that writes into a driver's transmit ring.  Thus
+    there is no limit on the length of the output and no need for a
+    large buffer on the stack.  Literal text between conversions is
+    passed to the sink in a single call.
+
+    The conversions d, i, u, x, X, o, c, s, p, and % are supported
+    with the flags -, 0, +, space, and #, a field width, a precision
+    (either may be *), and the length modifiers hh, h, l, ll, j, z,
+    and t.  The f conversion prints a double (or with L, a long
+    double) in fixed-point notation; the default precision is 6 and
+    at most FMT_PRECISION_MAX fractional digits are printed.  Values
+    of 1e20 and above are printed with an exponent, as for %e.
+
+    Other conversions are output as is.  The arguments of e, g, and a
+    are skipped so that the conversions that follow are correct.
+*/
+
+#ifndef FMT_H
+#define FMT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+#include <stdarg.h>
+#include <stddef.h>
+
+
+/* Set to 0 to drop support for %f (and the floating point code it
+   pulls in).  */
+#ifndef FMT_FLOAT
+#define FMT_FLOAT 1
+#endif
+
+
+/* Set to 1 to print long long arguments (%lld etc.) in full.  This
+   pulls in 64-bit division on 32-bit machines.  Otherwise they are
+   truncated to unsigned long, as are those of %jd etc.  */
+#ifndef FMT_LONG_LONG
+#define FMT_LONG_LONG 0
+#endif
+
+
+/* The most fractional digits printed by %f.  */
+#ifndef FMT_PRECISION_MAX
+#define FMT_PRECISION_MAX 9
+#endif
+
+
+/** Sink for formatted output.
+    @param arg the argument passed to fmt_printf
+    @param str pointer to characters (not null terminated)
+    @param size number of characters
+    @return negative value to abort the output.  */
+typedef int (*fmt_sink_t) (void *arg, const char *str, size_t size);
+
+
+/** Format a string, passing the output to a sink.
+    @param sink the function to pass the output to
+    @param arg the argument passed to the sink
+    @param fmt the format string
+    @param ap the arguments
+    @return number of characters output or -1 if the sink failed.  */
+int
+fmt_vprintf (fmt_sink_t sink, void *arg, const char *fmt, va_list ap);
+
+
+/** Format a string, passing the output to a sink.
+    @param sink the function to pass the output to
+    @param arg the argument passed to the sink
+    @param fmt the format string
+    @return number of characters output or -1 if the sink failed.  */
+int
+fmt_printf (fmt_sink_t sink, void *arg, const char *fmt, ...);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,6 @@
+FMT_DIR = $(DRIVER_DIR)/fmt
+
+VPATH += $(FMT_DIR)
+INCLUDES += -I$(FMT_DIR)
+
+SRC += fmt.c
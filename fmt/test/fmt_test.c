@@ -0,0 +1,240 @@
+/** @file   fmt_test.c
+    @brief  Compare fmt_printf with the C library's snprintf.  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "fmt.h"
+
+
+/* Number of random values to try.  */
+#define N 100000
+
+
+static char out[4096];
+static size_t out_size;
+static int sink_calls;
+static int sink_fail_after;
+static int errors;
+
+
+static int
+sink (void *arg, const char *str, size_t size)
+{
+    (void) arg;
+
+    if (sink_fail_after && sink_calls >= sink_fail_after)
+        return -1;
+    sink_calls++;
+
+    if (out_size + size >= sizeof (out))
+        return -1;
+    memcpy (out + out_size, str, size);
+    out_size += size;
+    out[out_size] = 0;
+    return 0;
+}
+
+
+static int
+format (const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    out_size = 0;
+    out[0] = 0;
+    sink_calls = 0;
+    va_start (ap, fmt);
+    ret = fmt_vprintf (sink, 0, fmt, ap);
+    va_end (ap);
+    return ret;
+}
+
+
+static void
+check (const char *expected, int expected_ret, int ret, const char *what,
+       int line)
+{
+    if (ret == expected_ret && !strcmp (out, expected))
+        return;
+
+    if (errors < 20)
+        printf ("Line %d: %s gave '%s' (%d), expected '%s' (%d)\n",
+                line, what, out, ret, expected, expected_ret);
+    errors++;
+}
+
+
+/* Compare the output and return value with snprintf.  */
+#define COMPARE(...)                                                \
+    do                                                              \
+    {                                                               \
+        char ref[sizeof (out)];                                     \
+        int ref_ret;                                                \
+                                                                    \
+        ref_ret = snprintf (ref, sizeof (ref), __VA_ARGS__);        \
+        check (ref, ref_ret, format (__VA_ARGS__), #__VA_ARGS__,    \
+               __LINE__);                                           \
+    } while (0)
+
+
+/* Compare with an expected string where fmt differs from printf.  */
+#define EXPECT(expected, ...)                                       \
+    check (expected, strlen (expected), format (__VA_ARGS__),       \
+           #__VA_ARGS__, __LINE__)
+
+
+static void
+integer_test (void)
+{
+    COMPARE ("hello");
+    COMPARE ("%d %i %u", -5, 42, 7u);
+    COMPARE ("%5d|%-5d|%05d|%+d|% d|%+ d", 12, 12, -12, 3, 3, 3);
+    COMPARE ("%x %X %#x %#X %08x %#010x", 255, 255, 255, 0, 0xbeef, 0xbeef);
+    COMPARE ("%o %#o %#o %#.3o %#5o", 8, 8, 0, 8, 8);
+    COMPARE ("%.3d %.0d| %8.3d %-8.3d| %08.3d %.0x|", 5, 0, -7, 7, 7, 0);
+    COMPARE ("%*d|%-*d|%.*d|%*d|%.*d", 6, 1, 6, 2, 4, 3, -6, 4, -1, 5);
+    COMPARE ("%d %d", INT32_MIN, INT32_MAX);
+    COMPARE ("%hd %hu %hhd %hhu %hx", -3, 65535, -1, 255, 0x12345);
+    COMPARE ("%ld %lu %lx %lo", -123456789L, 4000000000UL, 0xdeadbeefUL,
+             0777UL);
+    COMPARE ("%zu %zd %td %zx", (size_t) 99, (ssize_t) -2, (ptrdiff_t) -4,
+             (size_t) 0xabc);
+    COMPARE ("%jd %ju %jx", (intmax_t) -42, (uintmax_t) 42, (uintmax_t) 255);
+    COMPARE ("%p", (void *) 0x1234);
+#if FMT_LONG_LONG
+    COMPARE ("%lld %llu %llx %llo", -1234567890123LL, 18446744073709551615ULL,
+             0x123456789abcULL, 01234567012345670ULL);
+    COMPARE ("%lld %jd", INT64_MIN, (intmax_t) INT64_MAX);
+#endif
+}
+
+
+static void
+string_test (void)
+{
+    COMPARE ("%s|%10s|%-10s|%.2s|%5.1s|%.0s|", "abc", "abc", "abc", "abc",
+             "abc", "abc");
+    COMPARE ("%c%c|%3c|%-3c|%03c", 'a', 'b', 'x', 'y', 'z');
+    COMPARE ("100%% %d%%", 5);
+}
+
+
+static void
+float_test (void)
+{
+    COMPARE ("%f %f %f %F", 1.5, -2.25, 0.0, 3.0);
+    COMPARE ("%.2f %.0f %#.0f %8.3f %-8.3f| %08.3f %+.1f % .1f", 3.14159,
+             2.5001, 3.0, -1.0005, 1.25, -3.5, 2.0, 2.0);
+    COMPARE ("%.9f %.3f %.1f %.2f %.4f", 0.123456789, 999.9996, 0.96,
+             123456.785001, 0.00005001);
+    /* Ties round to even.  */
+    COMPARE ("%.0f %.0f %.0f %.1f %.1f %.2f", 0.5, 1.5, 2.5, 0.25, 0.75,
+             1.125);
+    COMPARE ("%f %f %.1f %+f", -0.0, -0.0000001, -0.04, -0.0);
+    COMPARE ("%f %F %5f %-6f| %08f %f", INFINITY, INFINITY, -INFINITY,
+             INFINITY, INFINITY, NAN);
+    COMPARE ("%f %F", -NAN, -NAN);
+    COMPARE ("%Lf %.3Lf", (long double) 2.5, (long double) -1.0625);
+
+    /* Integer parts too big for a long.  */
+    COMPARE ("%f %.1f %.0f", 4294967295.0, 4294967296.5, 4294967295.5);
+    COMPARE ("%f %.3f", 123456789012.25, 9007199254740991.0);
+    COMPARE ("%.0f %f", 18446744073709551615.0, 99999999999999991611392.0
+             / 10000);
+
+    /* Larger values have an exponent.  */
+    EXPECT ("1.000000e+20 1.5E+30 -1.797693e+308", "%f %.1F %f", 1e20,
+            1.5e30, -1.7976931348623157e308);
+    EXPECT ("1.00e+21", "%.2f", 9.999e20);
+    EXPECT ("1.0e+300", "%.1f", 9.99e299);
+}
+
+
+static void
+random_test (void)
+{
+    unsigned int i;
+
+    srand (1);
+    for (i = 0; i < N; i++)
+    {
+        double dvalue;
+        long lvalue;
+        int precision;
+
+        dvalue = (rand () - RAND_MAX / 2) / (double) (rand () % 10000 + 1);
+        precision = rand () % (FMT_PRECISION_MAX + 1);
+        COMPARE ("%.*f", precision, dvalue);
+
+        /* Values up to 2^53 with up to 3 decimal places are exact.  */
+        dvalue = ldexp (rand (), rand () % 22) + (rand () % 1000) / 8.0;
+        COMPARE ("%.3f %f", dvalue, dvalue);
+
+        /* Whole numbers up to FMT_FIXED_MAX are exact.  */
+        dvalue = ldexp (rand (), rand () % 36);
+        COMPARE ("%.1f", dvalue);
+
+        lvalue = rand () - RAND_MAX / 2;
+        COMPARE ("%ld %lx %12ld %-+12ld| %012ld %#lo", lvalue,
+                 (unsigned long) lvalue, lvalue, lvalue, lvalue,
+                 (unsigned long) lvalue);
+    }
+}
+
+
+static void
+unsupported_test (void)
+{
+    /* Unsupported conversions are output as is but the arguments of
+       the floating point ones are skipped.  */
+    EXPECT ("%e 1 %G 2 %La 3", "%e %d %G %d %La %d", 1.0, 1, 2.0, 2,
+            (long double) 3.0, 3);
+    EXPECT ("%y 4", "%y %d", 4);
+    EXPECT ("abc %", "abc %");
+}
+
+
+static void
+sink_test (void)
+{
+    int ret;
+
+    /* Literal text between conversions is passed in one go.  */
+    format ("abc %d def %s ghi\n", 1, "x");
+    if (sink_calls != 5)
+    {
+        printf ("Sink called %d times for 5 pieces\n", sink_calls);
+        errors++;
+    }
+
+    /* A failing sink aborts the output.  */
+    out_size = 0;
+    sink_calls = 0;
+    sink_fail_after = 2;
+    ret = fmt_printf (sink, 0, "abc %d def %s ghi\n", 1, "x");
+    sink_fail_after = 0;
+    if (ret != -1 || strcmp (out, "abc 1"))
+    {
+        printf ("Failing sink gave '%s' (%d)\n", out, ret);
+        errors++;
+    }
+}
+
+
+int
+main (void)
+{
+    integer_test ();
+    string_test ();
+    float_test ();
+    unsupported_test ();
+    sink_test ();
+    random_test ();
+
+    printf ("%s\n", errors ? "FAILED" : "PASSED");
+    return errors != 0;
+}
@@ -6,6 +6,7 @@
 #include "errno.h"
 #include "lusart.h"
 #include "peripherals.h"
+#include "fmt.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -31,11 +32,6 @@
 #endif
 
 
-#ifndef LUSART_SPRINTF_BUFFER_SIZE
-#define LUSART_SPRINTF_BUFFER_SIZE 128
-#endif
-
-
 struct lusart_dev_struct
 {
     void (*tx_irq_enable) (void);
@@ -220,13 +216,57 @@ lusart_putc (lusart_t lusart, char ch)
 }
 
 
+/** Copy text into the transmit buffer, in two pieces if it wraps
+    around.  As much as will fit is copied.  */
+static int
+lusart_write_text (void *lusart, const char *str, size_t size)
+{
+    lusart_dev_t *dev = lusart;
+    uint16_t tx_out;
+    uint16_t tx_in;
+    size_t semi_num;
+    size_t num;
+
+    // One byte is left free to distinguish a full buffer from an
+    // empty one.
+    tx_out = dev->tx_out;
+    tx_in = dev->tx_in;
+    if (tx_out > tx_in)
+        num = tx_out - tx_in - 1;
+    else
+        num = dev->tx_size - tx_in + tx_out - 1;
+    if (num > size)
+        num = size;
+
+    semi_num = dev->tx_size - tx_in;
+    if (semi_num > num)
+        semi_num = num;
+
+    memcpy (dev->tx_buffer + tx_in, str, semi_num);
+    memcpy (dev->tx_buffer, str + semi_num, num - semi_num);
+
+    tx_in += num;
+    if (tx_in >= dev->tx_size)
+        tx_in -= dev->tx_size;
+    dev->tx_in = tx_in;
+    dev->tx_irq_enable ();
+
+    if (num < size)
+    {
+        // Fail if cannot fit the text in buffer.
+        dev->tx_overruns++;
+        return -1;
+    }
+    return 0;
+}
+
+
 /** Write string.  */
 int
 lusart_puts (lusart_t lusart, const char *str)
 {
-    while (*str)
-        if (lusart_putc (lusart, *str++) < 0)
-            return -1;
+    if (lusart_write_text (lusart, str, strlen (str)) < 0)
+        return -1;
     return 1;
 }
 
@@ -237,35 +277,70 @@ char *
 lusart_gets (lusart_t lusart, char *buffer, int size)
 {
     lusart_dev_t *dev = lusart;
-    int i;
+    uint16_t rx_in;
+    uint16_t semi_num;
+    uint16_t num;
+    char *ptr;
 
     // rx_nl_in is incremented by the ISR whenever a newline is read.
     // rx_nl_out is incremented whenever lusart_getc returns a newline.
     // If they are the same, there are no unread lines.
-    if (dev->rx_nl_in == dev->rx_nl_out)
+    if (dev->rx_nl_in == dev->rx_nl_out || size < 2)
         return 0;
 
-    for (i = 0; i < size - 1; i++)
+    // The data is in up to two portions, from rx_out to the end of
+    // the buffer and from the start of the buffer to rx_in.
+    rx_in = dev->rx_in;
+    if (rx_in >= dev->rx_out)
     {
-        char ch;
-
-        ch = lusart_getc (dev);
-
-        // Have a problem since the newline count indicates we have data...
-        if (ch == (char) -1)
+        semi_num = rx_in - dev->rx_out;
+        num = semi_num;
+    }
+    else
+    {
+        semi_num = dev->rx_size - dev->rx_out;
+        num = semi_num + rx_in;
+    }
+    if (num > size - 1)
+        num = size - 1;
+    if (semi_num > num)
+        semi_num = num;
+
+    // Find the first newline
+    ptr = memchr (dev->rx_buffer + dev->rx_out, '\n', semi_num);
+    if (ptr)
+        num = ptr - (dev->rx_buffer + dev->rx_out) + 1;
+    else
+    {
+        ptr = memchr (dev->rx_buffer, '\n', num - semi_num);
+        if (ptr)
+            num = semi_num + ptr - dev->rx_buffer + 1;
+        else if (num < size - 1)
         {
-            dev->rx_nl_out == dev->rx_nl_in;
+            // Have a problem since the newline count indicates we
+            // have a line...
+            dev->rx_nl_out = dev->rx_nl_in;
             return 0;
         }
+    }
 
-        buffer[i] = ch;
-        if (ch == '\n')
-        {
-            i++;
-            break;
-        }
+    if (num > semi_num)
+    {
+        memcpy (buffer, dev->rx_buffer + dev->rx_out, semi_num);
+        memcpy (buffer + semi_num, dev->rx_buffer, num - semi_num);
+        dev->rx_out = num - semi_num;
+    }
+    else
+    {
+        memcpy (buffer, dev->rx_buffer + dev->rx_out, num);
+        dev->rx_out += num;
+        if (dev->rx_out >= dev->rx_size)
+            dev->rx_out = 0;
     }
-    buffer[i] = 0;
+    buffer[num] = 0;
+
+    if (ptr)
+        dev->rx_nl_out++;
 
     return buffer;
 }
@@ -274,16 +349,12 @@ lusart_gets (lusart_t lusart, char *buffer, int size)
 int
 lusart_printf (lusart_t lusart, const char *fmt, ...)
 {
-    // FIXME, long strings can overflow the buffer and thus be truncated.
-    char buffer[LUSART_SPRINTF_BUFFER_SIZE];
     va_list ap;
     int ret;
 
     va_start (ap, fmt);
-    ret = vsnprintf (buffer, sizeof (buffer), fmt, ap);
+    ret = fmt_vprintf (lusart_write_text, lusart, fmt, ap);
     va_end (ap);
-
-    lusart_puts (lusart, buffer);
     return ret;
 }
 
@@ -80,6 +80,9 @@ char *
 lusart_gets (lusart_t lusart, char *buffer, int size);
 
 
+/* Formatted write, see fmt.h for the supported conversions.  Output
+   that does not fit in the transmit buffer is dropped and -1 is
+   returned, otherwise the number of characters is returned.  */
 int
 lusart_printf (lusart_t lusart, const char *fmt, ...);
 
@@ -4,5 +4,6 @@ VPATH += $(LUSART_DIR)
 INCLUDES += -I$(LUSART_DIR)
 
 PERIPHERALS += usart
+DRIVERS += fmt
 
 SRC += lusart.c
@@ -0,0 +1,186 @@
+/** @file   mpring.h
+    @brief  Lock-free multiple producer ring buffer of fixed-size records.
+
+    ring_t, pring_t and the record rings are only safe with a single
+    writer.  This ring allows several writers (ISRs at different
+    priorities, or host threads) and several readers without masking
+    interrupts.  Like recring.h, it is a macro template;
+    MPRING_DEFINE (NAME, TYPE) defines NAME_t and static inline
+    functions NAME_init, NAME_push, NAME_pop, etc.  For example:
+
+    MPRING_DEFINE (log_ring, log_record_t)
+
+    static log_ring_slot_t log_slots[32];
+    static log_ring_t log_ring;
+
+    log_ring_init (&log_ring, log_slots, ARRAY_SIZE (log_slots));
+
+    Each slot has a sequence number as well as the element.  A writer
+    claims a slot by advancing the in count with compare-and-swap once
+    the slot's sequence number shows it is free, copies the element,
+    then publishes it by setting the sequence number.  Readers do the
+    same with the out count.  A writer interrupted between claiming
+    and publishing a slot does not block other writers but the
+    readers cannot get past that slot until it is published.
+
+    The number of slots must be a power of two and at least two; with
+    a single slot the sequence number of a full slot is the same as
+    that of a free one for the next lap.  This needs
+    compare-and-swap support (say LDREX/STREX on Cortex-M3 and above).
+*/
+
+#ifndef MPRING_H
+#define MPRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+
+
+typedef uint32_t mpring_size_t;
+
+
+/** The following macros should be considered private.  */
+
+#define MPRING_LOAD(VAR, ORDER) __atomic_load_n (&(VAR), __ATOMIC_ ## ORDER)
+
+#define MPRING_STORE(VAR, VALUE, ORDER) \
+    __atomic_store_n (&(VAR), (VALUE), __ATOMIC_ ## ORDER)
+
+/** Try to advance a count from *PEXPECTED; on failure *PEXPECTED is
+    updated to the current value.  */
+#define MPRING_CLAIM(VAR, PEXPECTED) \
+    __atomic_compare_exchange_n (&(VAR), (PEXPECTED), *(PEXPECTED) + 1, 1, \
+                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+
+/** Define lock-free ring buffer type NAME_t for elements of TYPE,
+    its slot type NAME_slot_t, and its functions.  */
+#define MPRING_DEFINE(NAME, TYPE)                                       \
+                                                                        \
+typedef struct NAME ## _slot_struct                                     \
+{                                                                       \
+    mpring_size_t seq;                                                  \
+    TYPE item;                                                          \
+} NAME ## _slot_t;                                                      \
+                                                                        \
+                                                                        \
+typedef struct NAME ## _struct                                          \
+{                                                                       \
+    NAME ## _slot_t *slots;                                             \
+    mpring_size_t mask;         /* Number of slots - 1.  */             \
+    mpring_size_t in;           /* Count of slots claimed to push.  */  \
+    mpring_size_t out;          /* Count of slots claimed to pop.  */   \
+} NAME ## _t;                                                           \
+                                                                        \
+                                                                        \
+/** Initialise ring to use array slots of size elements, a power of    \
+    two of at least two.  Return zero if the size is invalid.  This     \
+    must be called before the ring is used by more than one             \
+    context.  */                                                        \
+static inline bool                                                      \
+NAME ## _init (NAME ## _t *ring, NAME ## _slot_t *slots,                \
+               mpring_size_t size)                                      \
+{                                                                       \
+    mpring_size_t i;                                                    \
+                                                                        \
+    if (size < 2 || (size & (size - 1)))                                \
+        return 0;                                                       \
+                                                                        \
+    for (i = 0; i < size; i++)                                          \
+        slots[i].seq = i;                                               \
+                                                                        \
+    ring->slots = slots;                                                \
+    ring->mask = size - 1;                                              \
+    ring->in = ring->out = 0;                                           \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Return number of elements claimed for pushing less those claimed   \
+    for popping.  This is only a snapshot when there are several        \
+    writers or readers.  */                                             \
+static inline mpring_size_t                                             \
+NAME ## _num (NAME ## _t *ring)                                         \
+{                                                                       \
+    mpring_size_t out;                                                  \
+                                                                        \
+    out = MPRING_LOAD (ring->out, RELAXED);                             \
+    return MPRING_LOAD (ring->in, RELAXED) - out;                       \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Push copy of item.  This can be called concurrently by any number  \
+    of writers.  Return zero if full.  */                               \
+static inline bool                                                      \
+NAME ## _push (NAME ## _t *ring, const TYPE *item)                      \
+{                                                                       \
+    NAME ## _slot_t *slot;                                              \
+    mpring_size_t pos;                                                  \
+    int32_t diff;                                                       \
+                                                                        \
+    pos = MPRING_LOAD (ring->in, RELAXED);                              \
+    for (;;)                                                            \
+    {                                                                   \
+        slot = &ring->slots[pos & ring->mask];                          \
+        diff = (int32_t) (MPRING_LOAD (slot->seq, ACQUIRE) - pos);      \
+                                                                        \
+        /* The slot is free once popped for the previous lap.  */       \
+        if (diff == 0)                                                  \
+        {                                                               \
+            if (MPRING_CLAIM (ring->in, &pos))                          \
+                break;                                                  \
+        }                                                               \
+        else if (diff < 0)                                              \
+            return 0;                                                   \
+        else                                                            \
+            pos = MPRING_LOAD (ring->in, RELAXED);                      \
+    }                                                                   \
+                                                                        \
+    slot->item = *item;                                                 \
+    MPRING_STORE (slot->seq, pos + 1, RELEASE);                         \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Pop oldest element into item.  This can be called concurrently by  \
+    any number of readers.  Return zero if empty (or the oldest         \
+    element is still being pushed).  */                                 \
+static inline bool                                                      \
+NAME ## _pop (NAME ## _t *ring, TYPE *item)                             \
+{                                                                       \
+    NAME ## _slot_t *slot;                                              \
+    mpring_size_t pos;                                                  \
+    int32_t diff;                                                       \
+                                                                        \
+    pos = MPRING_LOAD (ring->out, RELAXED);                             \
+    for (;;)                                                            \
+    {                                                                   \
+        slot = &ring->slots[pos & ring->mask];                          \
+        diff = (int32_t) (MPRING_LOAD (slot->seq, ACQUIRE) - (pos + 1)); \
+                                                                        \
+        /* The slot is full once pushed for this lap.  */               \
+        if (diff == 0)                                                  \
+        {                                                               \
+            if (MPRING_CLAIM (ring->out, &pos))                         \
+                break;                                                  \
+        }                                                               \
+        else if (diff < 0)                                              \
+            return 0;                                                   \
+        else                                                            \
+            pos = MPRING_LOAD (ring->out, RELAXED);                     \
+    }                                                                   \
+                                                                        \
+    *item = slot->item;                                                 \
+    MPRING_STORE (slot->seq, pos + ring->mask + 1, RELEASE);            \
+    return 1;                                                           \
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
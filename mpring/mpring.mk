@@ -0,0 +1,4 @@
+MPRING_DIR = $(DRIVER_DIR)/mpring
+
+VPATH += $(MPRING_DIR)
+INCLUDES += -I$(MPRING_DIR)
@@ -16,6 +16,15 @@
 
    Some flash devices such as dataflash allow partial block writes
    but SD cards do not (although they can do partial block reads).
+
+   Requests spanning multiple whole blocks bypass the cache so that
+   drivers can use multiple block transfers.
+
+   The cache is write-through unless write-back has been enabled for
+   the device with msd_write_back_set.  With write-back, the dirty
+   block is written when the cache is needed for another block or
+   when msd_flush is called.  The user is responsible for calling
+   msd_flush (say after a timeout) so that data is not lost.
 */
 
 
@@ -41,27 +50,100 @@ typedef struct msd_cache_struct
 static msd_cache_t msd_cache;
 
 
+#if MSD_STATS
+#define MSD_STATS_ADD(msd, field, val) ((msd)->stats.field += (val))
+#define MSD_STATS_MAX(msd, field, val)          \
+    do                                          \
+    {                                           \
+        if ((val) > (msd)->stats.field)         \
+            (msd)->stats.field = (val);         \
+    } while (0)
+
+static void
+msd_stats_latency (uint32_t *histogram, uint32_t ticks)
+{
+    uint8_t bin;
+
+    for (bin = 0; ticks && bin < MSD_STATS_BINS - 1; bin++)
+        ticks >>= 1;
+    histogram[bin]++;
+}
+#define MSD_STATS_LATENCY(msd, field, start) \
+    msd_stats_latency ((msd)->stats.field, MSD_STATS_TICKS () - (start))
+#define MSD_STATS_START() MSD_STATS_TICKS ()
+#else
+#define MSD_STATS_ADD(msd, field, val)
+#define MSD_STATS_MAX(msd, field, val) do {} while (0)
+#define MSD_STATS_LATENCY(msd, field, start)
+#define MSD_STATS_START() 0
+#endif
+
+
+/* Read from the device, retrying on error.  */
 static msd_size_t
-msd_cache_flush (msd_t *msd)
+msd_dev_read (msd_t *msd, msd_addr_t addr, void *buffer, msd_size_t size)
 {
     msd_size_t bytes;
     int retries;
+    uint32_t start __unused__;
 
-    if (!msd_cache.dirty)
-        return MSD_CACHE_SIZE;
+    for (retries = 0; retries < MSD_RETRIES; retries++)
+    {
+        start = MSD_STATS_START ();
+        bytes = msd->ops->read (msd->handle, addr, buffer, size);
+        MSD_STATS_LATENCY (msd, read_latency, start);
+        MSD_STATS_ADD (msd, read_bytes, bytes);
+        msd->reads++;
+        if (bytes == size)
+            break;
+        msd->read_errors++;
+        MSD_STATS_ADD (msd, read_retries, 1);
+    }
+    return bytes;
+}
+
+
+/* Write to the device, retrying on error.  This assumes that the
+   write routine does any erasing if necessary.  */
+static msd_size_t
+msd_dev_write (msd_t *msd, msd_addr_t addr, const void *buffer,
+               msd_size_t size)
+{
+    msd_size_t bytes;
+    int retries;
+    uint32_t start __unused__;
 
-    /* This assumes that the write routine does any erasing if
-       necessary and that MSD_CACHE_SIZE is a multiple of the page
-       size.  */
     for (retries = 0; retries < MSD_RETRIES; retries++)
     {
-        bytes = msd->ops->write (msd_cache.msd->handle, msd_cache.addr,
-                                 msd_cache.data, MSD_CACHE_SIZE);
+        start = MSD_STATS_START ();
+        bytes = msd->ops->write (msd->handle, addr, buffer, size);
+        MSD_STATS_LATENCY (msd, write_latency, start);
+        MSD_STATS_ADD (msd, write_bytes, bytes);
         msd->writes++;
-        if (bytes == MSD_CACHE_SIZE)
+        if (bytes == size)
             break;
         msd->write_errors++;
+        MSD_STATS_ADD (msd, write_retries, 1);
     }
+    return bytes;
+}
+
+
+static msd_size_t
+msd_cache_flush (msd_t *msd)
+{
+    msd_size_t bytes;
+
+    if (!msd_cache.dirty)
+        return MSD_CACHE_SIZE;
+
+    /* The dirty data may belong to another device.  */
+    msd = msd_cache.msd;
+
+    /* This assumes that MSD_CACHE_SIZE is a multiple of the page
+       size.  */
+    bytes = msd_dev_write (msd, msd_cache.addr, msd_cache.data,
+                           MSD_CACHE_SIZE);
 
     msd_cache.dirty = 0;
 
@@ -73,22 +155,18 @@ static msd_size_t
 msd_cache_fill (msd_t *msd, msd_addr_t addr)
 {
     msd_size_t bytes;
-    int retries;
-
-    msd_cache_flush (msd_cache.msd);
 
     if (msd_cache.msd == msd && msd_cache.addr == addr)
-        return MSD_CACHE_SIZE;
-
-    for (retries = 0; retries < MSD_RETRIES; retries++)
     {
-        bytes = msd->ops->read (msd->handle, addr, msd_cache.data,
-                                MSD_CACHE_SIZE);
-        msd->reads++;
-        if (bytes == MSD_CACHE_SIZE)
-            break;
-        msd->read_errors++;
+        MSD_STATS_ADD (msd, cache_hits, 1);
+        return MSD_CACHE_SIZE;
     }
+    MSD_STATS_ADD (msd, cache_misses, 1);
+
+    if (msd_cache_flush (msd_cache.msd) != MSD_CACHE_SIZE)
+        return 0;
+
+    bytes = msd_dev_read (msd, addr, msd_cache.data, MSD_CACHE_SIZE);
 
     msd_cache.msd = msd;
     msd_cache.addr = addr;
@@ -96,6 +174,37 @@ msd_cache_fill (msd_t *msd, msd_addr_t addr)
 }
 
 
+/* Discard the clean cached block if it lies within a region that has
+   been written directly.  A block cached for another device is also
+   discarded since it may be the same data seen through a partition.  */
+static void
+msd_cache_invalidate (msd_t *msd, msd_addr_t addr, msd_size_t size)
+{
+    if (msd_cache.msd != msd || (msd_cache.addr >= addr
+                                 && msd_cache.addr < addr + size))
+        msd_cache.msd = 0;
+}
+
+
+bool
+msd_cache_bypass (msd_t *msd, msd_addr_t addr, msd_addr_t size, bool write)
+{
+    if (write)
+        msd->changes++;
+
+    if (msd_cache.msd != msd || msd_cache.addr >= addr + size
+        || msd_cache.addr + MSD_CACHE_SIZE <= addr)
+        return 1;
+
+    if (msd_cache_flush (msd) != MSD_CACHE_SIZE)
+        return 0;
+
+    if (write)
+        msd_cache.msd = 0;
+    return 1;
+}
+
+
 msd_size_t
 msd_read (msd_t *msd, msd_addr_t addr, void *buffer, msd_size_t size)
 {
@@ -105,6 +214,10 @@ msd_read (msd_t *msd, msd_addr_t addr, void *buffer, msd_size_t size)
     msd_size_t bytes;
     uint8_t *dst = buffer;
 
+    MSD_STATS_ADD (msd, read_requests, 1);
+    MSD_STATS_ADD (msd, read_request_bytes, size);
+    MSD_STATS_MAX (msd, read_request_max, size);
+
     block = addr / MSD_CACHE_SIZE;
     offset = addr - block * MSD_CACHE_SIZE;
     addr = addr - offset;
@@ -112,20 +225,32 @@ msd_read (msd_t *msd, msd_addr_t addr, void *buffer, msd_size_t size)
 
     while (size)
     {
-        /* If bytes == MSD_CACHE_SIZE and bytes < size then could read
-           directly to user's buffer since the cache will be
-           overwriten on next read.  */
+        bytes = size - size % MSD_CACHE_SIZE;
+        if (offset == 0 && bytes > MSD_CACHE_SIZE)
+        {
+            /* Read multiple whole blocks directly into the user's
+               buffer so that the driver can use a multiple block
+               transfer.  Any dirty block is written first in case
+               it is within the requested region.  */
+            if (msd_cache_flush (msd) != MSD_CACHE_SIZE)
+                return total;
 
-        bytes = msd_cache_fill (msd, addr);
-        /* Perhaps should return error.  */
-        if (bytes != MSD_CACHE_SIZE)
-            return total;
+            if (msd_dev_read (msd, addr, dst, bytes) != bytes)
+                return total;
+        }
+        else
+        {
+            bytes = msd_cache_fill (msd, addr);
+            /* Perhaps should return error.  */
+            if (bytes != MSD_CACHE_SIZE)
+                return total;
 
-        bytes = MIN (bytes - offset, size);
-        memcpy (dst, msd_cache.data + offset, bytes);
+            bytes = MIN (bytes - offset, size);
+            memcpy (dst, msd_cache.data + offset, bytes);
+        }
 
         size -= bytes;
-        addr += bytes;
+        addr += offset + bytes;
         dst += bytes;
         total += bytes;
         offset = 0;
@@ -144,6 +269,12 @@ msd_write (msd_t *msd, msd_addr_t addr, const void *buffer, msd_size_t size)
     msd_size_t bytes;
     const uint8_t *src = buffer;
 
+    MSD_STATS_ADD (msd, write_requests, 1);
+    MSD_STATS_ADD (msd, write_request_bytes, size);
+    MSD_STATS_MAX (msd, write_request_max, size);
+
+    msd->changes++;
+
     block = addr / MSD_CACHE_SIZE;
     offset = addr - block * MSD_CACHE_SIZE;
     addr = addr - offset;
@@ -151,6 +282,26 @@ msd_write (msd_t *msd, msd_addr_t addr, const void *buffer, msd_size_t size)
 
     while (size)
     {
+        bytes = size - size % MSD_CACHE_SIZE;
+        if (offset == 0 && bytes > MSD_CACHE_SIZE)
+        {
+            /* Write multiple whole blocks directly from the user's
+               buffer so that the driver can use a multiple block
+               transfer.  */
+            if (msd_cache_flush (msd) != MSD_CACHE_SIZE)
+                return total;
+            msd_cache_invalidate (msd, addr, bytes);
+
+            if (msd_dev_write (msd, addr, src, bytes) != bytes)
+                return total;
+
+            size -= bytes;
+            addr += bytes;
+            src += bytes;
+            total += bytes;
+            continue;
+        }
+
         if (offset != 0 || size < MSD_CACHE_SIZE)
         {
             /* Have a partial write so need to perform
@@ -176,16 +327,15 @@ msd_write (msd_t *msd, msd_addr_t addr, const void *buffer, msd_size_t size)
         memcpy (msd_cache.data + offset, src, bytes);
         msd_cache.dirty = 1;
 
-        /* Implement write-through policy for now to ensure that data
-           hits storage.  This is inefficient for many small
-           writes and for large page sizes.  */
-
-        if (msd_cache_flush (msd) != MSD_CACHE_SIZE)
+        /* With the write-through policy, data hits storage before
+           returning.  This is inefficient for many small writes and
+           for large page sizes.  */
+        if (!msd->flags.write_back
+            && msd_cache_flush (msd) != MSD_CACHE_SIZE)
             return total;
-        /* Perhaps should return error.  */
 
         size -= bytes;
-        addr += bytes;
+        addr += offset + bytes;
         src += bytes;
         total += bytes;
         offset = 0;
@@ -219,3 +369,98 @@ msd_shutdown (msd_t *msd)
     if (msd->ops->shutdown)
         msd->ops->shutdown (msd->handle);
 }
+
+
+bool
+msd_flush (msd_t *msd)
+{
+    bool ok = 1;
+
+    if (msd_cache.dirty && msd_cache.msd == msd)
+        ok = msd_cache_flush (msd) == MSD_CACHE_SIZE;
+
+    if (msd->ops->flush && !msd->ops->flush (msd->handle))
+        ok = 0;
+
+    return ok;
+}
+
+
+bool
+msd_dirty_p (msd_t *msd)
+{
+    return msd_cache.dirty && msd_cache.msd == msd;
+}
+
+
+void
+msd_write_back_set (msd_t *msd, bool enable)
+{
+    if (!enable)
+        msd_flush (msd);
+
+    msd->flags.write_back = enable;
+}
+
+
+bool
+msd_discard (msd_t *msd, msd_addr_t addr, msd_addr_t size)
+{
+    msd_size_t block_bytes;
+    msd_addr_t end;
+
+    if (!msd->ops->discard)
+        return 0;
+
+    block_bytes = msd->block_bytes ? msd->block_bytes : MSD_CACHE_SIZE;
+
+    /* Round inwards to whole blocks.  */
+    end = (addr + size) / block_bytes * block_bytes;
+    addr = (addr + block_bytes - 1) / block_bytes * block_bytes;
+    if (addr >= end)
+        return 1;
+
+    msd->changes++;
+
+    /* A block cached for another device may be the same data seen
+       through a partition so it is written and discarded.  */
+    if (msd_cache.msd && msd_cache.msd != msd)
+    {
+        if (msd_cache_flush (msd_cache.msd) != MSD_CACHE_SIZE)
+            return 0;
+        msd_cache.msd = 0;
+    }
+
+    /* Cached data within the region is stale, even if dirty.  A
+       block that is only partly discarded must be written first.  */
+    if (msd_cache.msd == msd && msd_cache.addr < end
+        && msd_cache.addr + MSD_CACHE_SIZE > addr)
+    {
+        if (msd_cache.addr < addr || msd_cache.addr + MSD_CACHE_SIZE > end)
+            msd_cache_flush (msd);
+        msd_cache.msd = 0;
+        msd_cache.dirty = 0;
+    }
+
+    return msd->ops->discard (msd->handle, addr, end - addr);
+}
+
+
+void
+msd_stats_get (msd_t *msd, msd_stats_t *stats)
+{
+#if MSD_STATS
+    *stats = msd->stats;
+#else
+    memset (stats, 0, sizeof (*stats));
+#endif
+}
+
+
+void
+msd_stats_reset (msd_t *msd __unused__)
+{
+#if MSD_STATS
+    memset (&msd->stats, 0, sizeof (msd->stats));
+#endif
+}
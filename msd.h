@@ -16,6 +16,25 @@ typedef uint64_t msd_addr_t;
 #define MSD_BLOCK_SIZE_MAX 512
 #endif
 
+
+/* Set MSD_STATS to 1 in config.h to collect detailed statistics.
+   For latency histograms, MSD_STATS_TICKS() should also be defined to
+   return a free-running 32-bit tick count.  */
+#ifndef MSD_STATS
+#define MSD_STATS 0
+#endif
+
+#ifndef MSD_STATS_TICKS
+#define MSD_STATS_TICKS() 0
+#endif
+
+/* Number of log2 latency histogram bins.  Bin 0 is for zero ticks,
+   bin n is for 2^(n-1) to 2^n - 1 ticks, and the last bin collects
+   everything longer.  */
+#ifndef MSD_STATS_BINS
+#define MSD_STATS_BINS 16
+#endif
+
 typedef enum
 {
     MSD_STATUS_READY,
@@ -30,10 +49,33 @@ typedef struct
     unsigned int volatile1:1;
     unsigned int partial_read:1;
     unsigned int partial_write:1;
-    unsigned int reserved:4;
+    unsigned int write_back:1;
+    unsigned int reserved:3;
 } msd_flags_t;
 
 
+typedef struct msd_stats_struct
+{
+    /* Number of msd_read/msd_write requests and their sizes.  */
+    uint32_t read_requests;
+    uint32_t write_requests;
+    uint64_t read_request_bytes;
+    uint64_t write_request_bytes;
+    msd_size_t read_request_max;
+    msd_size_t write_request_max;
+    /* Bytes transferred to/from the device.  */
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint32_t read_retries;
+    uint32_t write_retries;
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    /* Histograms of device read/write latencies.  */
+    uint32_t read_latency[MSD_STATS_BINS];
+    uint32_t write_latency[MSD_STATS_BINS];
+} msd_stats_t;
+
+
 typedef msd_addr_t
 (*msd_probe_t)(void *handle);
 
@@ -54,6 +96,14 @@ typedef void
 (*msd_shutdown_t)(void *shutdown);
 
 
+typedef bool
+(*msd_flush_t)(void *handle);
+
+
+typedef bool
+(*msd_discard_t)(void *handle, msd_addr_t addr, msd_addr_t size);
+
+
 typedef struct msd_ops_struct
 {
     msd_probe_t probe;
@@ -61,6 +111,8 @@ typedef struct msd_ops_struct
     msd_write_t write;
     msd_status_get_t status_get;
     msd_shutdown_t shutdown;
+    msd_flush_t flush;
+    msd_discard_t discard;
 } msd_ops_t;
 
 
@@ -72,10 +124,16 @@ typedef struct msd_struct
     msd_size_t block_bytes;
     uint32_t reads;
     uint32_t writes;
+    /* Incremented by every write or discard so that a user holding a
+       copy of the data can tell when it may be stale.  */
+    uint32_t changes;
     uint16_t read_errors;
     uint16_t write_errors;
     const char *name;
     msd_flags_t flags;
+#if MSD_STATS
+    msd_stats_t stats;
+#endif
 } msd_t;
 
 
@@ -89,6 +147,38 @@ msd_status_t msd_status_get (msd_t *msd);
 
 void msd_shutdown (msd_t *msd);
 
+/* Write any cached data to the device and wait for the device to
+   commit it.  Return false on error.  */
+bool msd_flush (msd_t *msd);
+
+/* Return true if there is cached data that has not been written.  */
+bool msd_dirty_p (msd_t *msd);
+
+/* With write-back enabled, writes are held in the cache until
+   msd_flush is called or the cache is needed for another block.  */
+void msd_write_back_set (msd_t *msd, bool enable);
+
+/* Prepare for accessing a region of the device with its driver
+   operations rather than msd_read or msd_write.  A dirty cached block
+   overlapping the region is written and, if WRITE is set, the cached
+   block is discarded since it will become stale and the write is
+   counted in msd->changes.  Return false if the cached block could
+   not be written.  */
+bool msd_cache_bypass (msd_t *msd, msd_addr_t addr, msd_addr_t size,
+                       bool write);
+
+/* Tell the device that the data in a region is no longer needed so
+   that a flash device can reclaim it.  Only the whole blocks within
+   the region are discarded; reading them afterwards returns
+   undefined data.  Return false if the device does not support this
+   or on error.  */
+bool msd_discard (msd_t *msd, msd_addr_t addr, msd_addr_t size);
+
+/* Copy the statistics; these are all zero if MSD_STATS is 0.  */
+void msd_stats_get (msd_t *msd, msd_stats_t *stats);
+
+void msd_stats_reset (msd_t *msd);
+
 static inline msd_addr_t msd_media_bytes_get (msd_t *msd)
 {
     if (!msd)
@@ -97,6 +187,40 @@ static inline msd_addr_t msd_media_bytes_get (msd_t *msd)
 }
 
 
+static inline bool msd_discard_p (msd_t *msd)
+{
+    return msd->ops->discard != 0;
+}
+
+
+static inline msd_size_t msd_stats_read_average (const msd_stats_t *stats)
+{
+    if (!stats->read_requests)
+        return 0;
+    return stats->read_request_bytes / stats->read_requests;
+}
+
+
+static inline msd_size_t msd_stats_write_average (const msd_stats_t *stats)
+{
+    if (!stats->write_requests)
+        return 0;
+    return stats->write_request_bytes / stats->write_requests;
+}
+
+
+/* Return cache hit ratio as a percentage.  */
+static inline uint8_t msd_stats_cache_hit_percent (const msd_stats_t *stats)
+{
+    uint32_t total;
+
+    total = stats->cache_hits + stats->cache_misses;
+    if (!total)
+        return 0;
+    return (uint64_t)stats->cache_hits * 100 / total;
+}
+
+
 #ifdef __cplusplus
 }
 #endif    
@@ -0,0 +1,216 @@
+/** @file   msd_partition.c
+    @brief  Mass storage device for a partition of another device.
+*/
+
+#include "msd_partition.h"
+#include <string.h>
+
+/* This presents a region of a parent device as a device in its own
+   right so that a partition can be mounted or exported as a separate
+   USB LUN without the user having to add offsets.
+
+   Accesses go directly to the parent's driver operations rather than
+   through msd_read/msd_write so that data is not cached twice and the
+   partition's statistics are kept separately from the parent's.  The
+   parent's cached block is written (and for a write, discarded)
+   first so that the two views of the device agree.  */
+
+
+#ifndef MSD_PARTITION_NUM
+#define MSD_PARTITION_NUM 4
+#endif
+
+/* The MBR partition table is at offset 446 in the first sector and
+   has 4 entries of 16 bytes.  */
+enum {MSD_PARTITION_MBR_SIZE = 512,
+      MSD_PARTITION_MBR_TABLE = 446,
+      MSD_PARTITION_MBR_ENTRY_SIZE = 16};
+
+enum {MSD_PARTITION_SECTOR_SIZE = 512};
+
+
+typedef struct
+{
+    msd_t msd;
+    msd_t *parent;
+    msd_addr_t offset;
+} msd_partition_dev_t;
+
+
+static uint8_t msd_partition_devices_num = 0;
+static msd_partition_dev_t msd_partition_devices[MSD_PARTITION_NUM];
+
+
+static msd_addr_t
+msd_partition_probe (void *handle)
+{
+    msd_partition_dev_t *dev = handle;
+
+    return dev->msd.media_bytes;
+}
+
+
+/* Accesses must be of whole blocks within the partition.  */
+static bool
+msd_partition_valid_p (msd_partition_dev_t *dev, msd_addr_t addr,
+                       msd_addr_t size)
+{
+    msd_size_t block_bytes = dev->msd.block_bytes;
+
+    if (addr + size > dev->msd.media_bytes || addr + size < addr)
+        return 0;
+
+    return !block_bytes || (addr % block_bytes == 0
+                            && size % block_bytes == 0);
+}
+
+
+static msd_size_t
+msd_partition_read (void *handle, msd_addr_t addr, void *buffer,
+                    msd_size_t size)
+{
+    msd_partition_dev_t *dev = handle;
+    msd_t *parent = dev->parent;
+
+    if (!msd_partition_valid_p (dev, addr, size))
+        return 0;
+
+    if (!msd_cache_bypass (parent, dev->offset + addr, size, 0))
+        return 0;
+
+    return parent->ops->read (parent->handle, dev->offset + addr,
+                              buffer, size);
+}
+
+
+static msd_size_t
+msd_partition_write (void *handle, msd_addr_t addr, const void *buffer,
+                     msd_size_t size)
+{
+    msd_partition_dev_t *dev = handle;
+    msd_t *parent = dev->parent;
+
+    if (!msd_partition_valid_p (dev, addr, size))
+        return 0;
+
+    if (!msd_cache_bypass (parent, dev->offset + addr, size, 1))
+        return 0;
+
+    return parent->ops->write (parent->handle, dev->offset + addr,
+                               buffer, size);
+}
+
+
+static msd_status_t
+msd_partition_status_get (void *handle)
+{
+    msd_partition_dev_t *dev = handle;
+
+    return msd_status_get (dev->parent);
+}
+
+
+static bool
+msd_partition_flush (void *handle)
+{
+    msd_partition_dev_t *dev = handle;
+
+    return msd_flush (dev->parent);
+}
+
+
+static bool
+msd_partition_discard (void *handle, msd_addr_t addr, msd_addr_t size)
+{
+    msd_partition_dev_t *dev = handle;
+
+    if (addr + size > dev->msd.media_bytes)
+        return 0;
+
+    return msd_discard (dev->parent, dev->offset + addr, size);
+}
+
+
+static const msd_ops_t msd_partition_ops =
+{
+    .probe = msd_partition_probe,
+    .read = msd_partition_read,
+    .write = msd_partition_write,
+    .status_get = msd_partition_status_get,
+    .flush = msd_partition_flush,
+    .discard = msd_partition_discard,
+};
+
+
+msd_t *
+msd_partition_init (msd_t *parent, msd_addr_t offset, msd_addr_t bytes)
+{
+    msd_partition_dev_t *dev;
+
+    if (!parent || offset >= parent->media_bytes)
+        return 0;
+
+    if (parent->block_bytes && offset % parent->block_bytes)
+        return 0;
+
+    if (!bytes)
+        bytes = parent->media_bytes - offset;
+
+    if (bytes > parent->media_bytes - offset)
+        return 0;
+
+    if (msd_partition_devices_num >= MSD_PARTITION_NUM)
+        return 0;
+    dev = msd_partition_devices + msd_partition_devices_num++;
+
+    memset (dev, 0, sizeof (*dev));
+    dev->parent = parent;
+    dev->offset = offset;
+
+    dev->msd.handle = dev;
+    dev->msd.ops = &msd_partition_ops;
+    dev->msd.media_bytes = bytes;
+    dev->msd.block_bytes = parent->block_bytes;
+    dev->msd.flags = parent->flags;
+    /* Only whole blocks can be accessed; see msd_partition_valid_p.  */
+    dev->msd.flags.partial_read = 0;
+    dev->msd.flags.partial_write = 0;
+    dev->msd.name = parent->name;
+    return &dev->msd;
+}
+
+
+msd_t *
+msd_partition_mbr_init (msd_t *parent, uint8_t index)
+{
+    uint8_t mbr[MSD_PARTITION_MBR_SIZE];
+    const uint8_t *entry;
+    uint32_t start;
+    uint32_t sectors;
+
+    if (index >= 4)
+        return 0;
+
+    if (msd_read (parent, 0, mbr, sizeof (mbr)) != sizeof (mbr))
+        return 0;
+
+    if (mbr[510] != 0x55 || mbr[511] != 0xaa)
+        return 0;
+
+    entry = mbr + MSD_PARTITION_MBR_TABLE
+        + index * MSD_PARTITION_MBR_ENTRY_SIZE;
+
+    /* Partition type 0 denotes an unused entry.  */
+    if (!entry[4])
+        return 0;
+
+    /* The start LBA and number of sectors are little endian.  */
+    start = entry[8] | (entry[9] << 8) | (entry[10] << 16)
+        | ((uint32_t)entry[11] << 24);
+    sectors = entry[12] | (entry[13] << 8) | (entry[14] << 16)
+        | ((uint32_t)entry[15] << 24);
+
+    return msd_partition_init (parent,
+                               (msd_addr_t)start * MSD_PARTITION_SECTOR_SIZE,
+                               (msd_addr_t)sectors * MSD_PARTITION_SECTOR_SIZE);
+}
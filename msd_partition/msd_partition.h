@@ -0,0 +1,32 @@
+/** @file   msd_partition.h
+    @brief  Mass storage device for a partition of another device.
+*/
+
+#ifndef MSD_PARTITION_H
+#define MSD_PARTITION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include "config.h"
+#include "msd.h"
+
+
+/* Create a device for the region of PARENT starting at byte OFFSET
+   and of size BYTES.  OFFSET must be a multiple of the parent's block
+   size.  If BYTES is zero, the region extends to the end of PARENT.  */
+msd_t *msd_partition_init (msd_t *parent, msd_addr_t offset,
+                           msd_addr_t bytes);
+
+
+/* Create a device for the primary partition INDEX (0 to 3) described
+   by the MBR of PARENT.  */
+msd_t *msd_partition_mbr_init (msd_t *parent, uint8_t index);
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
@@ -0,0 +1,6 @@
+MSD_PARTITION_DIR = $(DRIVER_DIR)/msd_partition
+
+VPATH += $(MSD_PARTITION_DIR)
+INCLUDES += -I$(MSD_PARTITION_DIR)
+
+SRC += msd_partition.c msd.c
@@ -0,0 +1,19 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __unused__ __attribute__((unused))
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
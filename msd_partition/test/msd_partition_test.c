@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "msd_partition.h"
+#include "file_msd.h"
+
+/* Exercise msd_partition.c on a device backed by a file: parsing of
+   the MBR, rejection of bad accesses, accesses at the partition
+   offset, and coherence of the cached data seen through the parent
+   and through a partition.  */
+
+#define FILENAME "msd_partition_test.img"
+
+#define BLOCK_SIZE 512
+
+#define BLOCKS 64
+
+/* Start and size in blocks of the partitions in the MBR.  */
+#define P0_START 8
+#define P0_BLOCKS 16
+#define P1_START 24
+#define P1_BLOCKS 40
+
+
+static uint8_t ref[BLOCKS * BLOCK_SIZE];
+static uint8_t buffer[BLOCKS * BLOCK_SIZE];
+
+
+static int
+check (bool ok, const char *what, int line)
+{
+    if (!ok)
+        printf ("Line %d: %s failed\n", line, what);
+    return !ok;
+}
+
+#define CHECK(ok) check ((ok), #ok, __LINE__)
+
+
+static void
+mbr_entry_set (uint8_t *mbr, unsigned int index, uint8_t type,
+               uint32_t start, uint32_t sectors)
+{
+    uint8_t *entry = mbr + 446 + index * 16;
+    unsigned int i;
+
+    memset (entry, 0, 16);
+    entry[4] = type;
+    for (i = 0; i < 4; i++)
+    {
+        entry[8 + i] = start >> (i * 8);
+        entry[12 + i] = sectors >> (i * 8);
+    }
+}
+
+
+/* Write data through DEV at ADDR, relative to the start of the
+   parent, and update the reference copy.  */
+static int
+data_write (msd_t *dev, msd_addr_t offset, msd_addr_t addr, msd_size_t size)
+{
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
+        ref[offset + addr + i] = rand ();
+
+    if (msd_write (dev, addr, ref + offset + addr, size) != size)
+        return 1;
+    return 0;
+}
+
+
+/* Read data through DEV at ADDR and compare with the reference.  */
+static int
+data_read (msd_t *dev, msd_addr_t offset, msd_addr_t addr, msd_size_t size)
+{
+    if (msd_read (dev, addr, buffer, size) != size)
+        return 1;
+    return memcmp (ref + offset + addr, buffer, size) != 0;
+}
+
+
+static int
+mbr_test (msd_t *parent, msd_t **p0, msd_t **p1)
+{
+    uint8_t *mbr = ref;
+    int errors = 0;
+
+    memset (mbr, 0, BLOCK_SIZE);
+    mbr_entry_set (mbr, 0, 0x0c, P0_START, P0_BLOCKS);
+    mbr_entry_set (mbr, 1, 0x83, P1_START, P1_BLOCKS);
+    // Entry 2 is unused and entry 3 extends past the end
+    mbr_entry_set (mbr, 3, 0x83, BLOCKS - 4, 8);
+    errors += CHECK (msd_write (parent, 0, mbr, BLOCK_SIZE) == BLOCK_SIZE);
+
+    // Without the signature there is no partition table
+    errors += CHECK (!msd_partition_mbr_init (parent, 0));
+
+    mbr[510] = 0x55;
+    mbr[511] = 0xaa;
+    errors += CHECK (msd_write (parent, 0, mbr, BLOCK_SIZE) == BLOCK_SIZE);
+
+    *p0 = msd_partition_mbr_init (parent, 0);
+    *p1 = msd_partition_mbr_init (parent, 1);
+    errors += CHECK (*p0 && (*p0)->media_bytes == P0_BLOCKS * BLOCK_SIZE);
+    errors += CHECK (*p1 && (*p1)->media_bytes == P1_BLOCKS * BLOCK_SIZE);
+    errors += CHECK (!msd_partition_mbr_init (parent, 2));
+    errors += CHECK (!msd_partition_mbr_init (parent, 3));
+    errors += CHECK (!msd_partition_mbr_init (parent, 4));
+    return errors;
+}
+
+
+static int
+init_test (msd_t *parent, msd_t *p0)
+{
+    int errors = 0;
+
+    errors += CHECK (!msd_partition_init (0, 0, 0));
+    errors += CHECK (!msd_partition_init (parent, 100, BLOCK_SIZE));
+    errors += CHECK (!msd_partition_init (parent, BLOCKS * BLOCK_SIZE, 0));
+    errors += CHECK (!msd_partition_init (parent, BLOCK_SIZE,
+                                          BLOCKS * BLOCK_SIZE));
+
+    // The partition cannot be accessed in part blocks
+    errors += CHECK (parent->flags.partial_read && parent->flags.partial_write);
+    errors += CHECK (!p0->flags.partial_read && !p0->flags.partial_write);
+    errors += CHECK (p0->block_bytes == BLOCK_SIZE);
+    return errors;
+}
+
+
+/* Accesses by the driver operations must be of whole blocks within
+   the partition.  */
+static int
+valid_test (msd_t *p0)
+{
+    msd_addr_t end = p0->media_bytes;
+    int errors = 0;
+
+    errors += CHECK (p0->ops->read (p0->handle, 0, buffer, BLOCK_SIZE)
+                     == BLOCK_SIZE);
+    errors += CHECK (p0->ops->read (p0->handle, end - BLOCK_SIZE, buffer,
+                                    BLOCK_SIZE) == BLOCK_SIZE);
+
+    errors += CHECK (!p0->ops->read (p0->handle, 100, buffer, BLOCK_SIZE));
+    errors += CHECK (!p0->ops->read (p0->handle, 0, buffer, 100));
+    errors += CHECK (!p0->ops->read (p0->handle, end, buffer, BLOCK_SIZE));
+    errors += CHECK (!p0->ops->read (p0->handle, end - BLOCK_SIZE, buffer,
+                                     2 * BLOCK_SIZE));
+    errors += CHECK (!p0->ops->read (p0->handle, (msd_addr_t)-BLOCK_SIZE,
+                                     buffer, 2 * BLOCK_SIZE));
+
+    errors += CHECK (!p0->ops->write (p0->handle, 100, buffer, BLOCK_SIZE));
+    errors += CHECK (!p0->ops->write (p0->handle, 0, buffer, 100));
+    errors += CHECK (!p0->ops->write (p0->handle, end, buffer, BLOCK_SIZE));
+
+    errors += CHECK (!p0->ops->discard (p0->handle, end - BLOCK_SIZE,
+                                        2 * BLOCK_SIZE));
+    return errors;
+}
+
+
+/* Data written through one view is read at the right place through
+   the other.  */
+static int
+offset_test (msd_t *parent, msd_t *p0, msd_t *p1)
+{
+    msd_addr_t offset0 = P0_START * BLOCK_SIZE;
+    msd_addr_t offset1 = P1_START * BLOCK_SIZE;
+    int errors = 0;
+
+    errors += data_write (p0, offset0, 0, 3 * BLOCK_SIZE);
+    errors += data_write (p1, offset1, P1_BLOCKS * BLOCK_SIZE - BLOCK_SIZE,
+                          BLOCK_SIZE);
+    errors += data_read (parent, 0, 0, BLOCKS * BLOCK_SIZE / 2);
+    errors += data_read (parent, 0, BLOCKS * BLOCK_SIZE / 2,
+                         BLOCKS * BLOCK_SIZE / 2);
+
+    errors += data_write (parent, 0, offset0 + BLOCK_SIZE, 2 * BLOCK_SIZE);
+    errors += data_read (p0, offset0, 0, P0_BLOCKS * BLOCK_SIZE);
+
+    // Part block accesses go through the cache
+    errors += data_write (p0, offset0, 700, 100);
+    errors += data_read (p0, offset0, 650, 200);
+    errors += data_read (parent, 0, offset0 + 512, 512);
+    errors += data_read (p1, offset1, 0, P1_BLOCKS * BLOCK_SIZE);
+
+    // Accesses past the end of a partition fail
+    errors += CHECK (msd_read (p0, P0_BLOCKS * BLOCK_SIZE, buffer,
+                               BLOCK_SIZE) == 0);
+    errors += CHECK (msd_write (p0, P0_BLOCKS * BLOCK_SIZE, buffer,
+                                BLOCK_SIZE) == 0);
+    errors += data_read (parent, 0, 0, BLOCKS * BLOCK_SIZE / 2);
+    return errors;
+}
+
+
+/* The single cached block is shared by the parent and the partition
+   so each view must see writes made through the other, including
+   the multiple block writes that bypass the cache.  */
+static int
+cache_test (msd_t *parent, msd_t *p0)
+{
+    msd_addr_t offset0 = P0_START * BLOCK_SIZE;
+    int errors = 0;
+
+    // A clean block of the partition is cached
+    errors += data_read (p0, offset0, 10, 20);
+    errors += data_write (parent, 0, offset0, 2 * BLOCK_SIZE);
+    errors += data_read (p0, offset0, 10, 20);
+
+    // A clean block of the parent is cached
+    errors += data_read (parent, 0, offset0 + 10, 20);
+    errors += data_write (p0, offset0, 0, 2 * BLOCK_SIZE);
+    errors += data_read (parent, 0, offset0 + 10, 20);
+
+    // A dirty block of the parent is cached
+    msd_write_back_set (parent, 1);
+    errors += data_write (parent, 0, offset0 + 100, 10);
+    errors += CHECK (msd_dirty_p (parent));
+    errors += data_read (p0, offset0, 0, 2 * BLOCK_SIZE);
+    errors += data_write (parent, 0, offset0 + 200, 10);
+    errors += data_write (p0, offset0, 0, 2 * BLOCK_SIZE);
+    errors += data_read (parent, 0, offset0 + 100, 200);
+    errors += CHECK (msd_flush (parent));
+    msd_write_back_set (parent, 0);
+
+    // A dirty block of the partition is cached
+    msd_write_back_set (p0, 1);
+    errors += data_write (p0, offset0, 30, 10);
+    errors += CHECK (msd_dirty_p (p0));
+    errors += data_read (parent, 0, offset0, 2 * BLOCK_SIZE);
+    errors += data_write (p0, offset0, 40, 10);
+    errors += data_write (parent, 0, offset0, 2 * BLOCK_SIZE);
+    errors += data_read (p0, offset0, 0, 100);
+    errors += CHECK (msd_flush (p0));
+    msd_write_back_set (p0, 0);
+
+    // Discarding through the parent a block cached for the partition
+    errors += data_read (p0, offset0, 10, 20);
+    errors += CHECK (msd_discard (parent, offset0, 2 * BLOCK_SIZE));
+    memset (ref + offset0, 0, 2 * BLOCK_SIZE);
+    errors += data_read (p0, offset0, 10, 20);
+
+    // Discarding through the partition a block cached for the parent
+    errors += data_write (parent, 0, offset0, 2 * BLOCK_SIZE);
+    errors += data_read (parent, 0, offset0 + 10, 20);
+    errors += CHECK (msd_discard (p0, 0, 2 * BLOCK_SIZE));
+    memset (ref + offset0, 0, 2 * BLOCK_SIZE);
+    errors += data_read (parent, 0, offset0 + 10, 20);
+
+    errors += data_read (parent, 0, 0, BLOCKS * BLOCK_SIZE / 2);
+    return errors;
+}
+
+
+int
+main (void)
+{
+    file_msd_cfg_t cfg;
+    msd_t *parent;
+    msd_t *p0 = 0;
+    msd_t *p1 = 0;
+    int errors = 0;
+
+    memset (&cfg, 0, sizeof (cfg));
+    cfg.filename = FILENAME;
+    cfg.media_bytes = sizeof (ref);
+    cfg.partial_read = 1;
+    cfg.partial_write = 1;
+
+    remove (FILENAME);
+    srand (1);
+
+    parent = file_msd_init (&cfg);
+    if (!parent)
+    {
+        printf ("Cannot create %s\n", FILENAME);
+        return 1;
+    }
+
+    errors += mbr_test (parent, &p0, &p1);
+    if (!p0 || !p1)
+    {
+        printf ("FAILED\n");
+        return 1;
+    }
+    errors += init_test (parent, p0);
+    errors += valid_test (p0);
+    errors += offset_test (parent, p0, p1);
+    errors += cache_test (parent, p0);
+
+    remove (FILENAME);
+
+    if (errors)
+    {
+        printf ("%d errors\nFAILED\n", errors);
+        return 1;
+    }
+    printf ("PASSED\n");
+    return 0;
+}
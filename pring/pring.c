@@ -0,0 +1,129 @@
+/** @file   pring.c
+    @brief  Power-of-two ring buffer implementation.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "pring.h"
+
+
+/** Initialise a ring buffer structure to use a specified buffer.
+    @param pring pointer to ring buffer structure, if 0 it is malloced
+    @param buffer pointer to memory buffer, if 0 it is malloced
+    @param size size of memory buffer in bytes, must be a power of two
+    @return pointer to ring buffer structure or zero if error.  */
+pring_t *
+pring_init (pring_t *pring, void *buffer, pring_size_t size)
+{
+    bool allocated = 0;
+
+    if (!size || (size & (size - 1)))
+        return 0;
+
+    if (! pring)
+    {
+        pring = malloc (sizeof (*pring));
+        if (! pring)
+            return 0;
+        allocated = 1;
+    }
+
+    if (! buffer)
+        buffer = calloc (1, size);
+    if (! buffer)
+    {
+        if (allocated)
+            free (pring);
+        return 0;
+    }
+
+    pring->buffer = buffer;
+    pring->mask = size - 1;
+
+    pring_clear (pring);
+
+    return pring;
+}
+
+
+/** Read from a ring buffer.
+    @param pring pointer to ring buffer structure
+    @param buffer pointer to memory buffer
+    @param size maximum number of bytes to read
+    @return number of bytes actually read.  */
+pring_size_t
+pring_read (pring_t *pring, void *buffer, pring_size_t size)
+{
+    pring_size_t out;
+    pring_size_t count;
+    pring_size_t offset;
+    pring_size_t semi_num;
+    char *buf = buffer;
+
+    out = PRING_LOAD_RELAXED (pring->out);
+    count = PRING_LOAD_ACQUIRE (pring->in) - out;
+    if (size > count)
+        size = count;
+
+    if (!size)
+        return 0;
+
+    /* Copy the portion up to the end of the buffer and then any
+       remainder from the start.  */
+    offset = out & pring->mask;
+    semi_num = pring->mask + 1 - offset;
+    if (semi_num > size)
+        semi_num = size;
+
+    memcpy (buf, pring->buffer + offset, semi_num);
+    memcpy (buf + semi_num, pring->buffer, size - semi_num);
+
+    PRING_STORE_RELEASE (pring->out, out + size);
+    return size;
+}
+
+
+/** Write to a ring buffer.  Nothing is written unless all the bytes fit.
+    @param pring pointer to ring buffer structure
+    @param buffer pointer to memory buffer
+    @param size number of bytes to write
+    @return number of bytes actually written.  */
+pring_size_t
+pring_write (pring_t *pring, const void *buffer, pring_size_t size)
+{
+    pring_size_t in;
+    pring_size_t offset;
+    pring_size_t semi_num;
+    const char *buf = buffer;
+
+    in = PRING_LOAD_RELAXED (pring->in);
+
+    /* Only write into ring buffer if can fit all the bytes.
+       This is important if writing integers, structs, etc.  */
+    if (pring->mask + 1 - (in - PRING_LOAD_ACQUIRE (pring->out)) < size)
+        return 0;
+
+    if (!size)
+        return 0;
+
+    offset = in & pring->mask;
+    semi_num = pring->mask + 1 - offset;
+    if (semi_num > size)
+        semi_num = size;
+
+    memcpy (pring->buffer + offset, buf, semi_num);
+    memcpy (pring->buffer, buf + semi_num, size - semi_num);
+
+    PRING_STORE_RELEASE (pring->in, in + size);
+    return size;
+}
+
+
+/** Empties the ring buffer.  This must not be called while
+    the ring buffer is being read or written.
+    @param pring pointer to ring buffer structure.  */
+void
+pring_clear (pring_t *pring)
+{
+    pring->in = pring->out = 0;
+}
@@ -0,0 +1,192 @@
+/** @file   pring.h
+    @brief  Power-of-two ring buffer interface.
+
+    This is an alternative to ring_t for large buffers or where the
+    per-byte cost matters.  The size must be a power of two.  The in
+    and out indices are free-running 32-bit counts so all of the
+    buffer can be used and the number of bytes is simply in - out.
+    Elements are addressed by masking the indices.
+
+    A single writer and a single reader (say an ISR and the main loop,
+    or two threads) can use the ring concurrently.  The in index is
+    only modified by the writer and the out index only by the reader.
+    Each index is published with release ordering and read with
+    acquire ordering so that the data is visible before the index that
+    makes it available.
+*/
+
+#ifndef PRING_H
+#define PRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+
+typedef uint32_t pring_size_t;
+
+
+/** Do not access the members directly.  */
+typedef struct pring_struct
+{
+    char *buffer;
+    pring_size_t mask;          /* Size - 1.  */
+    pring_size_t in;            /* Count of bytes written.  */
+    pring_size_t out;           /* Count of bytes read.  */
+} pring_t;
+
+
+/** The following macros should be considered private.  */
+
+/** Read other side's index.  */
+#define PRING_LOAD_ACQUIRE(INDEX) __atomic_load_n (&(INDEX), __ATOMIC_ACQUIRE)
+
+/** Read own index.  */
+#define PRING_LOAD_RELAXED(INDEX) __atomic_load_n (&(INDEX), __ATOMIC_RELAXED)
+
+/** Publish own index.  */
+#define PRING_STORE_RELEASE(INDEX, VALUE) \
+    __atomic_store_n (&(INDEX), (VALUE), __ATOMIC_RELEASE)
+
+
+/** Initialise a ring buffer structure to use a specified buffer.
+    @param pring pointer to ring buffer structure, if 0 it is malloced
+    @param buffer pointer to memory buffer, if 0 it is malloced
+    @param size size of memory buffer in bytes, must be a power of two
+    @return pointer to ring buffer structure or zero if error.  */
+pring_t *
+pring_init (pring_t *pring, void *buffer, pring_size_t size);
+
+
+/** Read from a ring buffer.
+    @param pring pointer to ring buffer structure
+    @param buffer pointer to memory buffer
+    @param size maximum number of bytes to read
+    @return number of bytes actually read.  */
+pring_size_t
+pring_read (pring_t *pring, void *buffer, pring_size_t size);
+
+
+/** Write to a ring buffer.  Nothing is written unless all the bytes fit.
+    @param pring pointer to ring buffer structure
+    @param buffer pointer to memory buffer
+    @param size number of bytes to write
+    @return number of bytes actually written.  */
+pring_size_t
+pring_write (pring_t *pring, const void *buffer, pring_size_t size);
+
+
+/** Empties the ring buffer.  This must not be called while
+    the ring buffer is being read or written.
+    @param pring pointer to ring buffer structure.  */
+void
+pring_clear (pring_t *pring);
+
+
+/** Return size of ring buffer in bytes.  */
+static inline pring_size_t
+pring_size (pring_t *pring)
+{
+    return pring->mask + 1;
+}
+
+
+/** Determine number of bytes in ring buffer ready for reading.
+    This is called by the reader.
+    @param pring pointer to ring buffer structure
+    @return number of bytes in ring buffer ready for reading.  */
+static inline pring_size_t
+pring_read_num (pring_t *pring)
+{
+    return PRING_LOAD_ACQUIRE (pring->in) - PRING_LOAD_RELAXED (pring->out);
+}
+
+
+/** Determine number of bytes in ring buffer free for writing.
+    This is called by the writer.
+    @param pring pointer to ring buffer structure
+    @return number of bytes in ring buffer free for writing.  */
+static inline pring_size_t
+pring_write_num (pring_t *pring)
+{
+    return pring->mask + 1
+        - (PRING_LOAD_RELAXED (pring->in) - PRING_LOAD_ACQUIRE (pring->out));
+}
+
+
+/** Return non-zero if the ring buffer is empty.  */
+static inline bool
+pring_empty_p (pring_t *pring)
+{
+    return pring_read_num (pring) == 0;
+}
+
+
+/** Return non-zero if the ring buffer is full.  */
+static inline bool
+pring_full_p (pring_t *pring)
+{
+    return pring_write_num (pring) == 0;
+}
+
+
+/** Write single character to ring buffer.
+    @param pring pointer to ring buffer structure
+    @param c character to write
+    @return non-zero if successful.  */
+static inline pring_size_t
+pring_putc (pring_t *pring, char c)
+{
+    pring_size_t in;
+
+    in = PRING_LOAD_RELAXED (pring->in);
+    if (in - PRING_LOAD_ACQUIRE (pring->out) > pring->mask)
+        return 0;
+
+    pring->buffer[in & pring->mask] = c;
+    PRING_STORE_RELEASE (pring->in, in + 1);
+    return 1;
+}
+
+
+/** Read single character from ring buffer.
+    @param pring pointer to ring buffer structure
+    @return character or -1 if unsuccessful.  */
+static inline int
+pring_getc (pring_t *pring)
+{
+    pring_size_t out;
+    unsigned char c;
+
+    out = PRING_LOAD_RELAXED (pring->out);
+    if (PRING_LOAD_ACQUIRE (pring->in) == out)
+        return -1;
+
+    c = pring->buffer[out & pring->mask];
+    PRING_STORE_RELEASE (pring->out, out + 1);
+    return c;
+}
+
+
+/** Peek at next character to read from ring buffer.
+    @param pring pointer to ring buffer structure
+    @return character or -1 if unsuccessful.  */
+static inline int
+pring_peek (pring_t *pring)
+{
+    pring_size_t out;
+
+    out = PRING_LOAD_RELAXED (pring->out);
+    if (PRING_LOAD_ACQUIRE (pring->in) == out)
+        return -1;
+
+    return (unsigned char) pring->buffer[out & pring->mask];
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
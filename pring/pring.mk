@@ -0,0 +1,6 @@
+PRING_DIR = $(DRIVER_DIR)/pring
+
+VPATH += $(PRING_DIR)
+INCLUDES += -I$(PRING_DIR)
+
+SRC += pring.c
@@ -0,0 +1,331 @@
+#include "config.h"
+#include "msd.h"
+#include "ram_msd_sparse.h"
+#include <string.h>
+
+/* This is a sparse RAM disk.  The medium is divided into pages that
+   are only allocated from a fixed pool when first written.  Unwritten
+   pages all share the zero page (they are not backed by any memory)
+   so the medium can be much larger than the memory used.  Writing
+   zeros to an unwritten page does not allocate it.
+
+   With RAM_MSD_SPARSE_SNAPSHOT, a copy-on-write snapshot can be
+   taken.  Pages are then shared between the snapshot and the live
+   medium until written.  Each page has a reference count and a page
+   is only copied when a write hits a shared page.
+
+   Discarded pages are returned to the pool and read as zeros.
+
+   Like ram_msd, this only supports a single instance.  */
+
+#ifndef RAM_MSD_SPARSE_BYTES
+#error RAM_MSD_SPARSE_BYTES undefined in config.h
+#endif
+
+#ifndef RAM_MSD_SPARSE_PAGES
+#error RAM_MSD_SPARSE_PAGES undefined in config.h
+#endif
+
+#ifndef RAM_MSD_SPARSE_PAGE_BYTES
+#define RAM_MSD_SPARSE_PAGE_BYTES 512
+#endif
+
+#ifndef RAM_MSD_SPARSE_SNAPSHOT
+#define RAM_MSD_SPARSE_SNAPSHOT 0
+#endif
+
+#define RAM_MSD_SPARSE_MAP_SIZE (RAM_MSD_SPARSE_BYTES / RAM_MSD_SPARSE_PAGE_BYTES)
+
+/* Page index denoting the shared zero page.  */
+#define RAM_MSD_SPARSE_ZERO 0xffff
+
+#if RAM_MSD_SPARSE_PAGES >= RAM_MSD_SPARSE_ZERO
+#error RAM_MSD_SPARSE_PAGES too large
+#endif
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+typedef uint16_t ram_msd_sparse_page_t;
+
+
+static uint8_t pages[RAM_MSD_SPARSE_PAGES][RAM_MSD_SPARSE_PAGE_BYTES];
+/* Number of map entries referring to each page; zero if free.  */
+static uint8_t refs[RAM_MSD_SPARSE_PAGES];
+static ram_msd_sparse_page_t map[RAM_MSD_SPARSE_MAP_SIZE];
+#if RAM_MSD_SPARSE_SNAPSHOT
+static ram_msd_sparse_page_t snap[RAM_MSD_SPARSE_MAP_SIZE];
+#endif
+/* Free pages are linked through their first two bytes.  */
+static ram_msd_sparse_page_t free_list;
+static uint16_t free_num;
+
+
+static ram_msd_sparse_page_t
+ram_msd_sparse_page_alloc (void)
+{
+    ram_msd_sparse_page_t page;
+
+    page = free_list;
+    if (page == RAM_MSD_SPARSE_ZERO)
+        return page;
+
+    memcpy (&free_list, pages[page], sizeof (free_list));
+    free_num--;
+    refs[page] = 1;
+    return page;
+}
+
+
+static void
+ram_msd_sparse_page_unref (ram_msd_sparse_page_t page)
+{
+    if (page == RAM_MSD_SPARSE_ZERO)
+        return;
+
+    if (--refs[page])
+        return;
+
+    memcpy (pages[page], &free_list, sizeof (free_list));
+    free_list = page;
+    free_num++;
+}
+
+
+static bool
+ram_msd_sparse_zero_p (const uint8_t *data, msd_size_t size)
+{
+    msd_size_t i;
+
+    for (i = 0; i < size; i++)
+        if (data[i])
+            return 0;
+    return 1;
+}
+
+
+static msd_addr_t
+ram_msd_sparse_probe (void *dev __unused__)
+{
+    return RAM_MSD_SPARSE_BYTES;
+}
+
+
+static msd_size_t
+ram_msd_sparse_read (void *dev __unused__, msd_addr_t addr,
+                     void *buffer, msd_size_t size)
+{
+    uint8_t *dst = buffer;
+    msd_size_t offset;
+    msd_size_t bytes;
+    msd_size_t total;
+    ram_msd_sparse_page_t page;
+
+    if (addr + size > RAM_MSD_SPARSE_BYTES)
+        return 0;
+
+    for (total = 0; total < size; total += bytes)
+    {
+        offset = addr % RAM_MSD_SPARSE_PAGE_BYTES;
+        bytes = MIN (RAM_MSD_SPARSE_PAGE_BYTES - offset, size - total);
+
+        page = map[addr / RAM_MSD_SPARSE_PAGE_BYTES];
+        if (page == RAM_MSD_SPARSE_ZERO)
+            memset (dst, 0, bytes);
+        else
+            memcpy (dst, &pages[page][offset], bytes);
+
+        addr += bytes;
+        dst += bytes;
+    }
+
+    return total;
+}
+
+
+static msd_size_t
+ram_msd_sparse_write (void *dev __unused__, msd_addr_t addr,
+                      const void *buffer, msd_size_t size)
+{
+    const uint8_t *src = buffer;
+    msd_size_t offset;
+    msd_size_t bytes;
+    msd_size_t total;
+    ram_msd_sparse_page_t page;
+    ram_msd_sparse_page_t *pmap;
+
+    if (addr + size > RAM_MSD_SPARSE_BYTES)
+        return 0;
+
+    for (total = 0; total < size; total += bytes)
+    {
+        offset = addr % RAM_MSD_SPARSE_PAGE_BYTES;
+        bytes = MIN (RAM_MSD_SPARSE_PAGE_BYTES - offset, size - total);
+
+        pmap = &map[addr / RAM_MSD_SPARSE_PAGE_BYTES];
+        if (*pmap == RAM_MSD_SPARSE_ZERO)
+        {
+            if (!ram_msd_sparse_zero_p (src, bytes))
+            {
+                page = ram_msd_sparse_page_alloc ();
+                if (page == RAM_MSD_SPARSE_ZERO)
+                    return total;
+                memset (pages[page], 0, RAM_MSD_SPARSE_PAGE_BYTES);
+                memcpy (&pages[page][offset], src, bytes);
+                *pmap = page;
+            }
+        }
+        else
+        {
+            if (refs[*pmap] > 1)
+            {
+                /* The page is shared with the snapshot so copy it.  */
+                page = ram_msd_sparse_page_alloc ();
+                if (page == RAM_MSD_SPARSE_ZERO)
+                    return total;
+                memcpy (pages[page], pages[*pmap], RAM_MSD_SPARSE_PAGE_BYTES);
+                ram_msd_sparse_page_unref (*pmap);
+                *pmap = page;
+            }
+            memcpy (&pages[*pmap][offset], src, bytes);
+        }
+
+        addr += bytes;
+        src += bytes;
+    }
+
+    return total;
+}
+
+
+/* Return the pages of a discarded region to the pool.  Pages shared
+   with the snapshot are retained by the snapshot.  */
+static bool
+ram_msd_sparse_discard (void *dev __unused__, msd_addr_t addr,
+                        msd_addr_t size)
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t i;
+
+    if (addr + size > RAM_MSD_SPARSE_BYTES)
+        return 0;
+
+    /* Only whole pages can be freed.  */
+    first = (addr + RAM_MSD_SPARSE_PAGE_BYTES - 1) / RAM_MSD_SPARSE_PAGE_BYTES;
+    last = (addr + size) / RAM_MSD_SPARSE_PAGE_BYTES;
+
+    for (i = first; i < last; i++)
+    {
+        ram_msd_sparse_page_unref (map[i]);
+        map[i] = RAM_MSD_SPARSE_ZERO;
+    }
+    return 1;
+}
+
+
+static msd_status_t
+ram_msd_sparse_status_get (void *dev __unused__)
+{
+    return MSD_STATUS_READY;
+}
+
+
+static const msd_ops_t ram_msd_sparse_ops =
+{
+    .probe = ram_msd_sparse_probe,
+    .read = ram_msd_sparse_read,
+    .write = ram_msd_sparse_write,
+    .status_get = ram_msd_sparse_status_get,
+    .discard = ram_msd_sparse_discard
+};
+
+
+static msd_t ram_msd_sparse =
+{
+    .handle = 0,
+    .ops = &ram_msd_sparse_ops,
+    .media_bytes = RAM_MSD_SPARSE_BYTES,
+    .block_bytes = RAM_MSD_SPARSE_PAGE_BYTES,
+    .flags = {.removable = 0, .volatile1 = 1, .partial_read = 1,
+              .partial_write = 1, .reserved = 0},
+    .name = "Sparse ramdisk"
+};
+
+
+uint16_t
+ram_msd_sparse_pages_free (void)
+{
+    return free_num;
+}
+
+
+#if RAM_MSD_SPARSE_SNAPSHOT
+void
+ram_msd_sparse_snapshot_release (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < RAM_MSD_SPARSE_MAP_SIZE; i++)
+    {
+        ram_msd_sparse_page_unref (snap[i]);
+        snap[i] = RAM_MSD_SPARSE_ZERO;
+    }
+}
+
+
+void
+ram_msd_sparse_snapshot (void)
+{
+    uint32_t i;
+
+    ram_msd_sparse_snapshot_release ();
+
+    for (i = 0; i < RAM_MSD_SPARSE_MAP_SIZE; i++)
+    {
+        snap[i] = map[i];
+        if (snap[i] != RAM_MSD_SPARSE_ZERO)
+            refs[snap[i]]++;
+    }
+}
+
+
+void
+ram_msd_sparse_snapshot_revert (void)
+{
+    uint32_t i;
+
+    /* The snapshot is retained so that it can be reverted to again.  */
+    for (i = 0; i < RAM_MSD_SPARSE_MAP_SIZE; i++)
+    {
+        ram_msd_sparse_page_unref (map[i]);
+        map[i] = snap[i];
+        if (map[i] != RAM_MSD_SPARSE_ZERO)
+            refs[map[i]]++;
+    }
+}
+#endif
+
+
+msd_t *
+ram_msd_sparse_init (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < RAM_MSD_SPARSE_MAP_SIZE; i++)
+    {
+        map[i] = RAM_MSD_SPARSE_ZERO;
+#if RAM_MSD_SPARSE_SNAPSHOT
+        snap[i] = RAM_MSD_SPARSE_ZERO;
+#endif
+    }
+
+    free_list = RAM_MSD_SPARSE_ZERO;
+    free_num = 0;
+    for (i = RAM_MSD_SPARSE_PAGES; i-- > 0;)
+    {
+        refs[i] = 1;
+        ram_msd_sparse_page_unref (i);
+    }
+
+    return &ram_msd_sparse;
+}
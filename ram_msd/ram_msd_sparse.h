@@ -0,0 +1,30 @@
+#ifndef RAM_MSD_SPARSE_H
+#define RAM_MSD_SPARSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include "msd.h"
+
+msd_t *ram_msd_sparse_init (void);
+
+/* Return number of unallocated pages.  */
+uint16_t ram_msd_sparse_pages_free (void);
+
+/* Take a copy-on-write snapshot of the current contents, replacing
+   any previous snapshot.  Requires RAM_MSD_SPARSE_SNAPSHOT.  */
+void ram_msd_sparse_snapshot (void);
+
+/* Discard all changes made since the snapshot.  */
+void ram_msd_sparse_snapshot_revert (void);
+
+/* Discard the snapshot, freeing any pages only it references.  */
+void ram_msd_sparse_snapshot_release (void);
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
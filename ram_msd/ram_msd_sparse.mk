@@ -0,0 +1,6 @@
+RAM_MSD_DIR = $(DRIVER_DIR)/ram_msd
+
+VPATH += $(RAM_MSD_DIR)
+INCLUDES += -I$(RAM_MSD_DIR)
+
+SRC += ram_msd_sparse.c msd.c
@@ -0,0 +1,25 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __unused__ __attribute__((unused))
+
+/* A small pool so that it is easily exhausted.  */
+#define RAM_MSD_SPARSE_BYTES (64 * 512)
+#define RAM_MSD_SPARSE_PAGES 8
+#define RAM_MSD_SPARSE_PAGE_BYTES 512
+#define RAM_MSD_SPARSE_SNAPSHOT 1
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "ram_msd_sparse.h"
+
+/* Exercise ram_msd_sparse.c through its driver operations, checking
+   the data read back against a reference copy and the number of free
+   pages after each step.  */
+
+#define PAGE RAM_MSD_SPARSE_PAGE_BYTES
+
+
+static uint8_t ref[RAM_MSD_SPARSE_BYTES];
+static uint8_t buffer[RAM_MSD_SPARSE_BYTES];
+static msd_t *msd;
+
+
+static int
+check (bool ok, const char *what, int line)
+{
+    if (!ok)
+        printf ("Line %d: %s failed\n", line, what);
+    return !ok;
+}
+
+#define CHECK(ok) check ((ok), #ok, __LINE__)
+
+
+/* Write non-zero data, or zeros if ZERO is set, returning the number
+   of bytes written.  The reference copy is updated for what was
+   written.  */
+static msd_size_t
+data_write (msd_addr_t addr, msd_size_t size, bool zero)
+{
+    msd_size_t bytes;
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
+        buffer[i] = zero ? 0 : rand () % 255 + 1;
+
+    bytes = msd->ops->write (msd->handle, addr, buffer, size);
+    memcpy (ref + addr, buffer, bytes);
+    return bytes;
+}
+
+
+/* Read the whole medium and compare with the reference copy.  */
+static bool
+media_ok_p (void)
+{
+    return msd->ops->read (msd->handle, 0, buffer, RAM_MSD_SPARSE_BYTES)
+        == RAM_MSD_SPARSE_BYTES
+        && !memcmp (ref, buffer, RAM_MSD_SPARSE_BYTES);
+}
+
+
+static bool
+discard (msd_addr_t addr, msd_addr_t size)
+{
+    return msd->ops->discard (msd->handle, addr, size);
+}
+
+
+/* Pages are only allocated when first written with non-zero data.  */
+static int
+alloc_test (void)
+{
+    int errors = 0;
+
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES);
+
+    // Unwritten pages read as zeros
+    errors += CHECK (media_ok_p ());
+
+    errors += CHECK (data_write (2 * PAGE, 3 * PAGE, 1) == 3 * PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES);
+
+    errors += CHECK (data_write (PAGE + 100, 10, 0) == 10);
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES - 1);
+
+    // Rewriting an allocated page, even with zeros, does not allocate
+    errors += CHECK (data_write (PAGE, PAGE, 1) == PAGE);
+    errors += CHECK (data_write (PAGE + 200, 20, 0) == 20);
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES - 1);
+
+    // A write spanning two pages
+    errors += CHECK (data_write (4 * PAGE - 10, 20, 0) == 20);
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES - 3);
+
+    // Out of range
+    errors += CHECK (msd->ops->write (msd->handle, RAM_MSD_SPARSE_BYTES - 1,
+                                      buffer, 2) == 0);
+    errors += CHECK (msd->ops->read (msd->handle, RAM_MSD_SPARSE_BYTES - 1,
+                                     buffer, 2) == 0);
+
+    errors += CHECK (media_ok_p ());
+    return errors;
+}
+
+
+/* When the pool runs out, the bytes written before then are
+   counted.  */
+static int
+exhaust_test (void)
+{
+    uint16_t free_num;
+    int errors = 0;
+
+    free_num = ram_msd_sparse_pages_free ();
+    errors += CHECK (data_write (16 * PAGE, (free_num + 2) * PAGE, 0)
+                     == free_num * PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == 0);
+
+    // Zeros can still be written to an unallocated page
+    errors += CHECK (data_write (40 * PAGE, PAGE, 1) == PAGE);
+    errors += CHECK (data_write (40 * PAGE, PAGE, 0) == 0);
+    errors += CHECK (media_ok_p ());
+
+    errors += CHECK (discard (16 * PAGE, free_num * PAGE));
+    memset (ref + 16 * PAGE, 0, free_num * PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num);
+    errors += CHECK (media_ok_p ());
+    return errors;
+}
+
+
+/* Only the pages wholly within a discarded region are freed.  */
+static int
+discard_test (void)
+{
+    uint16_t free_num;
+    int errors = 0;
+
+    free_num = ram_msd_sparse_pages_free ();
+    errors += CHECK (data_write (30 * PAGE, 3 * PAGE, 0) == 3 * PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 3);
+
+    errors += CHECK (discard (30 * PAGE + 1, 2 * PAGE));
+    memset (ref + 31 * PAGE, 0, PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 2);
+
+    errors += CHECK (discard (30 * PAGE + 1, PAGE - 2));
+    errors += CHECK (discard (32 * PAGE, PAGE - 1));
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 2);
+
+    // Discarding unallocated pages does nothing
+    errors += CHECK (discard (50 * PAGE, 4 * PAGE));
+    errors += CHECK (!discard (RAM_MSD_SPARSE_BYTES - PAGE, 2 * PAGE));
+
+    errors += CHECK (discard (30 * PAGE, 3 * PAGE));
+    memset (ref + 30 * PAGE, 0, 3 * PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num);
+    errors += CHECK (media_ok_p ());
+    return errors;
+}
+
+
+/* Pages are shared with the snapshot until written.  */
+static int
+snapshot_test (void)
+{
+    static uint8_t saved[RAM_MSD_SPARSE_BYTES];
+    uint16_t free_num;
+    int errors = 0;
+
+    free_num = ram_msd_sparse_pages_free ();
+    ram_msd_sparse_snapshot ();
+    memcpy (saved, ref, sizeof (saved));
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num);
+
+    // Writing a shared page copies it
+    errors += CHECK (data_write (PAGE + 10, 10, 0) == 10);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 1);
+    errors += CHECK (data_write (PAGE + 20, 10, 0) == 10);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 1);
+
+    // A new page is not shared
+    errors += CHECK (data_write (20 * PAGE, PAGE, 0) == PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 2);
+
+    // A shared page that is discarded is kept by the snapshot
+    errors += CHECK (discard (3 * PAGE, PAGE));
+    memset (ref + 3 * PAGE, 0, PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 2);
+    errors += CHECK (media_ok_p ());
+
+    // Reverting frees the copies and restores the snapshot contents
+    ram_msd_sparse_snapshot_revert ();
+    memcpy (ref, saved, sizeof (ref));
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num);
+    errors += CHECK (media_ok_p ());
+
+    // The snapshot is kept so it can be reverted to again
+    errors += CHECK (data_write (PAGE, PAGE, 0) == PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 1);
+    ram_msd_sparse_snapshot_revert ();
+    memcpy (ref, saved, sizeof (ref));
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num);
+    errors += CHECK (media_ok_p ());
+
+    // Releasing frees the pages only the snapshot refers to
+    errors += CHECK (data_write (PAGE, PAGE, 0) == PAGE);
+    errors += CHECK (discard (3 * PAGE, PAGE));
+    memset (ref + 3 * PAGE, 0, PAGE);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num - 1);
+    ram_msd_sparse_snapshot_release ();
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num + 1);
+    errors += CHECK (media_ok_p ());
+
+    // Writing a page no longer shared does not copy it
+    errors += CHECK (data_write (PAGE, 10, 0) == 10);
+    errors += CHECK (ram_msd_sparse_pages_free () == free_num + 1);
+
+    // Everything returns to the pool
+    errors += CHECK (discard (0, RAM_MSD_SPARSE_BYTES));
+    memset (ref, 0, sizeof (ref));
+    errors += CHECK (ram_msd_sparse_pages_free () == RAM_MSD_SPARSE_PAGES);
+    errors += CHECK (media_ok_p ());
+    return errors;
+}
+
+
+int
+main (void)
+{
+    int errors = 0;
+
+    srand (1);
+
+    msd = ram_msd_sparse_init ();
+    errors += CHECK (msd->media_bytes == RAM_MSD_SPARSE_BYTES);
+    errors += CHECK (msd->ops->probe (msd->handle) == RAM_MSD_SPARSE_BYTES);
+
+    errors += alloc_test ();
+    errors += exhaust_test ();
+    errors += discard_test ();
+    errors += snapshot_test ();
+
+    if (errors)
+    {
+        printf ("%d errors\nFAILED\n", errors);
+        return 1;
+    }
+    printf ("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,237 @@
+/** @file   recring.h
+    @brief  Ring buffer of fixed-size records.
+
+    This is a FIFO of elements of a given type, such as captured
+    samples, button events or radio packets.  It is a macro template;
+    RECRING_DEFINE (NAME, TYPE) defines the structure NAME_t and
+    static inline functions NAME_init, NAME_push, NAME_pop, etc.
+    specialised for TYPE so elements are copied by assignment and
+    batches with memcpy.  For example:
+
+    RECRING_DEFINE (event_ring, event_t)
+
+    static event_t events[16];
+    static event_ring_t event_ring;
+
+    event_ring_init (&event_ring, events, ARRAY_SIZE (events));
+    event_ring_push (&event_ring, &event);
+
+    The number of elements must be a power of two.  The in and out
+    counts are free-running and are masked to index the elements.
+    Like ring_t, one writer and one reader can use the ring
+    concurrently (say an ISR and the main loop), with the counts
+    published with release ordering and read with acquire ordering.
+    NAME_push_force is the exception since it discards the oldest
+    element and so modifies the out count; the reader must not run at
+    the same time.
+*/
+
+#ifndef RECRING_H
+#define RECRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+#include <string.h>
+
+
+typedef uint32_t recring_size_t;
+
+
+/** The following macros should be considered private.  */
+
+#define RECRING_LOAD_ACQUIRE(INDEX) __atomic_load_n (&(INDEX), __ATOMIC_ACQUIRE)
+
+#define RECRING_LOAD_RELAXED(INDEX) __atomic_load_n (&(INDEX), __ATOMIC_RELAXED)
+
+#define RECRING_STORE_RELEASE(INDEX, VALUE) \
+    __atomic_store_n (&(INDEX), (VALUE), __ATOMIC_RELEASE)
+
+
+/** Define record ring buffer type NAME_t for elements of TYPE and its
+    functions.  */
+#define RECRING_DEFINE(NAME, TYPE)                                      \
+                                                                        \
+typedef struct NAME ## _struct                                          \
+{                                                                       \
+    TYPE *items;                                                        \
+    recring_size_t mask;        /* Number of elements - 1.  */          \
+    recring_size_t in;          /* Count of elements pushed.  */        \
+    recring_size_t out;         /* Count of elements popped.  */        \
+} NAME ## _t;                                                           \
+                                                                        \
+                                                                        \
+/** Initialise ring to use array items of size elements, a power of    \
+    two.  Return zero if the size is invalid.  */                       \
+static inline bool                                                      \
+NAME ## _init (NAME ## _t *ring, TYPE *items, recring_size_t size)      \
+{                                                                       \
+    if (!size || (size & (size - 1)))                                   \
+        return 0;                                                       \
+                                                                        \
+    ring->items = items;                                                \
+    ring->mask = size - 1;                                              \
+    ring->in = ring->out = 0;                                           \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Return number of elements ready to pop.  */                         \
+static inline recring_size_t                                            \
+NAME ## _num (NAME ## _t *ring)                                         \
+{                                                                       \
+    return RECRING_LOAD_ACQUIRE (ring->in)                              \
+        - RECRING_LOAD_RELAXED (ring->out);                             \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Return number of elements that can be pushed.  */                   \
+static inline recring_size_t                                            \
+NAME ## _free (NAME ## _t *ring)                                        \
+{                                                                       \
+    return ring->mask + 1                                               \
+        - (RECRING_LOAD_RELAXED (ring->in)                              \
+           - RECRING_LOAD_ACQUIRE (ring->out));                         \
+}                                                                       \
+                                                                        \
+                                                                        \
+static inline bool                                                      \
+NAME ## _empty_p (NAME ## _t *ring)                                     \
+{                                                                       \
+    return NAME ## _num (ring) == 0;                                    \
+}                                                                       \
+                                                                        \
+                                                                        \
+static inline bool                                                      \
+NAME ## _full_p (NAME ## _t *ring)                                      \
+{                                                                       \
+    return NAME ## _free (ring) == 0;                                   \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Push copy of item.  Return zero if full.  */                        \
+static inline bool                                                      \
+NAME ## _push (NAME ## _t *ring, const TYPE *item)                      \
+{                                                                       \
+    recring_size_t in;                                                  \
+                                                                        \
+    in = RECRING_LOAD_RELAXED (ring->in);                               \
+    if (in - RECRING_LOAD_ACQUIRE (ring->out) > ring->mask)             \
+        return 0;                                                       \
+                                                                        \
+    ring->items[in & ring->mask] = *item;                               \
+    RECRING_STORE_RELEASE (ring->in, in + 1);                           \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Push copy of item, discarding the oldest element if full.  */       \
+static inline void                                                      \
+NAME ## _push_force (NAME ## _t *ring, const TYPE *item)                \
+{                                                                       \
+    recring_size_t in;                                                  \
+                                                                        \
+    in = RECRING_LOAD_RELAXED (ring->in);                               \
+    if (in - RECRING_LOAD_RELAXED (ring->out) > ring->mask)             \
+        RECRING_STORE_RELEASE (ring->out, in - ring->mask);             \
+                                                                        \
+    ring->items[in & ring->mask] = *item;                               \
+    RECRING_STORE_RELEASE (ring->in, in + 1);                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Pop oldest element into item.  Return zero if empty.  */            \
+static inline bool                                                      \
+NAME ## _pop (NAME ## _t *ring, TYPE *item)                             \
+{                                                                       \
+    recring_size_t out;                                                 \
+                                                                        \
+    out = RECRING_LOAD_RELAXED (ring->out);                             \
+    if (RECRING_LOAD_ACQUIRE (ring->in) == out)                         \
+        return 0;                                                       \
+                                                                        \
+    *item = ring->items[out & ring->mask];                              \
+    RECRING_STORE_RELEASE (ring->out, out + 1);                         \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Return pointer to element index, where 0 is the oldest, without    \
+    popping it.  Return NULL if there is no such element.  */           \
+static inline TYPE *                                                    \
+NAME ## _peek (NAME ## _t *ring, recring_size_t index)                  \
+{                                                                       \
+    recring_size_t out;                                                 \
+                                                                        \
+    out = RECRING_LOAD_RELAXED (ring->out);                             \
+    if (RECRING_LOAD_ACQUIRE (ring->in) - out <= index)                 \
+        return NULL;                                                    \
+                                                                        \
+    return &ring->items[(out + index) & ring->mask];                    \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Push up to num elements from items.  Return number pushed.  */      \
+static inline recring_size_t                                            \
+NAME ## _push_n (NAME ## _t *ring, const TYPE *items,                   \
+                 recring_size_t num)                                    \
+{                                                                       \
+    recring_size_t in;                                                  \
+    recring_size_t count;                                               \
+    recring_size_t offset;                                              \
+    recring_size_t semi_num;                                            \
+                                                                        \
+    in = RECRING_LOAD_RELAXED (ring->in);                               \
+    count = ring->mask + 1 - (in - RECRING_LOAD_ACQUIRE (ring->out));   \
+    if (num > count)                                                    \
+        num = count;                                                    \
+                                                                        \
+    offset = in & ring->mask;                                           \
+    semi_num = ring->mask + 1 - offset;                                 \
+    if (semi_num > num)                                                 \
+        semi_num = num;                                                 \
+                                                                        \
+    memcpy (ring->items + offset, items, semi_num * sizeof (TYPE));     \
+    memcpy (ring->items, items + semi_num,                              \
+            (num - semi_num) * sizeof (TYPE));                          \
+                                                                        \
+    RECRING_STORE_RELEASE (ring->in, in + num);                         \
+    return num;                                                         \
+}                                                                       \
+                                                                        \
+                                                                        \
+/** Pop up to num elements into items.  Return number popped.  */       \
+static inline recring_size_t                                            \
+NAME ## _pop_n (NAME ## _t *ring, TYPE *items, recring_size_t num)      \
+{                                                                       \
+    recring_size_t out;                                                 \
+    recring_size_t count;                                               \
+    recring_size_t offset;                                              \
+    recring_size_t semi_num;                                            \
+                                                                        \
+    out = RECRING_LOAD_RELAXED (ring->out);                             \
+    count = RECRING_LOAD_ACQUIRE (ring->in) - out;                      \
+    if (num > count)                                                    \
+        num = count;                                                    \
+                                                                        \
+    offset = out & ring->mask;                                          \
+    semi_num = ring->mask + 1 - offset;                                 \
+    if (semi_num > num)                                                 \
+        semi_num = num;                                                 \
+                                                                        \
+    memcpy (items, ring->items + offset, semi_num * sizeof (TYPE));     \
+    memcpy (items + semi_num, ring->items,                              \
+            (num - semi_num) * sizeof (TYPE));                          \
+                                                                        \
+    RECRING_STORE_RELEASE (ring->out, out + num);                       \
+    return num;                                                         \
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,4 @@
+RECRING_DIR = $(DRIVER_DIR)/recring
+
+VPATH += $(RECRING_DIR)
+INCLUDES += -I$(RECRING_DIR)
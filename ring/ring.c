@@ -283,6 +283,111 @@ ring_read_advance (ring_t *ring, ring_size_t size)
 }
 
 
+/** Split size bytes starting at ptr into the portion before the end
+    of the ring buffer and the portion wrapped to the top.  */
+static void
+ring_segments_set (ring_t *ring, char *ptr, ring_size_t size,
+                   ring_segment_t *segments)
+{
+    ring_size_t semi_num;
+
+    semi_num = ring->end - ptr;
+    if (semi_num > size)
+        semi_num = size;
+
+    segments[0].data = ptr;
+    segments[0].size = semi_num;
+    segments[1].data = ring->top;
+    segments[1].size = size - semi_num;
+}
+
+
+/** Reserve space in ring buffer for writing in place.  The space is
+    made available to the reader by ring_write_commit.
+    @param ring pointer to ring buffer structure
+    @param size maximum number of bytes to reserve
+    @param segments array of two segments filled in with the space,
+    the second is empty unless the space wraps around
+    @return number of bytes reserved.  */
+ring_size_t
+ring_write_reserve (ring_t *ring, ring_size_t size, ring_segment_t *segments)
+{
+    ring_size_t count;
+    int tmp;
+
+    /* Determine number of free entries in ring buffer.  */
+    count = RING_WRITE_NUM (ring, tmp);
+    if (size > count)
+        size = count;
+
+    ring_segments_set (ring, ring->in, size, segments);
+    return size;
+}
+
+
+/** Commit bytes written into space given by ring_write_reserve.
+    @param ring pointer to ring buffer structure
+    @param size number of bytes written, not more than reserved.  */
+void
+ring_write_commit (ring_t *ring, ring_size_t size)
+{
+    ring_write_advance (ring, size);
+}
+
+
+/** Get data in ring buffer for reading in place.  The data remains in
+    the ring buffer until released by ring_read_release.
+    @param ring pointer to ring buffer structure
+    @param size maximum number of bytes to get
+    @param segments array of two segments filled in with the data,
+    the second is empty unless the data wraps around
+    @return number of bytes available.  */
+ring_size_t
+ring_read_segments (ring_t *ring, ring_size_t size, ring_segment_t *segments)
+{
+    ring_size_t count;
+    int tmp;
+
+    /* Determine number of entries in ring buffer.  */
+    count = RING_READ_NUM (ring, tmp);
+    if (size > count)
+        size = count;
+
+    ring_segments_set (ring, ring->out, size, segments);
+    return size;
+}
+
+
+/** Release bytes got by ring_read_segments.
+    @param ring pointer to ring buffer structure
+    @param size number of bytes consumed, not more than available.  */
+void
+ring_read_release (ring_t *ring, ring_size_t size)
+{
+    ring_read_advance (ring, size);
+}
+
+
+/** Find number of bytes up to and including the first occurrence of
+    a character in segments.
+    @return number of bytes or zero if character not found.  */
+static ring_size_t
+ring_segments_find (ring_segment_t *segments, char ch)
+{
+    char *ptr;
+
+    ptr = memchr (segments[0].data, ch, segments[0].size);
+    if (ptr)
+        return ptr - segments[0].data + 1;
+
+    ptr = memchr (segments[1].data, ch, segments[1].size);
+    if (ptr)
+        return segments[0].size + ptr - segments[1].data + 1;
+
+    return 0;
+}
+
+
 /** Search for character in ring buffer.
     @param ring pointer to ring buffer structure
     @param ch character to find
@@ -290,28 +395,53 @@ ring_read_advance (ring_t *ring, ring_size_t size)
 bool
 ring_find (ring_t *ring, char ch)
 {
-    ring_size_t count;
-    int tmp;
-    char *ptr;
+    ring_segment_t segments[2];
 
-    /* Determine number of entries in ring buffer.  */
-    count = RING_READ_NUM (ring, tmp);
+    ring_read_segments (ring, RING_SIZE (ring), segments);
+    return ring_segments_find (segments, ch) != 0;
+}
 
-    /* Return if nothing to read.  */
+
+/** Read from a ring buffer up to and including a delimiter.
+    @param ring pointer to ring buffer structure
+    @param delim delimiter character, say '\n'
+    @param buffer pointer to memory buffer
+    @param size maximum number of bytes to read
+    @return number of bytes read.  This is zero (and nothing is read)
+    unless the delimiter is found, size bytes are available, or the
+    ring buffer is full.  */
+ring_size_t
+ring_read_until (ring_t *ring, char delim, void *buffer, ring_size_t size)
+{
+    ring_segment_t segments[2];
+    ring_size_t count;
+    ring_size_t num;
+
+    count = ring_read_segments (ring, size, segments);
     if (!count)
         return 0;
 
-    /* This could be optimised with two searches.  */
-    ptr = ring->out;
-    while (count--)
+    num = ring_segments_find (segments, delim);
+    if (!num)
     {
-        if (*ptr++ == ch)
-            return 1;
-        if (ptr >= ring->end)
-            ptr = ring->top;
+        /* Wait for the delimiter unless the reader would have to
+           wait for ever.  */
+        if (count < size && count < RING_SIZE (ring) - 1)
+            return 0;
+        num = count;
     }
 
-    return 0;
+    if (num > segments[0].size)
+    {
+        memcpy (buffer, segments[0].data, segments[0].size);
+        memcpy ((char *)buffer + segments[0].size, segments[1].data,
+                num - segments[0].size);
+    }
+    else
+        memcpy (buffer, segments[0].data, num);
+
+    ring_read_release (ring, num);
+    return num;
 }
 
 /** Write single character to ring buffer.  If the buffer
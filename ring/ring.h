@@ -33,6 +33,15 @@ typedef struct ring_struct
 } ring_t;
 
 
+/** Contiguous portion of a ring buffer for reading or writing in
+    place.  */
+typedef struct ring_segment_struct
+{
+    char *data;
+    ring_size_t size;
+} ring_segment_t;
+
+
 /** The following macros should be considered private.  */
 
 /** Number of bytes in ring buffer.  */
@@ -152,6 +161,42 @@ char *
 ring_read_advance (ring_t *ring, ring_size_t size);
 
 
+/** Reserve space in ring buffer for writing in place.  The space is
+    made available to the reader by ring_write_commit.
+    @param ring pointer to ring buffer structure
+    @param size maximum number of bytes to reserve
+    @param segments array of two segments filled in with the space,
+    the second is empty unless the space wraps around
+    @return number of bytes reserved.  */
+ring_size_t
+ring_write_reserve (ring_t *ring, ring_size_t size, ring_segment_t *segments);
+
+
+/** Commit bytes written into space given by ring_write_reserve.
+    @param ring pointer to ring buffer structure
+    @param size number of bytes written, not more than reserved.  */
+void
+ring_write_commit (ring_t *ring, ring_size_t size);
+
+
+/** Get data in ring buffer for reading in place.  The data remains in
+    the ring buffer until released by ring_read_release.
+    @param ring pointer to ring buffer structure
+    @param size maximum number of bytes to get
+    @param segments array of two segments filled in with the data,
+    the second is empty unless the data wraps around
+    @return number of bytes available.  */
+ring_size_t
+ring_read_segments (ring_t *ring, ring_size_t size, ring_segment_t *segments);
+
+
+/** Release bytes got by ring_read_segments.
+    @param ring pointer to ring buffer structure
+    @param size number of bytes consumed, not more than available.  */
+void
+ring_read_release (ring_t *ring, ring_size_t size);
+
+
 /** Write single character to ring buffer.
     @param ring pointer to ring buffer structure
     @param c character to write
@@ -193,7 +238,7 @@ static inline int
 ring_getc (ring_t *ring)
 {
     int tmp;
-    char c;
+    unsigned char c;
     char *ptr;
 
     /* Determine number of free entries in ring buffer
@@ -225,7 +270,7 @@ ring_peek (ring_t *ring)
     if (!RING_READ_NUM (ring, tmp))
         return -1;
 
-    return *ring->out;
+    return (unsigned char) *ring->out;
 }
 
 
@@ -237,6 +282,18 @@ bool
 ring_find (ring_t *ring, char ch);
 
 
+/** Read from a ring buffer up to and including a delimiter.
+    @param ring pointer to ring buffer structure
+    @param delim delimiter character, say '\n'
+    @param buffer pointer to memory buffer
+    @param size maximum number of bytes to read
+    @return number of bytes read.  This is zero (and nothing is read)
+    unless the delimiter is found, size bytes are available, or the
+    ring buffer is full.  */
+ring_size_t
+ring_read_until (ring_t *ring, char delim, void *buffer, ring_size_t size);
+
+
 /** Empties the ring buffer to it's original state.
     @param ring, pointer to ring buffer structure. */
 void
@@ -0,0 +1,305 @@
+/** @file   ring_bench.c
+    @brief  Ring buffer benchmark.
+
+    This measures the throughput of the ring buffer variants for
+    single character and bulk operations over a range of ring sizes
+    and chunk lengths.  The writer and reader alternate in the same
+    thread so the figures are for the ring buffer code alone.  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ring.h"
+#include "pring.h"
+#include "recring.h"
+#include "mpring.h"
+
+
+RECRING_DEFINE (word_ring, uint32_t)
+
+MPRING_DEFINE (word_mpring, uint32_t)
+
+
+/* Number of bytes to transfer for each test.  */
+#define BYTES (16 * 1024 * 1024)
+
+#define SIZE_MAX_BYTES 4096
+
+
+static char buffer[SIZE_MAX_BYTES];
+static char data[SIZE_MAX_BYTES];
+static char result[SIZE_MAX_BYTES];
+static uint32_t words[SIZE_MAX_BYTES / 4];
+static word_mpring_slot_t slots[SIZE_MAX_BYTES / 4];
+
+
+typedef struct
+{
+    const char *name;
+    /* Transfer chunk bytes through ring of size bytes, returning the
+       number of operations.  */
+    unsigned long (*run) (unsigned int size, unsigned int chunk);
+} bench_t;
+
+
+static double
+time_get (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static unsigned long
+ring_char_run (unsigned int size, unsigned int chunk)
+{
+    ring_t ring;
+    unsigned long ops = 0;
+    unsigned int i;
+    unsigned int j;
+
+    ring_init (&ring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        for (j = 0; j < chunk; j++)
+            ring_putc (&ring, data[j]);
+        for (j = 0; j < chunk; j++)
+            result[j] = ring_getc (&ring);
+        ops += 2 * chunk;
+    }
+    return ops;
+}
+
+
+static unsigned long
+ring_bulk_run (unsigned int size, unsigned int chunk)
+{
+    ring_t ring;
+    unsigned long ops = 0;
+    unsigned int i;
+
+    ring_init (&ring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        ring_write (&ring, data, chunk);
+        ring_read (&ring, result, chunk);
+        ops += 2;
+    }
+    return ops;
+}
+
+
+static unsigned long
+ring_continuous_run (unsigned int size, unsigned int chunk)
+{
+    ring_t ring;
+    unsigned long ops = 0;
+    unsigned int i;
+
+    ring_init (&ring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        ring_write_continuous (&ring, data, chunk);
+        ring_read (&ring, result, chunk);
+        ops += 2;
+    }
+    return ops;
+}
+
+
+static unsigned long
+ring_segments_run (unsigned int size, unsigned int chunk)
+{
+    ring_t ring;
+    ring_segment_t segments[2];
+    unsigned long ops = 0;
+    unsigned int i;
+
+    ring_init (&ring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        ring_write_reserve (&ring, chunk, segments);
+        memcpy (segments[0].data, data, segments[0].size);
+        memcpy (segments[1].data, data + segments[0].size, segments[1].size);
+        ring_write_commit (&ring, chunk);
+
+        ring_read_segments (&ring, chunk, segments);
+        memcpy (result, segments[0].data, segments[0].size);
+        memcpy (result + segments[0].size, segments[1].data, segments[1].size);
+        ring_read_release (&ring, chunk);
+        ops += 4;
+    }
+    return ops;
+}
+
+
+static unsigned long
+pring_char_run (unsigned int size, unsigned int chunk)
+{
+    pring_t pring;
+    unsigned long ops = 0;
+    unsigned int i;
+    unsigned int j;
+
+    pring_init (&pring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        for (j = 0; j < chunk; j++)
+            pring_putc (&pring, data[j]);
+        for (j = 0; j < chunk; j++)
+            result[j] = pring_getc (&pring);
+        ops += 2 * chunk;
+    }
+    return ops;
+}
+
+
+static unsigned long
+pring_bulk_run (unsigned int size, unsigned int chunk)
+{
+    pring_t pring;
+    unsigned long ops = 0;
+    unsigned int i;
+
+    pring_init (&pring, buffer, size);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        pring_write (&pring, data, chunk);
+        pring_read (&pring, result, chunk);
+        ops += 2;
+    }
+    return ops;
+}
+
+
+/* The record rings are measured with four byte elements.  */
+static unsigned long
+recring_run (unsigned int size, unsigned int chunk)
+{
+    word_ring_t ring;
+    uint32_t *src = (uint32_t *)data;
+    uint32_t *dst = (uint32_t *)result;
+    unsigned long ops = 0;
+    unsigned int i;
+    unsigned int j;
+
+    word_ring_init (&ring, words, size / 4);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        for (j = 0; j < chunk / 4; j++)
+            word_ring_push (&ring, &src[j]);
+        for (j = 0; j < chunk / 4; j++)
+            word_ring_pop (&ring, &dst[j]);
+        ops += chunk / 2;
+    }
+    return ops;
+}
+
+
+static unsigned long
+recring_batch_run (unsigned int size, unsigned int chunk)
+{
+    word_ring_t ring;
+    unsigned long ops = 0;
+    unsigned int i;
+
+    word_ring_init (&ring, words, size / 4);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        word_ring_push_n (&ring, (uint32_t *)data, chunk / 4);
+        word_ring_pop_n (&ring, (uint32_t *)result, chunk / 4);
+        ops += 2;
+    }
+    return ops;
+}
+
+
+static unsigned long
+mpring_run (unsigned int size, unsigned int chunk)
+{
+    word_mpring_t ring;
+    uint32_t *src = (uint32_t *)data;
+    uint32_t *dst = (uint32_t *)result;
+    unsigned long ops = 0;
+    unsigned int i;
+    unsigned int j;
+
+    word_mpring_init (&ring, slots, size / 4);
+    for (i = 0; i < BYTES; i += chunk)
+    {
+        for (j = 0; j < chunk / 4; j++)
+            word_mpring_push (&ring, &src[j]);
+        for (j = 0; j < chunk / 4; j++)
+            word_mpring_pop (&ring, &dst[j]);
+        ops += chunk / 2;
+    }
+    return ops;
+}
+
+
+static const bench_t benches[] =
+{
+    {"ring putc/getc", ring_char_run},
+    {"ring write/read", ring_bulk_run},
+    {"ring continuous", ring_continuous_run},
+    {"ring segments", ring_segments_run},
+    {"pring putc/getc", pring_char_run},
+    {"pring write/read", pring_bulk_run},
+    {"recring push/pop", recring_run},
+    {"recring batch", recring_batch_run},
+    {"mpring push/pop", mpring_run},
+};
+
+
+static const unsigned int sizes[] = {64, 256, 4096};
+
+static const unsigned int chunks[] = {4, 16, 60, 512};
+
+
+int main (void)
+{
+    unsigned int b;
+    unsigned int s;
+    unsigned int c;
+
+    for (c = 0; c < sizeof (data); c++)
+        data[c] = c;
+
+    printf ("%-18s %6s %6s %10s %8s\n", "test", "size", "chunk", "MB/s",
+            "ns/op");
+
+    for (b = 0; b < sizeof (benches) / sizeof (benches[0]); b++)
+    {
+        for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+        {
+            for (c = 0; c < sizeof (chunks) / sizeof (chunks[0]); c++)
+            {
+                double start;
+                double secs;
+                unsigned long ops;
+
+                /* ring_t keeps one byte free.  */
+                if (chunks[c] >= sizes[s])
+                    continue;
+
+                start = time_get ();
+                ops = benches[b].run (sizes[s], chunks[c]);
+                secs = time_get () - start;
+
+                if (memcmp (data, result, chunks[c]))
+                {
+                    printf ("%s: data mismatch\n", benches[b].name);
+                    return 1;
+                }
+
+                printf ("%-18s %6u %6u %10.1f %8.2f\n", benches[b].name,
+                        sizes[s], chunks[c], BYTES / secs / 1e6,
+                        secs * 1e9 / ops);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+/** @file   ring_torture.c
+    @brief  Multiple thread ring buffer stress test.
+
+    A producer thread writes a known byte sequence into a ring buffer
+    using a random mix of single character and bulk writes while the
+    consumer thread reads it back the same way and checks that every
+    byte arrives once and in order.  This checks that the single
+    writer, single reader use of ring_t and pring_t is race-free.
+
+    mpring_t is then run with several producer threads and one or
+    more consumer threads.  Each element records its producer and
+    sequence number; every element must arrive exactly once and each
+    consumer must see the elements of a producer in order.  As with
+    any such test, races show up far more readily with several cores
+    than with one.  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "ring.h"
+#include "pring.h"
+#include "mpring.h"
+
+
+/* Default number of bytes to transfer.  */
+#define BYTES 20000000
+
+#define CHUNK_MAX 97
+
+
+typedef struct
+{
+    const char *name;
+    /* Write up to size bytes, returning number written.  */
+    unsigned int (*write) (const char *data, unsigned int size);
+    /* Read up to size bytes, returning number read.  */
+    unsigned int (*read) (char *data, unsigned int size);
+} torture_t;
+
+
+static unsigned long bytes = BYTES;
+static const torture_t *torture;
+static volatile bool stop;
+
+static char ring_buffer[251];
+static ring_t ring;
+
+static char pring_buffer[256];
+static pring_t pring;
+
+
+#define MPRING_PRODUCERS 3
+#define MPRING_CONSUMERS_MAX 2
+
+/* Give up if no element arrives for this many seconds, say if one was
+   lost.  */
+#define MPRING_STALL_SECONDS 10
+
+typedef struct
+{
+    uint32_t producer;
+    uint32_t seq;
+} mpring_torture_item_t;
+
+MPRING_DEFINE (item_ring, mpring_torture_item_t)
+
+static item_ring_slot_t item_slots[16];
+static item_ring_t item_ring;
+static unsigned long items;
+static unsigned char *item_counts[MPRING_PRODUCERS];
+static unsigned long items_popped;
+
+
+static unsigned int
+ring_torture_write (const char *data, unsigned int size)
+{
+    int ret;
+
+    if (size & 1)
+        return ring_write (&ring, data, size);
+
+    ret = ring_putc (&ring, *data);
+    return ret;
+}
+
+
+static unsigned int
+ring_torture_read (char *data, unsigned int size)
+{
+    int ret;
+
+    if (size & 1)
+        return ring_read (&ring, data, size);
+
+    ret = ring_getc (&ring);
+    if (ret < 0)
+        return 0;
+    *data = ret;
+    return 1;
+}
+
+
+static unsigned int
+pring_torture_write (const char *data, unsigned int size)
+{
+    if (size & 1)
+        return pring_write (&pring, data, size);
+
+    return pring_putc (&pring, *data);
+}
+
+
+static unsigned int
+pring_torture_read (char *data, unsigned int size)
+{
+    int ret;
+
+    if (size & 1)
+        return pring_read (&pring, data, size);
+
+    ret = pring_getc (&pring);
+    if (ret < 0)
+        return 0;
+    *data = ret;
+    return 1;
+}
+
+
+static const torture_t tortures[] =
+{
+    {"ring", ring_torture_write, ring_torture_read},
+    {"pring", pring_torture_write, pring_torture_read},
+};
+
+
+/* The byte sequence has a period that is not a multiple of the ring
+   buffer size so that stale data is detected.  */
+static char
+sequence (unsigned long i)
+{
+    return (i % 253) ^ (i >> 16);
+}
+
+
+static void *
+producer (void *arg)
+{
+    char data[CHUNK_MAX];
+    unsigned long i = 0;
+    unsigned int seed = 1;
+
+    while (i < bytes && !stop)
+    {
+        unsigned int size;
+        unsigned int j;
+        unsigned int ret;
+
+        size = rand_r (&seed) % CHUNK_MAX + 1;
+        if (size > bytes - i)
+            size = bytes - i;
+
+        for (j = 0; j < size; j++)
+            data[j] = sequence (i + j);
+
+        ret = torture->write (data, size);
+        if (!ret)
+            sched_yield ();
+        i += ret;
+    }
+    return 0;
+}
+
+
+static unsigned long
+consumer (void)
+{
+    char data[CHUNK_MAX];
+    unsigned long i = 0;
+    unsigned int seed = 2;
+
+    while (i < bytes)
+    {
+        unsigned int size;
+        unsigned int j;
+        unsigned int ret;
+
+        size = rand_r (&seed) % CHUNK_MAX + 1;
+        ret = torture->read (data, size);
+        if (!ret)
+            sched_yield ();
+
+        for (j = 0; j < ret; j++)
+        {
+            if (data[j] != sequence (i + j))
+            {
+                printf ("%s: mismatch at byte %lu\n", torture->name, i + j);
+                return i + j;
+            }
+        }
+        i += ret;
+    }
+    return i;
+}
+
+
+static void *
+mpring_producer (void *arg)
+{
+    mpring_torture_item_t item;
+
+    item.producer = (uintptr_t) arg;
+    for (item.seq = 0; item.seq < items && !stop; )
+    {
+        if (item_ring_push (&item_ring, &item))
+            item.seq++;
+        else
+            sched_yield ();
+    }
+    return 0;
+}
+
+
+static void *
+mpring_consumer (void *arg)
+{
+    mpring_torture_item_t item;
+    unsigned long next[MPRING_PRODUCERS];
+    unsigned long errors = 0;
+    unsigned long idle = 0;
+    time_t last;
+
+    (void) arg;
+    memset (next, 0, sizeof (next));
+    last = time (0);
+
+    while (__atomic_load_n (&items_popped, __ATOMIC_RELAXED)
+           < items * MPRING_PRODUCERS && !stop)
+    {
+        if (!item_ring_pop (&item_ring, &item))
+        {
+            if (++idle % 1024 == 0
+                && time (0) - last > MPRING_STALL_SECONDS)
+            {
+                printf ("mpring: stalled\n");
+                stop = 1;
+                return (void *) 1;
+            }
+            sched_yield ();
+            continue;
+        }
+        idle = 0;
+        last = time (0);
+
+        if (item.producer >= MPRING_PRODUCERS || item.seq >= items
+            || item.seq < next[item.producer])
+        {
+            if (!errors++)
+                printf ("mpring: bad or out of order element %u:%u\n",
+                        (unsigned int) item.producer,
+                        (unsigned int) item.seq);
+            __atomic_fetch_add (&items_popped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        next[item.producer] = item.seq + 1;
+        __atomic_fetch_add (&item_counts[item.producer][item.seq], 1,
+                            __ATOMIC_RELAXED);
+        __atomic_fetch_add (&items_popped, 1, __ATOMIC_RELAXED);
+    }
+    return (void *) (uintptr_t) errors;
+}
+
+
+/* Run producers and consumers over a ring of size slots.  Return
+   non-zero on failure.  */
+static int
+mpring_torture (unsigned int size, unsigned int consumers)
+{
+    pthread_t producers[MPRING_PRODUCERS];
+    pthread_t readers[MPRING_CONSUMERS_MAX];
+    unsigned long errors = 0;
+    unsigned long missing = 0;
+    unsigned int i;
+    unsigned long j;
+    void *ret;
+
+    if (!item_ring_init (&item_ring, item_slots, size))
+    {
+        printf ("mpring: init failed for %u slots\n", size);
+        return 1;
+    }
+
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        memset (item_counts[i], 0, items);
+    items_popped = 0;
+    stop = 0;
+
+    for (i = 0; i < consumers; i++)
+        pthread_create (&readers[i], 0, mpring_consumer, 0);
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        pthread_create (&producers[i], 0, mpring_producer,
+                        (void *) (uintptr_t) i);
+
+    for (i = 0; i < consumers; i++)
+    {
+        pthread_join (readers[i], &ret);
+        errors += (uintptr_t) ret;
+    }
+    /* The producers may be waiting for space after an error.  */
+    stop = 1;
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        pthread_join (producers[i], 0);
+
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        for (j = 0; j < items; j++)
+            if (item_counts[i][j] != 1)
+                missing++;
+
+    printf ("mpring %u slots, %u producers, %u consumers: %lu elements %s\n",
+            size, MPRING_PRODUCERS, consumers, items_popped,
+            !errors && !missing ? "OK" : "FAILED");
+    return errors || missing;
+}
+
+
+int main (int argc, char **argv)
+{
+    unsigned int t;
+    unsigned int i;
+    int failures = 0;
+
+    if (argc > 1)
+        bytes = strtoul (argv[1], 0, 0);
+
+    ring_init (&ring, ring_buffer, sizeof (ring_buffer));
+    pring_init (&pring, pring_buffer, sizeof (pring_buffer));
+
+    for (t = 0; t < sizeof (tortures) / sizeof (tortures[0]); t++)
+    {
+        pthread_t thread;
+        unsigned long received;
+
+        torture = &tortures[t];
+        stop = 0;
+        pthread_create (&thread, 0, producer, 0);
+        received = consumer ();
+        if (received != bytes)
+            failures++;
+
+        /* The producer may be waiting for space.  */
+        stop = 1;
+        pthread_join (thread, 0);
+        printf ("%s: %lu bytes %s\n", torture->name, received,
+                received == bytes ? "OK" : "FAILED");
+    }
+
+    /* Each producer sends a twentieth as many elements as bytes.  */
+    items = bytes / 20;
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        item_counts[i] = malloc (items);
+
+    /* Two slots is the smallest ring and has the most contention.  */
+    failures += mpring_torture (2, 1);
+    failures += mpring_torture (16, 1);
+    failures += mpring_torture (2, 2);
+    failures += mpring_torture (16, 2);
+
+    for (i = 0; i < MPRING_PRODUCERS; i++)
+        free (item_counts[i]);
+    return failures != 0;
+}
@@ -43,7 +43,10 @@
  
     To get the fastest transfers we need to use the multiple block
     read/write commands.  Some cards have multiple internal buffers
-    an an internal parallel reading/writing scheme.
+    an an internal parallel reading/writing scheme.  sdcard_read and
+    sdcard_write use CMD18 and CMD25 for transfers of more than one
+    block.  For writes, ACMD23 is sent first to tell the card how
+    many blocks to pre-erase.
 
     Kingston 2 GB CSD
 0x0, 0x2e, 0x0, 0x32, 0x5b, 0x5a, 0x83, 0xa9, 0xff, 0xff, 0xff, 0x80, 
@@ -70,11 +73,17 @@ typedef enum
     SD_OP_SEND_IF_COND = 8,           /* CMD8 */
     SD_OP_SEND_CSD = 9,               /* CMD9 */
     SD_OP_SEND_CID = 10,              /* CMD10 */
+    SD_OP_STOP_TRANSMISSION = 12,     /* CMD12 */
     SD_OP_SEND_STATUS = 13,           /* CMD13 */
     SD_OP_SET_BLOCKLEN = 16,          /* CMD16 */
     SD_OP_READ_SINGLE_BLOCK = 17,     /* CMD17 */
+    SD_OP_READ_MULTIPLE_BLOCK = 18,   /* CMD18 */
+    SD_OP_SET_WR_BLK_ERASE_COUNT = 23, /* ACMD23 */
     SD_OP_WRITE_BLOCK = 24,           /* CMD24 */
     SD_OP_WRITE_MULTIPLE_BLOCK = 25,  /* CMD25 */
+    SD_OP_ERASE_WR_BLK_START = 32,    /* CMD32 */
+    SD_OP_ERASE_WR_BLK_END = 33,      /* CMD33 */
+    SD_OP_ERASE = 38,                 /* CMD38 */
     SD_OP_APP_SEND_OP_COND = 41,      /* ACMD41 */
     SD_OP_APP_CMD = 55,               /* CMD55 */
     SD_OP_READ_OCR = 58,              /* CMD58 */
@@ -106,7 +115,9 @@ typedef enum
 
 enum
 {
-    SD_START_TOKEN = 0xfe
+    SD_START_TOKEN = 0xfe,
+    SD_MULTIPLE_START_TOKEN = 0xfc,
+    SD_MULTIPLE_STOP_TOKEN = 0xfd
 };
 
 
@@ -141,6 +152,24 @@ typedef enum
 /* The command response time Ncr is 0 to 8 bytes for SDC and 1 to 8 bytes for MMC.  */
 #define SDCARD_NCR 8
 
+/* Set to 1 to enable CRC checking of commands and data.  */
+#ifndef SDCARD_CRC_ENABLE
+#define SDCARD_CRC_ENABLE 0
+#endif
+
+/* Set to 0 to not send ACMD23 to pre-erase blocks before a multiple
+   block write.  */
+#ifndef SDCARD_PRE_ERASE
+#define SDCARD_PRE_ERASE 1
+#endif
+
+/* An erase can take much longer than a write.  The busy wait is
+   allowed one write timeout for every SDCARD_ERASE_TIMEOUT_BLOCKS
+   blocks erased.  */
+#ifndef SDCARD_ERASE_TIMEOUT_BLOCKS
+#define SDCARD_ERASE_TIMEOUT_BLOCKS 1024
+#endif
+
 
 
 static uint8_t sdcard_devices_num = 0;
@@ -174,85 +203,241 @@ sdcard_csd_bits (uint8_t *csd, unsigned int bytes,
 #endif
 
 
-/* The 16-bit CRC uses a standard CCIT generator polynomial:
-   x^16 + x^12 + x^5 + 1   */
+/* The 16-bit CRC uses a standard CCITT generator polynomial:
+   x^16 + x^12 + x^5 + 1 (0x1021) with the data processed MSB first
+   and an initial value of zero.
 
+   The 7-bit CRC uses a generator polynomial:
+   x^7 + x^3 + 1 (0x09).  
 
-static uint16_t 
-sdcard_crc16_bit (uint16_t crc, uint8_t in)
-{
-    uint8_t bit0;
+   SDCARD_CRC_SLICES selects the speed/size tradeoff:
+   0 calculates the CRCs a bit at a time with no tables,
+   1 uses a 512 byte table for CRC16 and a 256 byte table for CRC7,
+   4 or 8 additionally processes 4 or 8 bytes per step for CRC16
+   using tables (2 or 4 KB of RAM) built by sdcard_init.  This
+   suits 32-bit cores.  */
+
+#ifndef SDCARD_CRC_SLICES
+#define SDCARD_CRC_SLICES 1
+#endif
 
-    /* NB, the CRC is stored in reverse order to that specified
-       by the polynomial.  */
-    bit0 = crc & 1;
+#if SDCARD_CRC_SLICES != 0 && SDCARD_CRC_SLICES != 1 \
+    && SDCARD_CRC_SLICES != 4 && SDCARD_CRC_SLICES != 8
+#error SDCARD_CRC_SLICES must be 0, 1, 4, or 8
+#endif
 
-    crc >>= 1;    
-    if (bit0 ^ in)
-        crc = crc ^ (BIT (15 - 0) | BIT (15 - 5) | BIT (15 - 12));
+#define SDCARD_CRC16_POLY 0x1021
+#define SDCARD_CRC7_POLY 0x09
 
-    return crc;
-}
 
+#if SDCARD_CRC_SLICES == 0
 
-uint16_t
+static uint16_t
 sdcard_crc16_byte (uint16_t crc, uint8_t val)
 {
     uint8_t i;
-    
+
+    crc ^= val << 8;
     for (i = 0; i < 8; i++)
     {
-        crc = sdcard_crc16_bit (crc, val & 1);
-        val >>= 1;
+        if (crc & 0x8000)
+            crc = (crc << 1) ^ SDCARD_CRC16_POLY;
+        else
+            crc <<= 1;
     }
     return crc;
 }
 
 
-uint16_t
-sdcard_crc16 (uint16_t crc, const void *buffer, uint16_t size)
+/* Here the CRC is kept in the upper 7 bits.  */
+static uint8_t
+sdcard_crc7_byte (uint8_t crc, uint8_t val)
 {
     uint8_t i;
-    const uint8_t *data = buffer;
-    
-    for (i = 0; i < size; i++)
-        crc = sdcard_crc16_byte (crc, data[i]);
-    
+
+    crc ^= val;
+    for (i = 0; i < 8; i++)
+    {
+        if (crc & 0x80)
+            crc = (crc << 1) ^ (SDCARD_CRC7_POLY << 1);
+        else
+            crc <<= 1;
+    }
     return crc;
 }
 
+#else
+
+static const uint16_t sdcard_crc16_table[256] =
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
 
-/* The 7-bit CRC uses a generator polynomial:
-   x^7 + x^3 + 1   */
 
-uint8_t
-sdcard_crc7_byte (uint8_t crc, uint8_t val, uint8_t bits)
+/* Here the CRC is kept in the upper 7 bits.  */
+static const uint8_t sdcard_crc7_table[256] =
 {
-    int i;
-    
-    for (i = bits; i--; val <<= 1)
+    0x00, 0x12, 0x24, 0x36, 0x48, 0x5a, 0x6c, 0x7e,
+    0x90, 0x82, 0xb4, 0xa6, 0xd8, 0xca, 0xfc, 0xee,
+    0x32, 0x20, 0x16, 0x04, 0x7a, 0x68, 0x5e, 0x4c,
+    0xa2, 0xb0, 0x86, 0x94, 0xea, 0xf8, 0xce, 0xdc,
+    0x64, 0x76, 0x40, 0x52, 0x2c, 0x3e, 0x08, 0x1a,
+    0xf4, 0xe6, 0xd0, 0xc2, 0xbc, 0xae, 0x98, 0x8a,
+    0x56, 0x44, 0x72, 0x60, 0x1e, 0x0c, 0x3a, 0x28,
+    0xc6, 0xd4, 0xe2, 0xf0, 0x8e, 0x9c, 0xaa, 0xb8,
+    0xc8, 0xda, 0xec, 0xfe, 0x80, 0x92, 0xa4, 0xb6,
+    0x58, 0x4a, 0x7c, 0x6e, 0x10, 0x02, 0x34, 0x26,
+    0xfa, 0xe8, 0xde, 0xcc, 0xb2, 0xa0, 0x96, 0x84,
+    0x6a, 0x78, 0x4e, 0x5c, 0x22, 0x30, 0x06, 0x14,
+    0xac, 0xbe, 0x88, 0x9a, 0xe4, 0xf6, 0xc0, 0xd2,
+    0x3c, 0x2e, 0x18, 0x0a, 0x74, 0x66, 0x50, 0x42,
+    0x9e, 0x8c, 0xba, 0xa8, 0xd6, 0xc4, 0xf2, 0xe0,
+    0x0e, 0x1c, 0x2a, 0x38, 0x46, 0x54, 0x62, 0x70,
+    0x82, 0x90, 0xa6, 0xb4, 0xca, 0xd8, 0xee, 0xfc,
+    0x12, 0x00, 0x36, 0x24, 0x5a, 0x48, 0x7e, 0x6c,
+    0xb0, 0xa2, 0x94, 0x86, 0xf8, 0xea, 0xdc, 0xce,
+    0x20, 0x32, 0x04, 0x16, 0x68, 0x7a, 0x4c, 0x5e,
+    0xe6, 0xf4, 0xc2, 0xd0, 0xae, 0xbc, 0x8a, 0x98,
+    0x76, 0x64, 0x52, 0x40, 0x3e, 0x2c, 0x1a, 0x08,
+    0xd4, 0xc6, 0xf0, 0xe2, 0x9c, 0x8e, 0xb8, 0xaa,
+    0x44, 0x56, 0x60, 0x72, 0x0c, 0x1e, 0x28, 0x3a,
+    0x4a, 0x58, 0x6e, 0x7c, 0x02, 0x10, 0x26, 0x34,
+    0xda, 0xc8, 0xfe, 0xec, 0x92, 0x80, 0xb6, 0xa4,
+    0x78, 0x6a, 0x5c, 0x4e, 0x30, 0x22, 0x14, 0x06,
+    0xe8, 0xfa, 0xcc, 0xde, 0xa0, 0xb2, 0x84, 0x96,
+    0x2e, 0x3c, 0x0a, 0x18, 0x66, 0x74, 0x42, 0x50,
+    0xbe, 0xac, 0x9a, 0x88, 0xf6, 0xe4, 0xd2, 0xc0,
+    0x1c, 0x0e, 0x38, 0x2a, 0x54, 0x46, 0x70, 0x62,
+    0x8c, 0x9e, 0xa8, 0xba, 0xc4, 0xd6, 0xe0, 0xf2
+};
+
+
+static inline uint16_t
+sdcard_crc16_byte (uint16_t crc, uint8_t val)
+{
+    return (crc << 8) ^ sdcard_crc16_table[(crc >> 8) ^ val];
+}
+
+
+static inline uint8_t
+sdcard_crc7_byte (uint8_t crc, uint8_t val)
+{
+    return sdcard_crc7_table[crc ^ val];
+}
+
+#endif
+
+
+#if SDCARD_CRC_SLICES > 1
+
+/* sdcard_crc16_slices[k][i] is the CRC of byte i followed by k zero
+   bytes.  */
+static uint16_t sdcard_crc16_slices[SDCARD_CRC_SLICES][256];
+
+
+static void
+sdcard_crc16_slices_init (void)
+{
+    uint16_t i;
+    uint8_t k;
+    uint16_t crc;
+
+    if (sdcard_crc16_slices[1][1])
+        return;
+
+    for (i = 0; i < 256; i++)
     {
-        crc = (crc << 1) | ((val & 0x80) ? 1 : 0);
-        
-        if (crc & 0x80)
-            crc ^= (BIT(0) | BIT(3));
+        crc = sdcard_crc16_table[i];
+        sdcard_crc16_slices[0][i] = crc;
+        for (k = 1; k < SDCARD_CRC_SLICES; k++)
+        {
+            crc = sdcard_crc16_byte (crc, 0);
+            sdcard_crc16_slices[k][i] = crc;
+        }
+    }
+}
+#endif
+
+
+uint16_t
+sdcard_crc16 (uint16_t crc, const void *buffer, uint16_t size)
+{
+    uint16_t i;
+    const uint8_t *data = buffer;
+
+    i = 0;
+#if SDCARD_CRC_SLICES > 1
+    /* The current CRC is combined with the first two bytes of each
+       slice; the contributions of each byte are then independent.  */
+    for (; i + SDCARD_CRC_SLICES <= size; i += SDCARD_CRC_SLICES)
+    {
+        const uint8_t *d = data + i;
+
+        crc = sdcard_crc16_slices[SDCARD_CRC_SLICES - 1][d[0] ^ (crc >> 8)]
+            ^ sdcard_crc16_slices[SDCARD_CRC_SLICES - 2][d[1] ^ (crc & 0xff)]
+            ^ sdcard_crc16_slices[SDCARD_CRC_SLICES - 3][d[2]]
+            ^ sdcard_crc16_slices[SDCARD_CRC_SLICES - 4][d[3]]
+#if SDCARD_CRC_SLICES == 8
+            ^ sdcard_crc16_slices[3][d[4]]
+            ^ sdcard_crc16_slices[2][d[5]]
+            ^ sdcard_crc16_slices[1][d[6]]
+            ^ sdcard_crc16_slices[0][d[7]]
+#endif
+            ;
     }
-    return crc & 0x7f;
+#endif
+
+    for (; i < size; i++)
+        crc = sdcard_crc16_byte (crc, data[i]);
+
+    return crc;
 }
 
 
+/* Return the 7-bit CRC; CRC is a previous 7-bit CRC to continue from,
+   or zero.  */
 uint8_t
 sdcard_crc7 (uint8_t crc, const void *buffer, uint8_t size)
 {
     uint8_t i;
     const uint8_t *data = buffer;
 
+    crc <<= 1;
     for (i = 0; i < size; i++)
-        crc = sdcard_crc7_byte (crc, data[i], 8);
-
-    crc = sdcard_crc7_byte (crc, 0, 7);
+        crc = sdcard_crc7_byte (crc, data[i]);
 
-    return crc;
+    return crc >> 1;
 }
 
 
@@ -299,7 +484,7 @@ sdcard_error (sdcard_t dev, sdcard_error_t error, sdcard_status_t status)
 bool
 sdcard_response_match (sdcard_t dev, uint8_t desired, uint32_t timeout)
 {
-    uint16_t retries;
+    uint32_t retries;
     uint8_t command[1];
     uint8_t response[1];
 
@@ -321,7 +506,7 @@ sdcard_response_match (sdcard_t dev, uint8_t desired, uint32_t timeout)
 bool
 sdcard_response_not_match (sdcard_t dev, uint8_t desired, uint32_t timeout)
 {
-    uint16_t retries;
+    uint32_t retries;
     uint8_t command[1];
     uint8_t response[1];
 
@@ -359,6 +544,47 @@ sdcard_deselect (sdcard_t dev)
 }
 
 
+/* Wait for the card to finish programming after a deferred write.  */
+static bool
+sdcard_busy_wait (sdcard_t dev)
+{
+    bool ok;
+
+    if (!dev->busy)
+        return 1;
+    dev->busy = 0;
+
+    ok = sdcard_response_not_match (dev, 0x00, dev->write_timeout);
+    sdcard_deselect (dev);
+
+    if (!ok)
+        dev->write_failed = 1;
+    return ok;
+}
+
+
+bool
+sdcard_ready_p (sdcard_t dev)
+{
+    uint8_t command[1];
+    uint8_t response[1];
+
+    if (!dev->busy)
+        return 1;
+
+    /* The card holds DO low while busy.  */
+    command[0] = 0xff;
+    spi_transfer (dev->spi, command, response, 1, 0);
+    sdcard_deselect (dev);
+
+    if (response[0] == 0x00)
+        return 0;
+
+    dev->busy = 0;
+    return 1;
+}
+
+
 static uint8_t
 sdcard_command (sdcard_t dev, sdcard_op_t op, uint32_t param)
 {
@@ -366,6 +592,9 @@ sdcard_command (sdcard_t dev, sdcard_op_t op, uint32_t param)
     uint8_t response[SD_CMD_LEN];
     uint16_t retries;
 
+    /* A deferred write may still be in progress.  */
+    sdcard_busy_wait (dev);
+
 #if 0    
     /* Wait N_cs clock cycles, min is 0.  */
     command[0] = 0xff;
@@ -387,7 +616,7 @@ sdcard_command (sdcard_t dev, sdcard_op_t op, uint32_t param)
         break;
 
     case SD_OP_SEND_IF_COND:
-        command[5] = 0x86;
+        command[5] = 0x87;
         break;
 
     default:
@@ -403,6 +632,11 @@ sdcard_command (sdcard_t dev, sdcard_op_t op, uint32_t param)
 
     command[0] = 0xff;
 
+    /* When stopping a multiple block read, the byte following the
+       command is a stuff byte that may be anything.  */
+    if (op == SD_OP_STOP_TRANSMISSION)
+        spi_transfer (dev->spi, command, response, 1, 0);
+
     /* Search for R1 response; the card should respond with 0 to 8
        bytes of 0xff beforehand.  */
     for (retries = 0; retries < SDCARD_NCR + 1; retries++)
@@ -504,7 +738,9 @@ sdcard_command_read (sdcard_t dev, sdcard_op_t op, uint32_t param,
 
     sdcard_deselect (dev);
 
-    /* Could check crc here.  */
+    if (dev->crc_enabled
+        && sdcard_crc16 (0, buffer, bytes) != ((crc[0] << 8) | crc[1]))
+        return 4;
     
     return 0;
 }
@@ -669,32 +905,77 @@ sdcard_block_read (sdcard_t dev, sdcard_addr_t addr, void *buffer)
 }
 
 
+/* Read BLOCKS consecutive blocks using a multiple block read.  This
+   avoids the command overhead for each block.  */
+static sdcard_ret_t
+sdcard_blocks_read (sdcard_t dev, sdcard_addr_t addr, void *buffer,
+                    uint16_t blocks)
+{
+    uint8_t status;
+    uint8_t crc[2];
+    uint8_t *dst;
+    uint16_t i;
+
+    status = sdcard_command (dev, SD_OP_READ_MULTIPLE_BLOCK,
+                             addr >> dev->addr_shift);
+    if (status != 0)
+    {
+        sdcard_deselect (dev);
+        sdcard_error (dev, SDCARD_ERROR_READ, status);
+        return 0;
+    }
+
+    dst = buffer;
+    for (i = 0; i < blocks; i++)
+    {
+        /* Wait for card to return the start data token.  */
+        if (!sdcard_response_match (dev, SD_START_TOKEN, dev->read_timeout))
+            break;
+
+        memset (dst, 0xff, SDCARD_BLOCK_SIZE);
+        spi_transfer (dev->spi, dst, dst, SDCARD_BLOCK_SIZE, 0);
+
+        /* Read the 16 bit crc.  */
+        memset (crc, 0xff, sizeof (crc));
+        spi_transfer (dev->spi, crc, crc, sizeof (crc), 0);
+
+        if (dev->crc_enabled
+            && sdcard_crc16 (0, dst, SDCARD_BLOCK_SIZE)
+            != ((crc[0] << 8) | crc[1]))
+            break;
+
+        dst += SDCARD_BLOCK_SIZE;
+    }
+
+    /* The card keeps sending blocks until told to stop.  The R1b
+       response is followed by busy while the card stops.  */
+    status = sdcard_command (dev, SD_OP_STOP_TRANSMISSION, 0);
+    sdcard_response_not_match (dev, 0x00, dev->read_timeout);
+    sdcard_deselect (dev);
+
+    if (i != blocks)
+        sdcard_error (dev, SDCARD_ERROR_READ, status);
+
+    return i * SDCARD_BLOCK_SIZE;
+}
+
+
 sdcard_ret_t
 sdcard_read (sdcard_t dev, sdcard_addr_t addr, void *buffer, sdcard_size_t size)
 {
     uint16_t blocks;
-    uint16_t i;
-    sdcard_size_t total;
-    sdcard_size_t bytes;
-    uint8_t *dst;
 
     /* Ignore partial reads.  */
     if (addr % SDCARD_BLOCK_SIZE || size % SDCARD_BLOCK_SIZE)
         return 0;
 
     blocks = size / SDCARD_BLOCK_SIZE;
-    dst = buffer;
-    total = 0;
-    for (i = 0; i < blocks; i++)
-    {
-        bytes = sdcard_block_read (dev, addr, dst);
-        if (!bytes)
-            return total;
-        addr += bytes;
-        dst += bytes;
-        total += bytes;
-    }
-    return total;
+    if (!blocks)
+        return 0;
+    if (blocks == 1)
+        return sdcard_block_read (dev, addr, buffer);
+
+    return sdcard_blocks_read (dev, addr, buffer, blocks);
 }
 
 
@@ -742,6 +1023,17 @@ sdcard_block_write (sdcard_t dev, sdcard_addr_t addr, const void *buffer)
         // dev->write_status = sdcard_status_read (dev);
         return 0;
     }
+
+    if (dev->write_defer)
+    {
+        /* Let the card program the block while the caller gets on
+           with something else.  The busy wait is performed before
+           the next command and the status is read by sdcard_sync.  */
+        sdcard_deselect (dev);
+        dev->busy = 1;
+        dev->write_unchecked = 1;
+        return SDCARD_BLOCK_SIZE;
+    }
     
     /* Wait for card to complete write cycle.  */
     if (!sdcard_response_not_match (dev, 0x00, dev->write_timeout))
@@ -763,33 +1055,206 @@ sdcard_block_write (sdcard_t dev, sdcard_addr_t addr, const void *buffer)
 }
 
 
+/* Write BLOCKS consecutive blocks using a multiple block write.  The
+   busy wait is still required after each block but the command and
+   status read overheads are only incurred once.  */
+static sdcard_ret_t
+sdcard_blocks_write (sdcard_t dev, sdcard_addr_t addr, const void *buffer,
+                     uint16_t blocks)
+{
+    uint8_t status;
+    sdcard_status_t wstatus;
+    uint16_t crc;
+    uint8_t command[3];
+    uint8_t response[3];
+    const uint8_t *src;
+    uint16_t i;
+
+#if SDCARD_PRE_ERASE
+    /* Tell the card how many blocks are to be written so that it can
+       erase them beforehand.  This is not supported by MMC.  */
+    if (dev->type != SDCARD_TYPE_MMC)
+    {
+        sdcard_app_command (dev, SD_OP_SET_WR_BLK_ERASE_COUNT, blocks);
+        sdcard_deselect (dev);
+    }
+#endif
+
+    status = sdcard_command (dev, SD_OP_WRITE_MULTIPLE_BLOCK,
+                             addr >> dev->addr_shift);
+    if (status != 0)
+    {
+        sdcard_deselect (dev);
+        sdcard_error (dev, SDCARD_ERROR_WRITE, status);
+        return 0;
+    }
+
+    src = buffer;
+    for (i = 0; i < blocks; i++)
+    {
+        if (dev->crc_enabled)
+            crc = sdcard_crc16 (0, src, SDCARD_BLOCK_SIZE);
+        else
+            crc = 0xffff;
+
+        /* Send Nwr dummy clocks then data start block token.  */
+        command[0] = 0xff;
+        command[1] = SD_MULTIPLE_START_TOKEN;
+        spi_write (dev->spi, command, 2, 0);
+
+        /* Send the data.  */
+        spi_write (dev->spi, src, SDCARD_BLOCK_SIZE, 0);
+
+        command[0] = crc >> 8;
+        command[1] = crc & 0xff;
+        command[2] = 0xff;
+
+        /* Send the crc and get the status response.  */
+        spi_transfer (dev->spi, command, response, 3, 0);
+
+        /* Check to see if the data was accepted.  */
+        if ((response[2] & 0x1F) != SD_WRITE_OK)
+        {
+            sdcard_error (dev, SDCARD_ERROR_WRITE_REJECT, response[2]);
+            break;
+        }
+
+        /* Wait for card to program the block.  */
+        if (!sdcard_response_not_match (dev, 0x00, dev->write_timeout))
+            break;
+
+        src += SDCARD_BLOCK_SIZE;
+    }
+
+    /* Send the stop token, skip a byte, then wait until not busy.  */
+    command[0] = SD_MULTIPLE_STOP_TOKEN;
+    command[1] = 0xff;
+    spi_write (dev->spi, command, 2, 0);
+
+    if (dev->write_defer)
+    {
+        sdcard_deselect (dev);
+        dev->busy = 1;
+        dev->write_unchecked = 1;
+        return i * SDCARD_BLOCK_SIZE;
+    }
+
+    sdcard_response_not_match (dev, 0x00, dev->write_timeout);
+    sdcard_deselect (dev);
+
+    /* Look for a write error; this covers all the blocks.  */
+    if ((wstatus = sdcard_status_read (dev)))
+    {
+        sdcard_error (dev, SDCARD_ERROR_WRITE, wstatus);
+        return 0;
+    }
+
+    return i * SDCARD_BLOCK_SIZE;
+}
+
+
 sdcard_ret_t
 sdcard_write (sdcard_t dev, sdcard_addr_t addr, const void *buffer,
               sdcard_size_t size)
 {
     uint16_t blocks;
-    uint16_t i;
-    sdcard_size_t total;
-    sdcard_size_t bytes;
-    const uint8_t *src;
 
     /* Ignore partial writes.  */
     if (addr % SDCARD_BLOCK_SIZE || size % SDCARD_BLOCK_SIZE)
         return 0;
 
     blocks = size / SDCARD_BLOCK_SIZE;
-    src = buffer;
-    total = 0;
-    for (i = 0; i < blocks; i++)
+    if (!blocks)
+        return 0;
+    if (blocks == 1)
+        return sdcard_block_write (dev, addr, buffer);
+
+    return sdcard_blocks_write (dev, addr, buffer, blocks);
+}
+
+
+sdcard_err_t
+sdcard_sync (sdcard_t dev)
+{
+    sdcard_status_t wstatus;
+    bool failed;
+
+    sdcard_busy_wait (dev);
+    failed = dev->write_failed;
+    dev->write_failed = 0;
+
+    /* A single status read covers all the deferred writes.  */
+    if (dev->write_unchecked)
     {
-        bytes = sdcard_block_write (dev, addr, src);
-        if (!bytes)
-            return total;
-        addr += bytes;
-        src += bytes;
-        total += bytes;
+        dev->write_unchecked = 0;
+        if ((wstatus = sdcard_status_read (dev)))
+        {
+            sdcard_error (dev, SDCARD_ERROR_WRITE, wstatus);
+            failed = 1;
+        }
     }
-    return total;
+
+    return failed ? SDCARD_ERR_ERROR : SDCARD_ERR_OK;
+}
+
+
+sdcard_err_t
+sdcard_erase (sdcard_t dev, sdcard_addr_t addr, sdcard_size_t size)
+{
+    uint8_t status;
+    sdcard_status_t wstatus;
+    uint32_t blocks;
+    uint32_t i;
+    bool ok;
+
+    if (!size || addr % SDCARD_BLOCK_SIZE || size % SDCARD_BLOCK_SIZE)
+        return SDCARD_ERR_PARAM;
+
+    /* MMC cards use different erase commands.  */
+    if (dev->type == SDCARD_TYPE_MMC)
+        return SDCARD_ERR_PARAM;
+
+    blocks = size / SDCARD_BLOCK_SIZE;
+
+    status = sdcard_command (dev, SD_OP_ERASE_WR_BLK_START,
+                             addr >> dev->addr_shift);
+    sdcard_deselect (dev);
+    if (status)
+        return SDCARD_ERR_ERROR;
+
+    status = sdcard_command (dev, SD_OP_ERASE_WR_BLK_END,
+                             (addr + size - SDCARD_BLOCK_SIZE)
+                             >> dev->addr_shift);
+    sdcard_deselect (dev);
+    if (status)
+        return SDCARD_ERR_ERROR;
+
+    /* This has an R1b response; the card holds DO low while busy.  */
+    status = sdcard_command (dev, SD_OP_ERASE, 0);
+    if (status)
+    {
+        sdcard_deselect (dev);
+        return SDCARD_ERR_ERROR;
+    }
+
+    ok = 0;
+    for (i = 0; i <= blocks / SDCARD_ERASE_TIMEOUT_BLOCKS && !ok; i++)
+        ok = sdcard_response_not_match (dev, 0x00, dev->write_timeout);
+    sdcard_deselect (dev);
+
+    if (!ok)
+    {
+        sdcard_error (dev, SDCARD_ERROR_WRITE_TIMEOUT, 0);
+        return SDCARD_ERR_ERROR;
+    }
+
+    if ((wstatus = sdcard_status_read (dev)))
+    {
+        sdcard_error (dev, SDCARD_ERROR_WRITE, wstatus);
+        return SDCARD_ERR_ERROR;
+    }
+
+    return SDCARD_ERR_OK;
 }
 
 
@@ -848,7 +1313,7 @@ sdcard_test (sdcard_t dev)
 
     for (i = 0; i < sizeof (tmp); i++)
     {
-        if (tmp[i] != ~(i & 0xff))
+        if (tmp[i] != (uint8_t)~(i & 0xff))
             return 7;
     }
     return 0;
@@ -1035,6 +1500,13 @@ sdcard_probe (sdcard_t dev)
         return SDCARD_ERR_ERROR;
     }
 
+#if SDCARD_CRC_ENABLE
+    status = sdcard_command (dev, SD_OP_CRC_ON_OFF, 1);
+    sdcard_deselect (dev);
+    if (status == 0)
+        dev->crc_enabled = 1;
+#endif
+
     status = sdcard_ocr_read (dev, &ocr);
 
     /* If the OCR is zero then it is likely that the card is being current 
@@ -1074,6 +1546,12 @@ sdcard_init (const sdcard_cfg_t *cfg)
     /* This will change when CSD is read.  */
     dev->read_timeout = 8;
 
+    dev->write_defer = cfg->write_defer;
+
+#if SDCARD_CRC_SLICES > 1
+    sdcard_crc16_slices_init ();
+#endif
+
     return dev;
 }
 
@@ -1081,6 +1559,7 @@ sdcard_init (const sdcard_cfg_t *cfg)
 void
 sdcard_shutdown (sdcard_t dev)
 {
+    sdcard_sync (dev);
     // TODO
     spi_shutdown (dev->spi);
 }
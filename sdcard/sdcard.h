@@ -37,6 +37,9 @@ typedef uint16_t sdcard_status_t;
 typedef struct
 {
     spi_cfg_t spi;
+    /* Set to return from a write once the card has accepted the data
+       rather than waiting for it to be programmed.  */
+    bool write_defer;
 } sdcard_cfg_t;    
 
 
@@ -60,6 +63,13 @@ typedef struct
     uint8_t status;
     sdcard_type_t type;
     bool crc_enabled;
+    bool write_defer;
+    /* Card may be busy programming after a deferred write.  */
+    bool busy;
+    /* Card status needs reading after deferred writes.  */
+    bool write_unchecked;
+    /* Waiting for a deferred write timed out.  */
+    bool write_failed;
 } sdcard_dev_t;
 
 
@@ -91,6 +101,24 @@ sdcard_t
 sdcard_init (const sdcard_cfg_t *cfg);
 
 
+/** Return non-zero if the card has finished programming after a
+    deferred write.  */
+bool
+sdcard_ready_p (sdcard_t dev);
+
+
+/** Wait for deferred writes to complete and check the card status
+    for any errors since the last sync.  */
+sdcard_err_t
+sdcard_sync (sdcard_t dev);
+
+
+/** Erase whole blocks.  Erased blocks read as all zeros or all ones
+    depending on the card.  */
+sdcard_err_t
+sdcard_erase (sdcard_t dev, sdcard_addr_t addr, sdcard_size_t size);
+
+
 sdcard_addr_t
 sdcard_capacity_get (sdcard_t dev);
 
@@ -0,0 +1,20 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BIT(X) (1u << (X))
+
+#define __unused__ __attribute__((unused))
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
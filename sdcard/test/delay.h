@@ -0,0 +1,7 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+/* The simulated card does not need real delays.  */
+#define delay_ms(ms)
+
+#endif
@@ -0,0 +1,697 @@
+/** @file   sdcard_sim.c
+    @brief  Simulated SPI-mode SD card for host testing.
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "spi.h"
+#include "sdcard_sim.h"
+
+/* This models an SDHC card in SPI mode at the byte level and
+   implements the SPI driver functions used by sdcard.c so that the
+   driver can be tested on a host.  The card responds to CMD0, CMD8,
+   CMD9, CMD10, CMD12, CMD13, CMD16, CMD17, CMD18, CMD24, CMD25,
+   CMD32, CMD33, CMD38, CMD55, CMD58, CMD59, ACMD23, and ACMD41.
+   Erased blocks read as zeros.
+
+   Each byte clocked is full duplex; the card's output byte is
+   determined before the host's byte is seen.  Bytes the card has to
+   send are queued, and when the queue is empty the card sends 0x00
+   if busy or 0xff otherwise.  Command and data CRCs are checked
+   when enabled with CMD59 (CMD0 and CMD8 are always checked).  */
+
+
+enum {SIM_BLOCK_SIZE = 512};
+
+enum {SIM_OUT_SIZE = 2048};
+
+enum
+{
+    SIM_R1_IDLE = 0x01,
+    SIM_R1_ILLEGAL_COMMAND = 0x04,
+    SIM_R1_CRC_ERROR = 0x08,
+    SIM_R1_PARAMETER_ERROR = 0x40
+};
+
+enum
+{
+    SIM_TOKEN_START = 0xfe,
+    SIM_TOKEN_MULTIPLE_START = 0xfc,
+    SIM_TOKEN_MULTIPLE_STOP = 0xfd,
+    SIM_TOKEN_ERROR = 0x01
+};
+
+enum
+{
+    SIM_DATA_ACCEPTED = 0x05,
+    SIM_DATA_CRC_ERROR = 0x0b,
+    SIM_DATA_WRITE_ERROR = 0x0d
+};
+
+typedef enum
+{
+    SIM_STATE_COMMAND,
+    SIM_STATE_WRITE_TOKEN,
+    SIM_STATE_WRITE_DATA,
+    SIM_STATE_MULTIPLE_WRITE_TOKEN,
+    SIM_STATE_MULTIPLE_WRITE_DATA
+} sdcard_sim_state_t;
+
+
+struct spi_dev_struct
+{
+    sdcard_sim_cfg_t cfg;
+    sdcard_sim_stats_t stats;
+    int fd;
+    spi_cs_mode_t cs_mode;
+    bool cs;
+    bool spi_mode;
+    bool idle;
+    bool app;
+    bool crc_on;
+    bool streaming;
+    bool write_error;
+    uint8_t polls;
+    sdcard_sim_state_t state;
+    uint8_t command[6];
+    uint8_t command_len;
+    uint32_t block;
+    uint32_t erase_start;
+    uint32_t erase_end;
+    uint32_t busy;
+    uint32_t reads;
+    uint32_t writes;
+    uint8_t data[SIM_BLOCK_SIZE + 2];
+    uint16_t data_len;
+    uint8_t out[SIM_OUT_SIZE];
+    uint16_t out_head;
+    uint16_t out_tail;
+};
+
+
+static struct spi_dev_struct sim;
+
+
+static uint8_t
+sdcard_sim_crc7 (const uint8_t *data, uint8_t size)
+{
+    uint8_t crc = 0;
+    uint8_t i;
+    uint8_t j;
+    uint8_t val;
+
+    for (i = 0; i < size; i++)
+    {
+        val = data[i];
+        for (j = 0; j < 8; j++, val <<= 1)
+        {
+            crc <<= 1;
+            if ((val ^ crc) & 0x80)
+                crc ^= 0x09;
+        }
+    }
+    return crc & 0x7f;
+}
+
+
+static uint16_t
+sdcard_sim_crc16 (const uint8_t *data, uint16_t size)
+{
+    uint16_t crc = 0;
+    uint16_t i;
+    uint8_t j;
+
+    for (i = 0; i < size; i++)
+    {
+        crc ^= data[i] << 8;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+
+static void
+sdcard_sim_push (uint8_t val)
+{
+    if (sim.out_tail < SIM_OUT_SIZE)
+        sim.out[sim.out_tail++] = val;
+}
+
+
+static void
+sdcard_sim_push_block (const uint8_t *data, uint16_t size, bool corrupt)
+{
+    uint16_t crc;
+    uint16_t i;
+
+    for (i = 0; i < sim.cfg.read_delay_bytes; i++)
+        sdcard_sim_push (0xff);
+
+    crc = sdcard_sim_crc16 (data, size);
+    if (corrupt)
+        crc ^= 1;
+
+    sdcard_sim_push (SIM_TOKEN_START);
+    for (i = 0; i < size; i++)
+        sdcard_sim_push (data[i]);
+    sdcard_sim_push (crc >> 8);
+    sdcard_sim_push (crc & 0xff);
+}
+
+
+static void
+sdcard_sim_push_read (uint32_t block)
+{
+    uint8_t data[SIM_BLOCK_SIZE];
+    bool corrupt;
+
+    sim.reads++;
+    if (sim.cfg.read_error_period
+        && sim.reads % sim.cfg.read_error_period == 0)
+    {
+        /* An error token aborts a multiple block read.  */
+        sdcard_sim_push (SIM_TOKEN_ERROR);
+        sim.streaming = 0;
+        return;
+    }
+
+    memset (data, 0, sizeof (data));
+    if (pread (sim.fd, data, sizeof (data),
+               (off_t)block * SIM_BLOCK_SIZE) < 0)
+    {
+        sdcard_sim_push (SIM_TOKEN_ERROR);
+        return;
+    }
+
+    corrupt = sim.cfg.read_crc_error_period
+        && sim.reads % sim.cfg.read_crc_error_period == 0;
+
+    sdcard_sim_push_block (data, sizeof (data), corrupt);
+    sim.stats.blocks_read++;
+}
+
+
+static void
+sdcard_sim_csd_push (void)
+{
+    uint8_t csd[16] = {0x40, 0x0e, 0x00, 0x32, 0x5b, 0x59, 0x00, 0x00,
+                       0x00, 0x00, 0x7f, 0x80, 0x0a, 0x40, 0x40, 0x00};
+    uint32_t c_size;
+
+    /* SDHC capacity is (c_size + 1) * 512 KB.  */
+    c_size = sim.cfg.blocks / 1024 - 1;
+    csd[7] = (c_size >> 16) & 0x3f;
+    csd[8] = c_size >> 8;
+    csd[9] = c_size;
+    csd[15] = (sdcard_sim_crc7 (csd, 15) << 1) | 1;
+
+    sdcard_sim_push_block (csd, sizeof (csd), 0);
+}
+
+
+static void
+sdcard_sim_cid_push (void)
+{
+    uint8_t cid[16] = {0x03, 'S', 'M', 'S', 'I', 'M', 'S', 'D',
+                       0x10, 0x12, 0x34, 0x56, 0x78, 0x01, 0x1a, 0x00};
+
+    cid[15] = (sdcard_sim_crc7 (cid, 15) << 1) | 1;
+    sdcard_sim_push_block (cid, sizeof (cid), 0);
+}
+
+
+static void
+sdcard_sim_erase (void)
+{
+    uint8_t zeros[SIM_BLOCK_SIZE];
+    uint32_t block;
+
+    memset (zeros, 0, sizeof (zeros));
+    for (block = sim.erase_start; block <= sim.erase_end; block++)
+    {
+        if (pwrite (sim.fd, zeros, sizeof (zeros),
+                    (off_t)block * SIM_BLOCK_SIZE) != SIM_BLOCK_SIZE)
+            sim.write_error = 1;
+        sim.stats.blocks_erased++;
+    }
+    sim.busy = sim.cfg.write_busy_bytes + 1;
+}
+
+
+static void
+sdcard_sim_command (void)
+{
+    uint8_t op;
+    uint32_t arg;
+    uint8_t r1;
+    bool app;
+    uint32_t ocr;
+
+    op = sim.command[0] & 0x3f;
+    arg = ((uint32_t)sim.command[1] << 24) | (sim.command[2] << 16)
+        | (sim.command[3] << 8) | sim.command[4];
+
+    /* Until CMD0 is received with CS asserted the card is in SD mode.  */
+    if (!sim.spi_mode && op != 0)
+        return;
+
+    sim.stats.commands++;
+    app = sim.app;
+    sim.app = 0;
+
+    if (op == 12)
+    {
+        /* Stop transmission; discard the rest of the data being
+           sent.  This is followed by a stuff byte.  */
+        sim.out_head = sim.out_tail = 0;
+        sim.streaming = 0;
+        sdcard_sim_push (0xff);
+        sdcard_sim_push (0x00);
+        sim.busy = 2;
+        return;
+    }
+
+    /* Ncr.  */
+    sdcard_sim_push (0xff);
+
+    r1 = sim.idle ? SIM_R1_IDLE : 0;
+
+    if ((op == 0 || op == 8 || sim.crc_on)
+        && sim.command[5] != ((sdcard_sim_crc7 (sim.command, 5) << 1) | 1))
+    {
+        sim.stats.crc_errors++;
+        sdcard_sim_push (r1 | SIM_R1_CRC_ERROR);
+        return;
+    }
+
+    if (app)
+    {
+        switch (op)
+        {
+        case 41:
+            if (++sim.polls >= sim.cfg.init_polls)
+                sim.idle = 0;
+            sdcard_sim_push (sim.idle ? SIM_R1_IDLE : 0);
+            return;
+
+        case 23:
+            sdcard_sim_push (r1);
+            return;
+
+        default:
+            break;
+        }
+    }
+
+    switch (op)
+    {
+    case 0:
+        sim.spi_mode = 1;
+        sim.idle = 1;
+        sim.polls = 0;
+        sim.crc_on = 0;
+        sim.streaming = 0;
+        sim.state = SIM_STATE_COMMAND;
+        sdcard_sim_push (SIM_R1_IDLE);
+        break;
+
+    case 8:
+        /* R7 echoes the voltage and check pattern.  */
+        sdcard_sim_push (r1);
+        sdcard_sim_push (0x00);
+        sdcard_sim_push (0x00);
+        sdcard_sim_push ((arg >> 8) & 0x0f);
+        sdcard_sim_push (arg & 0xff);
+        break;
+
+    case 9:
+        sdcard_sim_push (r1);
+        sdcard_sim_csd_push ();
+        break;
+
+    case 10:
+        sdcard_sim_push (r1);
+        sdcard_sim_cid_push ();
+        break;
+
+    case 13:
+        /* R2; the second byte flags any write error since the last
+           status read.  */
+        sdcard_sim_push (r1);
+        sdcard_sim_push (sim.write_error ? 0x04 : 0x00);
+        sim.write_error = 0;
+        break;
+
+    case 16:
+        sdcard_sim_push (r1);
+        break;
+
+    case 17:
+    case 18:
+    case 24:
+    case 25:
+        if (sim.idle)
+        {
+            sdcard_sim_push (r1 | SIM_R1_ILLEGAL_COMMAND);
+            break;
+        }
+        if (arg >= sim.cfg.blocks)
+        {
+            sdcard_sim_push (r1 | SIM_R1_PARAMETER_ERROR);
+            break;
+        }
+        sdcard_sim_push (r1);
+        sim.block = arg;
+
+        if (op == 17)
+            sdcard_sim_push_read (sim.block);
+        else if (op == 18)
+            sim.streaming = 1;
+        else if (op == 24)
+            sim.state = SIM_STATE_WRITE_TOKEN;
+        else
+            sim.state = SIM_STATE_MULTIPLE_WRITE_TOKEN;
+        break;
+
+    case 32:
+    case 33:
+        if (arg >= sim.cfg.blocks)
+        {
+            sdcard_sim_push (r1 | SIM_R1_PARAMETER_ERROR);
+            break;
+        }
+        if (op == 32)
+            sim.erase_start = arg;
+        else
+            sim.erase_end = arg;
+        sdcard_sim_push (r1);
+        break;
+
+    case 38:
+        /* R1b; the card is busy for a while per block erased.  */
+        if (sim.erase_start > sim.erase_end)
+        {
+            sdcard_sim_push (r1 | SIM_R1_PARAMETER_ERROR);
+            break;
+        }
+        sdcard_sim_push (r1);
+        sdcard_sim_erase ();
+        break;
+
+    case 55:
+        sim.app = 1;
+        sdcard_sim_push (r1);
+        break;
+
+    case 58:
+        /* R3; the power up and CCS bits are set after initialisation.  */
+        ocr = 0x00ff8000;
+        if (!sim.idle)
+            ocr |= 0xc0000000;
+        sdcard_sim_push (r1);
+        sdcard_sim_push (ocr >> 24);
+        sdcard_sim_push (ocr >> 16);
+        sdcard_sim_push (ocr >> 8);
+        sdcard_sim_push (ocr);
+        break;
+
+    case 59:
+        sim.crc_on = arg & 1;
+        sdcard_sim_push (r1);
+        break;
+
+    default:
+        sdcard_sim_push (r1 | SIM_R1_ILLEGAL_COMMAND);
+        break;
+    }
+}
+
+
+static uint8_t
+sdcard_sim_block_write (void)
+{
+    uint16_t crc;
+
+    crc = (sim.data[SIM_BLOCK_SIZE] << 8) | sim.data[SIM_BLOCK_SIZE + 1];
+    if (sim.crc_on && crc != sdcard_sim_crc16 (sim.data, SIM_BLOCK_SIZE))
+    {
+        sim.stats.crc_errors++;
+        return SIM_DATA_CRC_ERROR;
+    }
+
+    sim.writes++;
+    if ((sim.cfg.write_error_period
+         && sim.writes % sim.cfg.write_error_period == 0)
+        || sim.block >= sim.cfg.blocks
+        || pwrite (sim.fd, sim.data, SIM_BLOCK_SIZE,
+                   (off_t)sim.block * SIM_BLOCK_SIZE) != SIM_BLOCK_SIZE)
+    {
+        sim.write_error = 1;
+        return SIM_DATA_WRITE_ERROR;
+    }
+
+    sim.block++;
+    sim.stats.blocks_written++;
+    return SIM_DATA_ACCEPTED;
+}
+
+
+static void
+sdcard_sim_input (uint8_t in)
+{
+    switch (sim.state)
+    {
+    case SIM_STATE_COMMAND:
+        /* A command starts with the bits 01.  */
+        if (sim.command_len == 0 && (in & 0xc0) != 0x40)
+            break;
+        sim.command[sim.command_len++] = in;
+        if (sim.command_len == sizeof (sim.command))
+        {
+            sim.command_len = 0;
+            sdcard_sim_command ();
+        }
+        break;
+
+    case SIM_STATE_WRITE_TOKEN:
+        if (in == SIM_TOKEN_START)
+        {
+            sim.data_len = 0;
+            sim.state = SIM_STATE_WRITE_DATA;
+        }
+        break;
+
+    case SIM_STATE_MULTIPLE_WRITE_TOKEN:
+        if (in == SIM_TOKEN_MULTIPLE_START)
+        {
+            sim.data_len = 0;
+            sim.state = SIM_STATE_MULTIPLE_WRITE_DATA;
+        }
+        else if (in == SIM_TOKEN_MULTIPLE_STOP)
+        {
+            /* The card goes busy one byte after the stop token.  */
+            sdcard_sim_push (0xff);
+            sim.busy = sim.cfg.write_busy_bytes;
+            sim.state = SIM_STATE_COMMAND;
+        }
+        break;
+
+    case SIM_STATE_WRITE_DATA:
+    case SIM_STATE_MULTIPLE_WRITE_DATA:
+        sim.data[sim.data_len++] = in;
+        if (sim.data_len < sizeof (sim.data))
+            break;
+
+        sdcard_sim_push (sdcard_sim_block_write ());
+        sim.busy = sim.cfg.write_busy_bytes;
+        if (sim.state == SIM_STATE_WRITE_DATA)
+            sim.state = SIM_STATE_COMMAND;
+        else
+            sim.state = SIM_STATE_MULTIPLE_WRITE_TOKEN;
+        break;
+    }
+}
+
+
+static uint8_t
+sdcard_sim_clock (uint8_t in)
+{
+    uint8_t out;
+
+    sim.stats.bus_bytes++;
+
+    /* The card keeps programming while deselected.  */
+    if (!sim.cs)
+    {
+        if (sim.busy)
+            sim.busy--;
+        return 0xff;
+    }
+
+    if (sim.out_head == sim.out_tail && sim.streaming && !sim.busy)
+    {
+        /* Multiple block read; keep sending until stopped.  */
+        sim.out_head = sim.out_tail = 0;
+        if (sim.block < sim.cfg.blocks)
+            sdcard_sim_push_read (sim.block++);
+        else
+        {
+            sdcard_sim_push (SIM_TOKEN_ERROR);
+            sim.streaming = 0;
+        }
+    }
+
+    if (sim.out_head != sim.out_tail)
+    {
+        out = sim.out[sim.out_head++];
+        if (sim.out_head == sim.out_tail)
+            sim.out_head = sim.out_tail = 0;
+    }
+    else if (sim.busy)
+    {
+        sim.busy--;
+        out = 0x00;
+    }
+    else
+        out = 0xff;
+
+    sdcard_sim_input (in);
+    return out;
+}
+
+
+spi_t
+spi_init (const spi_cfg_t *cfg __unused__)
+{
+    return &sim;
+}
+
+
+spi_ret_t
+spi_transfer (spi_t spi, const void *txbuffer, void *rxbuffer,
+              spi_size_t len, bool terminate)
+{
+    const uint8_t *tx = txbuffer;
+    uint8_t *rx = rxbuffer;
+    spi_size_t i;
+
+    spi->cs = spi->cs_mode != SPI_CS_MODE_HIGH;
+
+    for (i = 0; i < len; i++)
+    {
+        uint8_t out;
+
+        out = sdcard_sim_clock (tx ? tx[i] : 0xff);
+        if (rx)
+            rx[i] = out;
+    }
+
+    if (terminate)
+        spi_cs_negate (spi);
+    return len;
+}
+
+
+spi_ret_t
+spi_write (spi_t spi, const void *buffer, spi_size_t len, bool terminate)
+{
+    return spi_transfer (spi, buffer, 0, len, terminate);
+}
+
+
+spi_ret_t
+spi_read (spi_t spi, void *buffer, spi_size_t len, bool terminate)
+{
+    return spi_transfer (spi, 0, buffer, len, terminate);
+}
+
+
+uint32_t
+spi_clock_speed_kHz_set (spi_t spi __unused__, uint32_t clock_speed_kHz)
+{
+    return clock_speed_kHz;
+}
+
+
+void
+spi_mode_set (spi_t spi __unused__, spi_mode_t mode __unused__)
+{
+}
+
+
+void
+spi_cs_mode_set (spi_t spi, spi_cs_mode_t mode)
+{
+    spi->cs_mode = mode;
+    if (mode == SPI_CS_MODE_HIGH)
+        spi_cs_negate (spi);
+}
+
+
+void
+spi_cs_setup_set (spi_t spi __unused__, uint16_t delay __unused__)
+{
+}
+
+
+void
+spi_cs_hold_set (spi_t spi __unused__, uint16_t delay __unused__)
+{
+}
+
+
+void
+spi_cs_negate (spi_t spi)
+{
+    spi->cs = 0;
+    spi->command_len = 0;
+}
+
+
+void
+spi_shutdown (spi_t spi __unused__)
+{
+}
+
+
+void
+sdcard_sim_stats_get (sdcard_sim_stats_t *stats)
+{
+    *stats = sim.stats;
+}
+
+
+bool
+sdcard_sim_init (const sdcard_sim_cfg_t *cfg)
+{
+    sdcard_sim_shutdown ();
+
+    memset (&sim, 0, sizeof (sim));
+    sim.cfg = *cfg;
+    sim.cfg.blocks -= sim.cfg.blocks % 1024;
+    if (!sim.cfg.blocks)
+        return 0;
+
+    sim.fd = open (cfg->filename, O_RDWR | O_CREAT, 0644);
+    if (sim.fd < 0)
+        return 0;
+
+    if (ftruncate (sim.fd, (off_t)sim.cfg.blocks * SIM_BLOCK_SIZE) < 0)
+    {
+        close (sim.fd);
+        sim.fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+
+void
+sdcard_sim_shutdown (void)
+{
+    if (sim.fd > 0)
+        close (sim.fd);
+    sim.fd = -1;
+}
@@ -0,0 +1,59 @@
+/** @file   sdcard_sim.h
+    @brief  Simulated SPI-mode SD card for host testing.
+*/
+
+#ifndef SDCARD_SIM_H
+#define SDCARD_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include "config.h"
+
+
+typedef struct
+{
+    /* Backing store; created if it does not exist.  */
+    const char *filename;
+    /* Capacity in 512 byte blocks; rounded down to a multiple of 1024.  */
+    uint32_t blocks;
+    /* Number of ACMD41 polls before the card leaves the idle state.  */
+    uint8_t init_polls;
+    /* Number of bytes before a read data token (Nac).  */
+    uint16_t read_delay_bytes;
+    /* Number of busy bytes after a block is written.  */
+    uint32_t write_busy_bytes;
+    /* Send an error token instead of every Nth block read.  */
+    uint32_t read_error_period;
+    /* Corrupt the CRC of every Nth block read.  */
+    uint32_t read_crc_error_period;
+    /* Reject every Nth block written with a write error.  */
+    uint32_t write_error_period;
+} sdcard_sim_cfg_t;
+
+
+typedef struct
+{
+    /* Number of bytes clocked over the SPI bus.  */
+    uint32_t bus_bytes;
+    uint32_t commands;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t blocks_erased;
+    uint32_t crc_errors;
+} sdcard_sim_stats_t;
+
+
+bool sdcard_sim_init (const sdcard_sim_cfg_t *cfg);
+
+void sdcard_sim_stats_get (sdcard_sim_stats_t *stats);
+
+void sdcard_sim_shutdown (void);
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
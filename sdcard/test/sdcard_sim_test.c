@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdcard.h"
+#include "sdcard_sim.h"
+
+/* Exercise sdcard.c against the simulated card and report the SPI
+   bus overhead (bytes clocked per block transferred).  */
+
+#define FILENAME "sdcard_sim.img"
+
+#define BLOCKS 4096
+
+/* Maximum number of blocks per transfer.  */
+#define M 32
+
+extern int sdcard_test (sdcard_t dev);
+
+static uint8_t ref[BLOCKS * SDCARD_BLOCK_SIZE];
+static uint8_t buffer[M * SDCARD_BLOCK_SIZE];
+
+
+static sdcard_t
+setup (const sdcard_sim_cfg_t *sim_cfg, bool write_defer)
+{
+    sdcard_cfg_t cfg;
+    sdcard_t dev;
+
+    memset (&cfg, 0, sizeof (cfg));
+    cfg.write_defer = write_defer;
+
+    if (!sdcard_sim_init (sim_cfg))
+        return 0;
+
+    dev = sdcard_init (&cfg);
+    if (!dev)
+        return 0;
+
+    if (sdcard_probe (dev) != SDCARD_ERR_OK)
+        return 0;
+
+    return dev;
+}
+
+
+/* Perform random reads and writes of up to M blocks comparing with
+   a reference copy.  Return the number of mismatches.  */
+static int
+random_test (sdcard_t dev, int iterations, uint16_t max_blocks)
+{
+    int i;
+    int errors = 0;
+
+    for (i = 0; i < iterations; i++)
+    {
+        uint32_t block;
+        uint16_t blocks;
+        sdcard_addr_t addr;
+        sdcard_size_t size;
+        unsigned int j;
+
+        blocks = rand () % max_blocks + 1;
+        block = rand () % (BLOCKS - blocks);
+        addr = block * SDCARD_BLOCK_SIZE;
+        size = blocks * SDCARD_BLOCK_SIZE;
+
+        if (rand () & 1)
+        {
+            for (j = 0; j < size; j++)
+                buffer[j] = rand ();
+
+            if (sdcard_write (dev, addr, buffer, size) != (sdcard_ret_t)size)
+                errors++;
+            else
+                memcpy (ref + addr, buffer, size);
+        }
+        else
+        {
+            if (sdcard_read (dev, addr, buffer, size) != (sdcard_ret_t)size
+                || memcmp (ref + addr, buffer, size))
+                errors++;
+        }
+    }
+    return errors;
+}
+
+
+static void
+overhead_report (const char *name, const sdcard_sim_stats_t *before)
+{
+    sdcard_sim_stats_t stats;
+    uint32_t blocks;
+    uint32_t bytes;
+
+    sdcard_sim_stats_get (&stats);
+    blocks = stats.blocks_read + stats.blocks_written
+        - before->blocks_read - before->blocks_written;
+    bytes = stats.bus_bytes - before->bus_bytes;
+
+    printf ("%s: %u blocks, %.1f bus bytes/block, %u commands\n", name,
+            blocks, blocks ? (double)bytes / blocks : 0.0,
+            stats.commands - before->commands);
+}
+
+
+int
+main (void)
+{
+    sdcard_sim_cfg_t sim_cfg;
+    sdcard_sim_stats_t stats;
+    sdcard_t dev;
+    int failures = 0;
+    int errors;
+
+    memset (&sim_cfg, 0, sizeof (sim_cfg));
+    sim_cfg.filename = FILENAME;
+    sim_cfg.blocks = BLOCKS;
+    sim_cfg.init_polls = 3;
+    sim_cfg.read_delay_bytes = 8;
+    sim_cfg.write_busy_bytes = 64;
+
+    remove (FILENAME);
+    srand (1);
+
+    dev = setup (&sim_cfg, 0);
+    if (!dev)
+    {
+        printf ("Probe failed\n");
+        return 1;
+    }
+
+    if (sdcard_capacity_get (dev) != BLOCKS * SDCARD_BLOCK_SIZE)
+    {
+        printf ("Capacity %u\n", (unsigned int)sdcard_capacity_get (dev));
+        failures++;
+    }
+
+    if ((errors = sdcard_test (dev)))
+    {
+        printf ("sdcard_test failed %d\n", errors);
+        failures++;
+    }
+
+    /* Ensure the reference matches the card.  */
+    memset (ref, 0, sizeof (ref));
+    memset (buffer, 0, SDCARD_BLOCK_SIZE);
+    sdcard_write (dev, (BLOCKS - 1) * SDCARD_BLOCK_SIZE, buffer,
+                  SDCARD_BLOCK_SIZE);
+
+    sdcard_sim_stats_get (&stats);
+    if ((errors = random_test (dev, 2000, 1)))
+    {
+        printf ("Single block test: %d errors\n", errors);
+        failures++;
+    }
+    overhead_report ("Single block", &stats);
+
+    sdcard_sim_stats_get (&stats);
+    if ((errors = random_test (dev, 2000, M)))
+    {
+        printf ("Multiple block test: %d errors\n", errors);
+        failures++;
+    }
+    overhead_report ("Multiple block", &stats);
+
+    /* Deferred writes; the card state persists in the backing file.  */
+    dev = setup (&sim_cfg, 1);
+    sdcard_sim_stats_get (&stats);
+    if (!dev || (errors = random_test (dev, 2000, M))
+        || sdcard_sync (dev) != SDCARD_ERR_OK)
+    {
+        printf ("Deferred write test: %d errors\n", errors);
+        failures++;
+    }
+    overhead_report ("Deferred write", &stats);
+
+    /* Erase a range following a deferred write and check that only
+       that range is cleared.  */
+    if (dev)
+    {
+        memset (buffer, 0x5a, SDCARD_BLOCK_SIZE);
+        sdcard_write (dev, 100 * SDCARD_BLOCK_SIZE, buffer,
+                      SDCARD_BLOCK_SIZE);
+        memcpy (ref + 100 * SDCARD_BLOCK_SIZE, buffer, SDCARD_BLOCK_SIZE);
+        memset (ref + 101 * SDCARD_BLOCK_SIZE, 0, 10 * SDCARD_BLOCK_SIZE);
+        if (sdcard_erase (dev, 101 * SDCARD_BLOCK_SIZE,
+                          10 * SDCARD_BLOCK_SIZE) != SDCARD_ERR_OK
+            || sdcard_erase (dev, 1, SDCARD_BLOCK_SIZE) != SDCARD_ERR_PARAM
+            || sdcard_read (dev, 96 * SDCARD_BLOCK_SIZE, buffer,
+                            16 * SDCARD_BLOCK_SIZE) != 16 * SDCARD_BLOCK_SIZE
+            || memcmp (buffer, ref + 96 * SDCARD_BLOCK_SIZE,
+                       16 * SDCARD_BLOCK_SIZE))
+        {
+            printf ("Erase test failed\n");
+            failures++;
+        }
+    }
+
+    /* Injected write errors must be reported.  */
+    sim_cfg.write_error_period = 7;
+    dev = setup (&sim_cfg, 0);
+    if (!dev || !random_test (dev, 500, M) || !dev->write_errors)
+    {
+        printf ("Write errors not detected\n");
+        failures++;
+    }
+    sim_cfg.write_error_period = 0;
+
+    /* With deferred writes, errors are found by sdcard_sync.  */
+    sim_cfg.write_error_period = 3;
+    dev = setup (&sim_cfg, 1);
+    memset (buffer, 0, sizeof (buffer));
+    if (!dev)
+        failures++;
+    else
+    {
+        sdcard_write (dev, 0, buffer, SDCARD_BLOCK_SIZE);
+        sdcard_write (dev, SDCARD_BLOCK_SIZE, buffer, SDCARD_BLOCK_SIZE);
+        sdcard_write (dev, 2 * SDCARD_BLOCK_SIZE, buffer, SDCARD_BLOCK_SIZE);
+        if (sdcard_sync (dev) == SDCARD_ERR_OK)
+        {
+            printf ("Deferred write error not detected\n");
+            failures++;
+        }
+    }
+    sim_cfg.write_error_period = 0;
+
+    /* Injected read errors must be reported.  */
+    sim_cfg.read_error_period = 5;
+    dev = setup (&sim_cfg, 0);
+    if (!dev || sdcard_read (dev, 0, buffer, sizeof (buffer))
+        == sizeof (buffer))
+    {
+        printf ("Read errors not detected\n");
+        failures++;
+    }
+    sim_cfg.read_error_period = 0;
+
+#if SDCARD_CRC_ENABLE
+    /* Corrupted data must be detected by the CRC check.  */
+    sim_cfg.read_crc_error_period = 5;
+    dev = setup (&sim_cfg, 0);
+    if (!dev || !dev->crc_enabled
+        || sdcard_read (dev, 0, buffer, sizeof (buffer)) == sizeof (buffer))
+    {
+        printf ("CRC errors not detected\n");
+        failures++;
+    }
+    sim_cfg.read_crc_error_period = 0;
+#endif
+
+    sdcard_sim_stats_get (&stats);
+    if (stats.crc_errors)
+    {
+        printf ("%u CRC errors detected by card\n", stats.crc_errors);
+        failures++;
+    }
+
+    sdcard_sim_shutdown ();
+    remove (FILENAME);
+
+    printf ("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
@@ -0,0 +1,80 @@
+/** @file   spi.h
+    @brief  Host SPI interface for the simulated SD card.
+    @note   This provides the subset of the SPI driver API used by
+    sdcard.c; the functions are implemented by sdcard_sim.c.
+*/
+
+#ifndef SPI_H
+#define SPI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include "config.h"
+
+typedef enum
+{
+    SPI_MODE_0 = 0,
+    SPI_MODE_1,
+    SPI_MODE_2,
+    SPI_MODE_3
+} spi_mode_t;
+
+
+typedef enum
+{
+    SPI_CS_MODE_TOGGLE,
+    SPI_CS_MODE_FRAME,
+    SPI_CS_MODE_HIGH
+} spi_cs_mode_t;
+
+
+typedef uint16_t spi_size_t;
+typedef int16_t spi_ret_t;
+
+
+typedef struct
+{
+    uint8_t channel;
+    uint32_t clock_speed_kHz;
+    uint8_t cs;
+    spi_mode_t mode;
+    uint8_t bits;
+} spi_cfg_t;
+
+
+typedef struct spi_dev_struct *spi_t;
+
+
+spi_t spi_init (const spi_cfg_t *cfg);
+
+spi_ret_t spi_transfer (spi_t spi, const void *txbuffer, void *rxbuffer,
+                        spi_size_t len, bool terminate);
+
+spi_ret_t spi_write (spi_t spi, const void *buffer, spi_size_t len,
+                     bool terminate);
+
+spi_ret_t spi_read (spi_t spi, void *buffer, spi_size_t len,
+                    bool terminate);
+
+uint32_t spi_clock_speed_kHz_set (spi_t spi, uint32_t clock_speed_kHz);
+
+void spi_mode_set (spi_t spi, spi_mode_t mode);
+
+void spi_cs_mode_set (spi_t spi, spi_cs_mode_t mode);
+
+void spi_cs_setup_set (spi_t spi, uint16_t delay);
+
+void spi_cs_hold_set (spi_t spi, uint16_t delay);
+
+void spi_cs_negate (spi_t spi);
+
+void spi_shutdown (spi_t spi);
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
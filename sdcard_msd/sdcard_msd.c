@@ -5,6 +5,14 @@
 #include <string.h>
 
 
+/* Set to 1 to return from writes before the card has finished
+   programming.  Write errors are then only detected by the card
+   status check in sdcard_sync.  */
+#ifndef SDCARD_MSD_WRITE_DEFER
+#define SDCARD_MSD_WRITE_DEFER 0
+#endif
+
+
 static msd_addr_t
 sdcard_msd_probe (void *dev)
 {
@@ -31,8 +39,11 @@ sdcard_msd_write (void *dev, msd_addr_t addr, const void *buffer,
 
 
 static msd_status_t
-sdcard_msd_status_get (void *dev __unused__)
+sdcard_msd_status_get (void *dev)
 {
+    if (!sdcard_ready_p (dev))
+        return MSD_STATUS_BUSY;
+
     return MSD_STATUS_READY;
 }
 
@@ -44,6 +55,20 @@ sdcard_msd_shutdown (void *dev)
 }
 
 
+static bool
+sdcard_msd_flush (void *dev)
+{
+    return sdcard_sync (dev) == SDCARD_ERR_OK;
+}
+
+
+static bool
+sdcard_msd_discard (void *dev, msd_addr_t addr, msd_addr_t size)
+{
+    return sdcard_erase (dev, addr, size) == SDCARD_ERR_OK;
+}
+
+
 static const msd_ops_t sdcard_msd_ops =
 {
     .probe = sdcard_msd_probe,
@@ -51,6 +76,8 @@ static const msd_ops_t sdcard_msd_ops =
     .write = sdcard_msd_write,
     .status_get = sdcard_msd_status_get,
     .shutdown = sdcard_msd_shutdown,
+    .flush = sdcard_msd_flush,
+    .discard = sdcard_msd_discard,
 };
 
 
@@ -72,6 +99,7 @@ static const sdcard_cfg_t sdcard_cfg =
             .cs = SDCARD_CS,
             .mode = SPI_MODE_0,
             .bits = 8},
+    .write_defer = SDCARD_MSD_WRITE_DEFER
 };
 
 
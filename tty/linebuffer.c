@@ -111,3 +111,68 @@ linebuffer_getc (linebuffer_t *linebuffer)
         linebuffer->newlines--;
     return ch;
 }
+
+
+/** This is a non-blocking version of fgets.
+    @param linebuffer a pointer to the linebuffer
+    @param buffer pointer to buffer to store line
+    @param size size of buffer in bytes
+    @return buffer if a line (or size - 1 characters of it) has been
+            copied otherwise NULL.
+*/
+char *
+linebuffer_gets (linebuffer_t *linebuffer, char *buffer, int size)
+{
+    int num;
+
+    num = linebuffer_read (linebuffer, buffer, size - 1);
+    if (num <= 0)
+        return 0;
+
+    buffer[num] = 0;
+    return buffer;
+}
+
+
+/** This is a non-blocking version of read for a line.
+    @param linebuffer a pointer to the linebuffer
+    @param buffer pointer to buffer to store line
+    @param size maximum number of characters to copy
+    @return number of characters copied, up to and including the
+            newline (or size if the line is longer), otherwise -1 if
+            the linebuffer does not contain a newline.
+*/
+int
+linebuffer_read (linebuffer_t *linebuffer, char *buffer, int size)
+{
+    ring_size_t num;
+
+    if (linebuffer->newlines == 0 || size < 1)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    num = ring_read_until (&linebuffer->ring, '\n', buffer, size);
+    if (num == 0)
+    {
+        /* Something is wrong.  We think we have some newlines in the
+           ring buffer but there are none!  */
+        linebuffer->newlines = 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (buffer[num - 1] == '\n')
+        linebuffer->newlines--;
+    return num;
+}
+
+
+/** Return number of characters that can be added without the
+    linebuffer overflowing.  */
+int
+linebuffer_write_num (linebuffer_t *linebuffer)
+{
+    return ring_write_num (&linebuffer->ring);
+}
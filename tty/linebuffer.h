@@ -40,6 +40,35 @@ int
 linebuffer_getc (linebuffer_t *linebuffer);
 
 
+/** This is a non-blocking version of fgets.
+    @param linebuffer a pointer to the linebuffer
+    @param buffer pointer to buffer to store line
+    @param size size of buffer in bytes
+    @return buffer if a line (or size - 1 characters of it) has been
+            copied otherwise NULL.
+*/
+char *
+linebuffer_gets (linebuffer_t *linebuffer, char *buffer, int size);
+
+
+/** This is a non-blocking version of read for a line.
+    @param linebuffer a pointer to the linebuffer
+    @param buffer pointer to buffer to store line
+    @param size maximum number of characters to copy
+    @return number of characters copied, up to and including the
+            newline (or size if the line is longer), otherwise -1 if
+            the linebuffer does not contain a newline.
+*/
+int
+linebuffer_read (linebuffer_t *linebuffer, char *buffer, int size);
+
+
+/** Return number of characters that can be added without the
+    linebuffer overflowing.  */
+int
+linebuffer_write_num (linebuffer_t *linebuffer);
+
+
 bool
 linebuffer_full_p (linebuffer_t *linebuffer);
 
@@ -15,9 +15,9 @@
 #include "tty.h"
 #include "sys.h"
 #include "errno.h"
+#include "fmt.h"
 #include <ctype.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 
@@ -34,23 +34,10 @@ struct tty_struct
     bool echo;
     bool onlcr;                 /* Translate NL -> CR, NL */
     bool icrnl;                 /* Translate CR -> NL */
+    bool cr_sent;               /* CR of a translated NL written */
 };
 
 
-static int
-tty_getc1 (tty_t *tty)
-{
-    char ch = 0;
-    int ret;
-
-    ret = tty->read (tty->dev, &ch, 1);
-
-    if (ret == 1)
-        return ch;
-    return ret;
-}
-
-
 static int
 tty_putc1 (tty_t *tty, int c)
 {
@@ -58,7 +45,7 @@ tty_putc1 (tty_t *tty, int c)
     char ch;
 
     ch = c;
-    ret = tty->write (tty->dev, &c, 1);
+    ret = tty->write (tty->dev, &ch, 1);
 
     if (ret < 0)
         return -1;
@@ -70,9 +57,11 @@ tty_putc1 (tty_t *tty, int c)
 int
 tty_putc (tty_t *tty, int ch)
 {
-    /* Convert newline to carriage return/line feed.  */
-    if (tty->onlcr && ch ==  '\n')
+    /* Convert newline to carriage return/line feed unless the
+       carriage return was written by a short tty_write.  */
+    if (tty->onlcr && ch ==  '\n' && !tty->cr_sent)
         tty_putc1 (tty, '\r');
+    tty->cr_sent = 0;
 
     return tty_putc1 (tty, ch);
 }
@@ -82,45 +71,56 @@ tty_putc (tty_t *tty, int ch)
 int
 tty_puts (tty_t *tty, const char *s)
 {
-    int ret;
+    size_t size;
 
-    while (*s)
-    {
-        ret = tty_putc (tty, *s++);
-
-        if (ret < 0)
-            return ret;
-    }
+    size = strlen (s);
+    if (tty_write (tty, s, size) != (ssize_t) size)
+        return -1;
     return 1;
 }
 
 
 /** Read characters (if any) from input stream and store in
-    the linebuffer.  */
+    the linebuffer.  As many characters as are available and will fit
+    are read from the device at once.  */
 bool
 tty_poll (tty_t *tty)
 {
-    int ch;
+    char buffer[TTY_POLL_SIZE];
+    int size;
+    int ret;
+    int i;
 
-    while (! linebuffer_full_p (tty->linebuffer))
+    while (1)
     {
+        size = linebuffer_write_num (tty->linebuffer);
+        if (size <= 0)
+            return 0;
+        if (size > TTY_POLL_SIZE)
+            size = TTY_POLL_SIZE;
+
         if (tty->update && !tty->update ())
             return 0;
 
-        ch = tty_getc1 (tty);
-        if (ch < 0)
+        ret = tty->read (tty->dev, buffer, size);
+        if (ret <= 0)
             return 1;
 
-        if (tty->icrnl && ch == '\r')
-            ch = '\n';
+        for (i = 0; i < ret; i++)
+        {
+            if (tty->icrnl && buffer[i] == '\r')
+                buffer[i] = '\n';
 
-        /* Echo character.  */
+            linebuffer_add (tty->linebuffer, buffer[i]);
+        }
+
+        /* Echo characters.  */
         if (tty->echo)
-            tty_putc (tty, ch);
+            tty_write (tty, buffer, ret);
 
-        linebuffer_add (tty->linebuffer, ch);
+        if (ret < size)
+            return 1;
     }
-    return 0;
 }
 
 
@@ -152,14 +152,18 @@ tty_getc (tty_t *tty)
 char *
 tty_gets (tty_t *tty, char *buffer, int size)
 {
-    ssize_t ret;
-
     buffer[0] = 0;
-    ret = tty_read (tty, buffer, size - 1);
-    if (ret < 0)
-        return 0;
-    buffer[ret] = 0;
-    return buffer;
+    tty_poll (tty);
+    return linebuffer_gets (tty->linebuffer, buffer, size);
+}
+
+
+static int
+tty_printf_sink (void *tty, const char *str, size_t size)
+{
+    if (tty_write (tty, str, size) != (ssize_t) size)
+        return -1;
+    return 0;
 }
 
 
@@ -168,69 +172,126 @@ tty_printf (tty_t *tty, const char *fmt, ...)
 {
     va_list ap;
     int ret;
-    int len;
-    char buffer[TTY_OUTPUT_BUFFER_SIZE];
-
-    /* FIXME for buffer overrun.  Currently, the output will be
-       truncated to a length given by TTY_OUTPUT_BUFFER_SIZE.  */
 
+    /* The output is written as it is formatted so there is no limit
+       on its length.  */
     va_start (ap, fmt);
-    ret = vsnprintf (buffer, sizeof (buffer), fmt, ap);
+    ret = fmt_vprintf (tty_printf_sink, tty, fmt, ap);
     va_end (ap);
 
-    if (tty_puts (tty, buffer) < 0)
-        return -1;
-
     return ret;
 }
 
 
-/** Read size bytes.  */
+/** Read size bytes.  This copies a line (up to size - 1 characters
+    of it) from the linebuffer once it contains a newline.  */
 ssize_t
 tty_read (void *tty, void *data, size_t size)
 {
-    uint16_t count = 0;
-    char *buffer = data;
+    tty_t *dev = tty;
+
+    if (size < 2)
+        return 0;
 
-    for (count = 0; count < size - 1; count++)
+    tty_poll (dev);
+    return linebuffer_read (dev->linebuffer, data, size - 1);
+}
+
+
+/** Write size bytes to the device, at most TTY_WRITE_SIZE at a time,
+    returning the number written or -1 if none could be.  If the
+    device accepts nothing, smaller writes are tried down to a single
+    byte since some drivers only accept a write that fits in their
+    transmit buffer.  */
+static ssize_t
+tty_write1 (tty_t *tty, const char *data, size_t size)
+{
+    size_t count = 0;
+    size_t max = TTY_WRITE_SIZE;
+
+    while (count < size)
     {
-        int ch;
+        size_t chunk;
+        ssize_t ret;
+
+        chunk = size - count;
+        if (chunk > max)
+            chunk = max;
 
-        ch = tty_getc (tty);
-        if (ch < 0)
+        ret = tty->write (tty->dev, data + count, chunk);
+        if (ret > 0)
         {
-            if (count == 0 && errno == EAGAIN)
-                return -1;
-            return count;
+            count += ret;
+            continue;
         }
-        *buffer++ = ch;
-        if (ch == '\n')
-            return count + 1;
+
+        if (chunk == 1)
+            return count ? (ssize_t) count : ret;
+        max = chunk / 2;
     }
     return count;
 }
 
 
-/** Write size bytes.  */
+/** Write size bytes.  Each run of characters between newlines is
+    passed to the device in chunks of up to TTY_WRITE_SIZE.  */
 ssize_t
 tty_write (void *tty, const void *data, size_t size)
 {
-    uint16_t count = 0;
+    tty_t *dev = tty;
     const char *buffer = data;
+    size_t count = 0;
+
+    /* A carriage return written for a newline that was not counted
+       only stands if the caller retries with that newline; callers
+       such as tty_puts give up on a short write.  */
+    if (size && buffer[0] != '\n')
+        dev->cr_sent = 0;
 
-    for (count = 0; count < size; count++)
+    while (count < size)
     {
-        int ret;
+        const char *nl = 0;
+        size_t run;
+        ssize_t ret;
+
+        run = size - count;
+        if (dev->onlcr)
+        {
+            nl = memchr (buffer + count, '\n', run);
+            if (nl)
+                run = nl - (buffer + count);
+        }
 
-        ret = tty_putc (tty, *buffer++);
-        if (ret < 0)
+        if (run)
         {
-            if (count == 0 && errno == EAGAIN)
-                return -1;
-            return count;
+            ret = tty_write1 (dev, buffer + count, run);
+            if (ret > 0)
+                count += ret;
+            if (ret != (ssize_t) run)
+                break;
+        }
+
+        /* Convert newline to carriage return/line feed.  If only the
+           carriage return is written, the newline is not counted so
+           remember not to send the carriage return again on a retry.  */
+        if (nl)
+        {
+            run = dev->cr_sent ? 1 : 2;
+            ret = tty_write1 (dev, "\r\n" + 2 - run, run);
+            if (ret != (ssize_t) run)
+            {
+                if (ret > 0)
+                    dev->cr_sent = 1;
+                break;
+            }
+            dev->cr_sent = 0;
+            count++;
         }
     }
-    return size;
+
+    if (count == 0 && size != 0 && errno == EAGAIN)
+        return -1;
+    return count;
 }
 
 
@@ -286,6 +347,7 @@ tty_init (const tty_cfg_t *cfg, void *dev)
 
     tty_onlcr_set (tty, 1);
     tty_icrnl_set (tty, 1);
+    tty->cr_sent = 0;
 
     linebuffer_size = cfg->linebuffer_size;
     if (! linebuffer_size)
@@ -27,9 +27,17 @@ extern "C" {
 #endif
 
 
-/* The longest line for tty_printf.  */
-#ifndef TTY_OUTPUT_BUFFER_SIZE
-#define TTY_OUTPUT_BUFFER_SIZE 1024
+/* The most characters read from the device at a time.  */
+#ifndef TTY_POLL_SIZE
+#define TTY_POLL_SIZE 32
+#endif
+
+
+/* The most characters written to the device at a time.  Some drivers
+   only accept a write that fits in their transmit buffer; if nothing
+   is accepted, smaller writes are tried.  */
+#ifndef TTY_WRITE_SIZE
+#define TTY_WRITE_SIZE 32
 #endif
 
 
@@ -88,8 +96,10 @@ int
 tty_puts (tty_t *tty, const char *s);
 
 
-/** This is a blocking version of fprintf.
+/** This is a blocking version of fprintf.  See fmt.h for the
+    supported conversions.
     @param tty a pointer to the tty device
+    @return number of characters written otherwise -1 for error.
 */
 int
 tty_printf (tty_t *tty, const char *fmt, ...);
@@ -1,6 +1,6 @@
 TTY_DIR = $(DRIVER_DIR)/tty
 
-DRIVERS += ring
+DRIVERS += ring fmt
 
 VPATH += $(TTY_DIR)
 SRC += tty.c linebuffer.c
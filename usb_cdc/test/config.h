@@ -0,0 +1,22 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __packed__ __attribute__((packed))
+#define __unused__ __attribute__((unused))
+
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof ((a)[0]))
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
@@ -0,0 +1,48 @@
+#ifndef SYS_H
+#define SYS_H
+
+/* Host stand-ins for the system calls used by usb_cdc.c.  The
+   timeout is ignored; a transfer gives up as soon as nothing more can
+   be moved since the simulated host only makes progress when
+   usb_poll is called.  */
+
+#include "config.h"
+#include <errno.h>
+#include <sys/types.h>
+
+typedef ssize_t (*sys_read_t) (void *dev, void *data, size_t size);
+typedef ssize_t (*sys_write_t) (void *dev, const void *data, size_t size);
+
+typedef struct
+{
+    sys_read_t read;
+    sys_write_t write;
+} sys_file_ops_t;
+
+
+static inline ssize_t
+sys_read_timeout (void *dev, void *data, size_t size,
+                  uint32_t timeout_us __unused__, sys_read_t read)
+{
+    return read (dev, data, size);
+}
+
+
+static inline ssize_t
+sys_write_timeout (void *dev, const void *data, size_t size,
+                   uint32_t timeout_us __unused__, sys_write_t write)
+{
+    size_t count = 0;
+    ssize_t ret;
+
+    while (count < size)
+    {
+        ret = write (dev, (const char *)data + count, size - count);
+        if (ret <= 0)
+            return count ? (ssize_t)count : ret;
+        count += ret;
+    }
+    return count;
+}
+
+#endif
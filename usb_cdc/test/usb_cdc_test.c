@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb_cdc.h"
+#include "usb_sim.h"
+
+/* Exercise usb_cdc.c against a simulated host, checking that the
+   data arrives intact and in order as the ring buffers wrap around,
+   that reception stops and restarts as the receive ring buffer fills
+   and is emptied, and that partial packets are held back to be
+   combined when USB_CDC_TX_HOLD_POLLS is set.  */
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+/* Polls before the device is considered hung.  */
+#define TIMEOUT 10000
+
+
+static usb_cdc_t cdc;
+static uint8_t data[4096];
+static uint8_t buffer[4096];
+
+
+static int
+check (bool ok, const char *what, int line)
+{
+    if (!ok)
+        printf ("Line %d: %s failed\n", line, what);
+    return !ok;
+}
+
+#define CHECK(ok) check ((ok), #ok, __LINE__)
+
+
+static void
+data_fill (unsigned int size)
+{
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
+        data[i] = rand ();
+}
+
+
+static bool
+ring_p (const ring_t *ring, const void *ptr)
+{
+    return (const char *)ptr >= ring->top && (const char *)ptr < ring->end;
+}
+
+
+static void
+poll (unsigned int polls)
+{
+    while (polls--)
+        usb_cdc_update ();
+}
+
+
+/* Read size bytes, polling as needed, and compare them with the
+   data sent.  */
+static int
+rx_check (unsigned int size)
+{
+    unsigned int count = 0;
+    unsigned int polls = 0;
+    ssize_t ret;
+
+    while (count < size)
+    {
+        ret = usb_cdc_read (cdc, buffer + count, size - count);
+        if (ret > 0)
+            count += ret;
+        else if (++polls > TIMEOUT)
+            break;
+        usb_cdc_update ();
+    }
+    return count != size || memcmp (data, buffer, size) != 0;
+}
+
+
+/* Poll until the host has received size bytes and compare them with
+   the data written.  */
+static int
+tx_check (unsigned int size)
+{
+    unsigned int count = 0;
+    unsigned int polls = 0;
+
+    while (count < size && ++polls <= TIMEOUT)
+    {
+        usb_cdc_update ();
+        count += usb_sim_receive (buffer + count, size - count);
+    }
+    return count != size || memcmp (data, buffer, size) != 0;
+}
+
+
+/* Poll until a write transfer is started.  */
+static const void *
+tx_wait (void)
+{
+    unsigned int polls;
+
+    for (polls = 0; polls < TIMEOUT && !usb_sim_write_buffer (); polls++)
+        usb_cdc_update ();
+    return usb_sim_write_buffer ();
+}
+
+
+static void
+packets_clear (void)
+{
+    uint16_t packets[USB_SIM_PACKETS_MAX];
+
+    usb_sim_packets_get (packets, USB_SIM_PACKETS_MAX);
+}
+
+
+static bool
+packets_p (const uint16_t *sizes, unsigned int num)
+{
+    uint16_t packets[USB_SIM_PACKETS_MAX];
+
+    return usb_sim_packets_get (packets, USB_SIM_PACKETS_MAX) == num
+        && !memcmp (packets, sizes, num * sizeof (*sizes));
+}
+
+
+/* Data from the host is received into the ring buffer, a packet at a
+   time, and via the bounce buffer when a packet does not fit before
+   the end of the ring buffer.  */
+static int
+rx_test (void)
+{
+    unsigned int i;
+    int errors = 0;
+
+    // Reception starts once configured
+    usb_cdc_update ();
+    errors += CHECK (cdc->reading);
+    errors += CHECK (ring_p (&cdc->rx_ring, usb_sim_read_buffer ()));
+
+    // A short packet
+    data_fill (5);
+    usb_sim_send (data, 5);
+    errors += rx_check (5);
+
+    // Full packets up to near the end of the ring buffer
+    for (i = 0; i < 3; i++)
+    {
+        data_fill (UDP_EP_OUT_SIZE);
+        usb_sim_send (data, UDP_EP_OUT_SIZE);
+        errors += rx_check (UDP_EP_OUT_SIZE);
+    }
+
+    // The next packet does not fit before the end
+    errors += CHECK (cdc->reading && cdc->rx_bounce);
+    errors += CHECK (!ring_p (&cdc->rx_ring, usb_sim_read_buffer ()));
+    data_fill (UDP_EP_OUT_SIZE);
+    usb_sim_send (data, UDP_EP_OUT_SIZE);
+    errors += rx_check (UDP_EP_OUT_SIZE);
+    errors += CHECK (cdc->reading && !cdc->rx_bounce);
+
+    // A short packet via the bounce buffer
+    for (i = 0; i < 3; i++)
+    {
+        data_fill (UDP_EP_OUT_SIZE);
+        usb_sim_send (data, UDP_EP_OUT_SIZE);
+        errors += rx_check (UDP_EP_OUT_SIZE);
+    }
+    errors += CHECK (cdc->rx_bounce);
+    data_fill (7);
+    usb_sim_send (data, 7);
+    errors += rx_check (7);
+
+    // Long runs
+    for (i = 0; i < 20; i++)
+    {
+        unsigned int size = rand () % 1000 + 1;
+
+        data_fill (size);
+        usb_sim_send (data, size);
+        errors += rx_check (size);
+    }
+    return errors;
+}
+
+
+/* Reception stops when there is no room for a whole packet and is
+   restarted by reading.  */
+static int
+rx_full_test (void)
+{
+    ring_size_t num;
+    unsigned int size = 300;
+    int errors = 0;
+
+    data_fill (size);
+    usb_sim_send (data, size);
+    poll (100);
+
+    num = usb_cdc_read_num (cdc);
+    errors += CHECK (num < size);
+    errors += CHECK (num + UDP_EP_OUT_SIZE
+                     > cdc->rx_ring.end - cdc->rx_ring.top - 1);
+    errors += CHECK (!cdc->reading);
+    errors += CHECK (usb_sim_send_num () == size - num);
+
+    // Polling does not restart reception without room
+    poll (100);
+    errors += CHECK (!cdc->reading && usb_cdc_read_num (cdc) == num);
+
+    // Reading makes room
+    errors += CHECK (usb_cdc_read (cdc, buffer, 100) == 100);
+    errors += CHECK (cdc->reading);
+    errors += CHECK (!memcmp (data, buffer, 100));
+    memmove (data, data + 100, size - 100);
+    errors += rx_check (size - 100);
+    errors += CHECK (!usb_sim_send_num ());
+    return errors;
+}
+
+
+/* An aborted transfer is restarted by polling or by reading.  */
+static int
+rx_abort_test (void)
+{
+    int errors = 0;
+
+    errors += CHECK (cdc->reading);
+    usb_sim_read_abort ();
+    errors += CHECK (!cdc->reading);
+    usb_cdc_update ();
+    errors += CHECK (cdc->reading);
+
+    usb_sim_read_abort ();
+    errors += CHECK (!usb_cdc_read_ready_p (cdc));
+    errors += CHECK (cdc->reading);
+
+    data_fill (10);
+    usb_sim_send (data, 10);
+    errors += rx_check (10);
+
+    // Carriage returns are read as newlines
+    usb_sim_send ("a\r", 2);
+    poll (2);
+    errors += CHECK (usb_cdc_read_ready_p (cdc));
+    errors += CHECK (usb_cdc_getc (cdc) == 'a');
+    errors += CHECK (usb_cdc_getc (cdc) == '\n');
+    errors += CHECK (usb_cdc_getc (cdc) == -1);
+    return errors;
+}
+
+
+/* Whole packets are sent from the transmit ring buffer up to its
+   end and the packet spanning the wrap is assembled in the bounce
+   buffer.  */
+static int
+tx_test (void)
+{
+    static const uint16_t wrap_packets[] = {64, 11};
+    const void *ptr;
+    unsigned int i;
+    int errors = 0;
+
+    // Move the ring buffer pointers in from the top
+    data_fill (10);
+    errors += CHECK (usb_cdc_write (cdc, data, 10) == 10);
+    usb_cdc_flush (cdc);
+    errors += tx_check (10);
+    packets_clear ();
+
+    // Leave 70 bytes before the end and 5 after the wrap
+    usb_sim_in_pause (1);
+    data_fill (75);
+    errors += CHECK (usb_cdc_write (cdc, data, 75) == 75);
+    ptr = usb_sim_write_buffer ();
+    errors += CHECK (ptr == cdc->tx_ring.top + 10);
+
+    usb_sim_in_pause (0);
+    usb_cdc_update ();
+    ptr = tx_wait ();
+    errors += CHECK (ptr && !ring_p (&cdc->tx_ring, ptr));
+    errors += tx_check (75);
+    errors += CHECK (packets_p (wrap_packets, ARRAY_SIZE (wrap_packets)));
+
+    // Long runs
+    for (i = 0; i < 20; i++)
+    {
+        unsigned int size = rand () % 1000 + 1;
+        unsigned int count = 0;
+        unsigned int received = 0;
+        unsigned int polls = 0;
+        unsigned int chunk;
+        ssize_t ret;
+
+        data_fill (size);
+        while (received < size && ++polls <= TIMEOUT)
+        {
+            // A write fails unless all of it fits
+            chunk = rand () % 64 + 1;
+            ret = usb_cdc_write (cdc, data + count, MIN (size - count, chunk));
+            if (ret > 0)
+                count += ret;
+            if (count == size)
+                usb_cdc_flush (cdc);
+            usb_cdc_update ();
+            received += usb_sim_receive (buffer + received, size - received);
+        }
+        errors += CHECK (received == size && !memcmp (data, buffer, size));
+    }
+    packets_clear ();
+    return errors;
+}
+
+
+/* Data written into reserved space is sent when committed; with
+   nothing queued the whole ring buffer can be reserved.  */
+static int
+tx_reserve_test (void)
+{
+    unsigned int size = cdc->tx_ring.end - cdc->tx_ring.top;
+    uint8_t *ptr;
+    int errors = 0;
+
+    errors += CHECK (!usb_cdc_write_reserve (cdc, size));
+
+    ptr = usb_cdc_write_reserve (cdc, size - 1);
+    errors += CHECK (ptr == (uint8_t *)cdc->tx_ring.top);
+    if (!ptr)
+        return errors;
+
+    data_fill (size - 1);
+    memcpy (ptr, data, 30);
+    usb_sim_in_pause (1);
+    usb_cdc_write_commit (cdc, 30);
+    usb_cdc_flush (cdc);
+
+    // The space left while the data is being sent
+    errors += CHECK (!usb_cdc_write_reserve (cdc, size - 30));
+    ptr = usb_cdc_write_reserve (cdc, size - 31);
+    errors += CHECK (ptr == (uint8_t *)cdc->tx_ring.top + 30);
+    usb_sim_in_pause (0);
+    errors += tx_check (30);
+
+    // Once sent the ring buffer starts from the top again
+    ptr = usb_cdc_write_reserve (cdc, 20);
+    errors += CHECK (ptr == (uint8_t *)cdc->tx_ring.top);
+    if (!ptr)
+        return errors;
+    memcpy (ptr, data + 30, 20);
+    usb_cdc_write_commit (cdc, 20);
+    usb_cdc_flush (cdc);
+    memmove (data, data + 30, 20);
+    errors += tx_check (20);
+    packets_clear ();
+    return errors;
+}
+
+
+#ifdef USB_CDC_TX_HOLD_POLLS
+/* A partial packet is held back for USB_CDC_TX_HOLD_POLLS polls
+   unless flushed or a whole packet is ready.  */
+static int
+tx_hold_test (void)
+{
+    static const uint16_t combined_packets[] = {20};
+    unsigned int i;
+    int errors = 0;
+
+    data_fill (64);
+
+    // A partial packet is held
+    errors += CHECK (usb_cdc_write (cdc, data, 10) == 10);
+    errors += CHECK (!usb_sim_write_buffer ());
+    for (i = 0; i < USB_CDC_TX_HOLD_POLLS - 1; i++)
+        usb_cdc_update ();
+    errors += CHECK (!usb_sim_write_buffer ());
+    usb_cdc_update ();
+    errors += CHECK (usb_sim_write_buffer ());
+    errors += tx_check (10);
+
+    // Small writes are combined
+    packets_clear ();
+    errors += CHECK (usb_cdc_write (cdc, data, 10) == 10);
+    usb_cdc_update ();
+    errors += CHECK (usb_cdc_write (cdc, data + 10, 10) == 10);
+    errors += tx_check (20);
+    errors += CHECK (packets_p (combined_packets,
+                                ARRAY_SIZE (combined_packets)));
+
+    // A whole packet is sent at once
+    errors += CHECK (usb_cdc_write (cdc, data, 64) == 64);
+    errors += CHECK (usb_sim_write_buffer ());
+    errors += tx_check (64);
+
+    // Flushing sends a partial packet at once
+    errors += CHECK (usb_cdc_write (cdc, data, 10) == 10);
+    errors += CHECK (!usb_sim_write_buffer ());
+    usb_cdc_flush (cdc);
+    errors += CHECK (usb_sim_write_buffer ());
+    errors += tx_check (10);
+    return errors;
+}
+#endif
+
+
+int
+main (void)
+{
+    usb_cdc_cfg_t cfg;
+    usb_sim_stats_t stats;
+    int errors = 0;
+
+    memset (&cfg, 0, sizeof (cfg));
+    srand (1);
+
+    cdc = usb_cdc_init (&cfg);
+    if (!cdc)
+    {
+        printf ("Cannot initialise\n");
+        return 1;
+    }
+
+    errors += rx_test ();
+    errors += rx_full_test ();
+    errors += rx_abort_test ();
+    errors += tx_test ();
+    errors += tx_reserve_test ();
+#ifdef USB_CDC_TX_HOLD_POLLS
+    errors += tx_hold_test ();
+#endif
+
+    usb_sim_stats_get (&stats);
+    printf ("%u polls, %u packets out, %u packets in, %u reads, %u writes\n",
+            stats.polls, stats.packets_out, stats.packets_in, stats.reads,
+            stats.writes);
+    errors += CHECK (!stats.protocol_errors);
+
+    if (errors)
+    {
+        printf ("%d errors\nFAILED\n", errors);
+        return 1;
+    }
+    printf ("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,294 @@
+/** @file   usb_sim.c
+    @brief  Simulated USB host for exercising the CDC driver on a host.
+
+   This replaces usb.c, as does the simulated host in usb_msd/test,
+   and plays the part of a host with a terminal open.  Data queued by
+   usb_sim_send is sent when the device reads the bulk OUT endpoint
+   and the data written to the bulk IN endpoint is collected for
+   usb_sim_receive.
+
+   Each call of usb_poll moves at most one packet in each direction
+   so that the number of polls reflects the bus time.  A read
+   completes with the first packet, which is short if the host has
+   less than a packet queued.  */
+
+#include <string.h>
+#include "usb.h"
+#include "usb_sim.h"
+
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+/* Size of the host's queues.  */
+#define USB_SIM_QUEUE_SIZE 8192
+
+
+typedef struct
+{
+    bool active;
+    uint8_t *buffer;
+    unsigned int length;
+    usb_callback_t callback;
+    void *arg;
+    usb_transfer_t transfer;
+} usb_sim_transfer_t;
+
+
+typedef struct
+{
+    uint8_t data[USB_SIM_QUEUE_SIZE];
+    unsigned int in;
+    unsigned int out;
+} usb_sim_queue_t;
+
+
+static struct
+{
+    usb_sim_transfer_t read;
+    usb_sim_transfer_t write;
+    usb_sim_queue_t send;
+    usb_sim_queue_t receive;
+    bool in_paused;
+    uint16_t packets[USB_SIM_PACKETS_MAX];
+    unsigned int packets_num;
+    usb_sim_stats_t stats;
+    struct usb_dev_struct dev;
+} sim;
+
+
+static usb_status_t
+usb_sim_transfer (usb_sim_transfer_t *pending, void *buffer,
+                  unsigned int length, usb_callback_t callback, void *arg)
+{
+    if (pending->active)
+    {
+        sim.stats.protocol_errors++;
+        return USB_STATUS_BUSY;
+    }
+
+    pending->active = true;
+    pending->buffer = buffer;
+    pending->length = length;
+    pending->callback = callback;
+    pending->arg = arg;
+    pending->transfer.status = USB_STATUS_PENDING;
+    pending->transfer.transferred = 0;
+    pending->transfer.remaining = length;
+    pending->transfer.buffered = 0;
+    return USB_STATUS_SUCCESS;
+}
+
+
+static void
+usb_sim_complete (usb_sim_transfer_t *pending, usb_status_t status)
+{
+    // The callback may start another transfer
+    pending->active = false;
+    pending->transfer.status = status;
+    pending->callback (pending->arg, &pending->transfer);
+}
+
+
+usb_status_t
+usb_write_async (usb_t usb __unused__, const void *buffer,
+                 unsigned int length, usb_callback_t callback, void *arg)
+{
+    sim.stats.writes++;
+    return usb_sim_transfer (&sim.write, (void *)buffer, length,
+                             callback, arg);
+}
+
+
+usb_status_t
+usb_read_async (usb_t usb __unused__, void *buffer, unsigned int length,
+                usb_callback_t callback, void *arg)
+{
+    sim.stats.reads++;
+    return usb_sim_transfer (&sim.read, buffer, length, callback, arg);
+}
+
+
+/* Move a packet from the host to the device.  */
+static void
+usb_sim_out (void)
+{
+    usb_sim_transfer_t *pending = &sim.read;
+    unsigned int bytes;
+
+    if (!pending->active || sim.send.out == sim.send.in)
+        return;
+
+    bytes = MIN (pending->length, UDP_EP_OUT_SIZE);
+    bytes = MIN (bytes, sim.send.in - sim.send.out);
+    memcpy (pending->buffer, sim.send.data + sim.send.out, bytes);
+    sim.send.out += bytes;
+    if (sim.send.out == sim.send.in)
+        sim.send.out = sim.send.in = 0;
+    sim.stats.packets_out++;
+
+    pending->transfer.transferred = bytes;
+    pending->transfer.remaining = pending->length - bytes;
+    usb_sim_complete (pending, USB_STATUS_SUCCESS);
+}
+
+
+/* Move a packet from the device to the host.  */
+static void
+usb_sim_in (void)
+{
+    usb_sim_transfer_t *pending = &sim.write;
+    unsigned int bytes;
+
+    if (!pending->active || sim.in_paused)
+        return;
+
+    bytes = MIN (pending->length - pending->transfer.transferred,
+                 UDP_EP_IN_SIZE);
+    bytes = MIN (bytes, USB_SIM_QUEUE_SIZE - sim.receive.in);
+    memcpy (sim.receive.data + sim.receive.in,
+            pending->buffer + pending->transfer.transferred, bytes);
+    sim.receive.in += bytes;
+    pending->transfer.transferred += bytes;
+    pending->transfer.remaining -= bytes;
+    sim.stats.packets_in++;
+    if (sim.packets_num < USB_SIM_PACKETS_MAX)
+        sim.packets[sim.packets_num++] = bytes;
+
+    if (pending->transfer.remaining && bytes == UDP_EP_IN_SIZE)
+        return;
+    usb_sim_complete (pending, USB_STATUS_SUCCESS);
+}
+
+
+bool
+usb_poll (usb_t usb __unused__)
+{
+    sim.stats.polls++;
+    usb_sim_out ();
+    usb_sim_in ();
+    return true;
+}
+
+
+bool
+usb_configured_p (usb_t usb __unused__)
+{
+    return true;
+}
+
+
+void
+usb_control_write (usb_t usb __unused__, const void *data __unused__,
+                   usb_size_t length __unused__)
+{
+}
+
+
+void
+usb_control_gobble (usb_t usb __unused__)
+{
+}
+
+
+void
+usb_control_write_zlp (usb_t usb __unused__)
+{
+}
+
+
+usb_t
+usb_init (const usb_descriptors_t *descriptors,
+          udp_request_handler_t request_handler)
+{
+    memset (&sim, 0, sizeof (sim));
+    sim.dev.descriptors = descriptors;
+    sim.dev.request_handler = (usb_request_handler_t)request_handler;
+    return &sim.dev;
+}
+
+
+void
+usb_shutdown (void)
+{
+}
+
+
+void
+usb_sim_send (const void *data, unsigned int size)
+{
+    size = MIN (size, USB_SIM_QUEUE_SIZE - sim.send.in);
+    memcpy (sim.send.data + sim.send.in, data, size);
+    sim.send.in += size;
+}
+
+
+unsigned int
+usb_sim_send_num (void)
+{
+    return sim.send.in - sim.send.out;
+}
+
+
+unsigned int
+usb_sim_receive (void *data, unsigned int size)
+{
+    size = MIN (size, sim.receive.in - sim.receive.out);
+    memcpy (data, sim.receive.data + sim.receive.out, size);
+    sim.receive.out += size;
+
+    // Reuse the queue once it has been emptied
+    if (sim.receive.out == sim.receive.in)
+        sim.receive.out = sim.receive.in = 0;
+    return size;
+}
+
+
+void
+usb_sim_in_pause (bool pause)
+{
+    sim.in_paused = pause;
+}
+
+
+unsigned int
+usb_sim_packets_get (uint16_t *sizes, unsigned int max)
+{
+    unsigned int num;
+
+    num = MIN (max, sim.packets_num);
+    memcpy (sizes, sim.packets, num * sizeof (*sizes));
+    sim.packets_num = 0;
+    return num;
+}
+
+
+const void *
+usb_sim_write_buffer (void)
+{
+    return sim.write.active ? sim.write.buffer : NULL;
+}
+
+
+const void *
+usb_sim_read_buffer (void)
+{
+    return sim.read.active ? sim.read.buffer : NULL;
+}
+
+
+void
+usb_sim_read_abort (void)
+{
+    if (!sim.read.active)
+        return;
+
+    sim.read.transfer.transferred = 0;
+    usb_sim_complete (&sim.read, USB_STATUS_RESET);
+}
+
+
+void
+usb_sim_stats_get (usb_sim_stats_t *stats)
+{
+    *stats = sim.stats;
+}
@@ -0,0 +1,68 @@
+/** @file   usb_sim.h
+    @brief  Simulated USB host for exercising the CDC driver on a host.
+*/
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+
+
+/* Most IN packets recorded.  */
+#define USB_SIM_PACKETS_MAX 256
+
+
+typedef struct
+{
+    /* Number of usb_poll calls.  */
+    uint32_t polls;
+    /* Number of transfers started by the device.  */
+    uint32_t reads;
+    uint32_t writes;
+    /* Number of packets moved over the bulk endpoints.  */
+    uint32_t packets_out;
+    uint32_t packets_in;
+    /* Number of transfers started while one was in progress.  */
+    uint32_t protocol_errors;
+} usb_sim_stats_t;
+
+
+/* Queue data for the host to send on the bulk OUT endpoint.  */
+void usb_sim_send (const void *data, unsigned int size);
+
+/* Return the number of queued bytes not yet taken by the device.  */
+unsigned int usb_sim_send_num (void);
+
+/* Take up to size bytes received by the host on the bulk IN
+   endpoint.  */
+unsigned int usb_sim_receive (void *data, unsigned int size);
+
+/* Stop or resume taking IN packets, as a host does when it has no
+   buffer for them.  */
+void usb_sim_in_pause (bool pause);
+
+/* Get the size of the IN packets received since the last call,
+   returning the number of packets.  */
+unsigned int usb_sim_packets_get (uint16_t *sizes, unsigned int max);
+
+/* Return the buffer of the current write transfer or NULL.  */
+const void *usb_sim_write_buffer (void);
+
+/* Return the buffer of the current read transfer or NULL.  */
+const void *usb_sim_read_buffer (void);
+
+/* Abort the current read transfer, as on a bus reset.  */
+void usb_sim_read_abort (void);
+
+void usb_sim_stats_get (usb_sim_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -3,6 +3,7 @@
 #include "usb_dsc.h"
 #include "usb.h"
 #include <stdlib.h>
+#include <string.h>
 
 
 /* CDC communication device class.
@@ -12,10 +13,26 @@
    or /dev/ttyACM0
 
    Writing works by:
-   1. copying data to a ring buffer
+   1. copying data to a ring buffer (or formatting it in place
+      using usb_cdc_write_reserve and usb_cdc_write_commit)
    2. using asynchronous I/O to transmit a block from the ring buffer
-      (without wrap-around) to the USB driver
+      to the USB driver.  The block is a whole number of packets
+      unless it is the last of the data.  When the data wraps around
+      with less than a packet at the end of the ring buffer, a packet
+      is assembled from both ends in a bounce buffer.
    3. the asynchronous callback repeats step 2 until the ring buffer is empty.
+
+   Reading works by:
+   1. using asynchronous I/O to receive a packet from the USB driver
+      directly into a ring buffer (or into a bounce buffer when there
+      is not a packet of contiguous space)
+   2. the asynchronous callback advances the ring buffer and repeats
+      step 1 while there is room for another packet; otherwise
+      reading the ring buffer restarts it.
+
+   With USB_CDC_TX_HOLD_POLLS non-zero, less than a packet of data is
+   held back for that many calls of usb_cdc_update so that small
+   writes can be combined.  usb_cdc_flush sends it immediately.
 */
 
 #ifndef USB_CURRENT_MA
@@ -26,6 +43,15 @@
 #define USB_CDC_TX_RING_SIZE 80
 #endif
 
+#ifndef USB_CDC_RX_RING_SIZE
+#define USB_CDC_RX_RING_SIZE (4 * UDP_EP_OUT_SIZE)
+#endif
+
+/* Number of usb_cdc_update calls to hold back a partial packet.  */
+#ifndef USB_CDC_TX_HOLD_POLLS
+#define USB_CDC_TX_HOLD_POLLS 0
+#endif
+
 
 #ifndef MIN
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -160,6 +186,13 @@ static USB_CDC_LINE_CODING line_coding =
 
 static usb_cdc_dev_t usb_cdc_dev;
 
+/* Packet assembled from both ends of the transmit ring buffer.  */
+static char usb_cdc_tx_packet[UDP_EP_IN_SIZE];
+
+/* Packet received when it does not fit before the end of the receive
+   ring buffer.  */
+static char usb_cdc_rx_packet[UDP_EP_OUT_SIZE];
+
 
 static bool
 usb_cdc_request_handler (usb_t usb, usb_setup_t *setup)
@@ -195,24 +228,92 @@ usb_cdc_request_handler (usb_t usb, usb_setup_t *setup)
 }
 
 
+static void
+usb_cdc_read_next (usb_cdc_dev_t *dev);
+
+
+static void
+usb_cdc_read_callback (void *usb_cdc, usb_transfer_t *transfer)
+{
+    usb_cdc_dev_t *dev = usb_cdc;
+
+    if (dev->rx_bounce)
+        ring_write (&dev->rx_ring, usb_cdc_rx_packet, transfer->transferred);
+    else
+        ring_write_commit (&dev->rx_ring, transfer->transferred);
+    dev->reading = 0;
+
+    if (transfer->status != USB_STATUS_SUCCESS)
+        return;
+
+    usb_cdc_read_next (dev);
+}
+
+
+static void
+usb_cdc_read_next (usb_cdc_dev_t *dev)
+{
+    ring_segment_t segments[2];
+    char *data;
+
+    // The reading flag works like the writing flag.  The ring buffer
+    // in pointer is only moved by the callback and the out pointer
+    // only by usb_cdc_read_nonblock.
+    if (dev->reading)
+        return;
+
+    // Only start a transfer when a whole packet can be stored.
+    if (ring_write_reserve (&dev->rx_ring, UDP_EP_OUT_SIZE, segments)
+        < UDP_EP_OUT_SIZE)
+        return;
+
+    data = segments[0].data;
+    dev->rx_bounce = segments[0].size < UDP_EP_OUT_SIZE;
+    if (dev->rx_bounce)
+        data = usb_cdc_rx_packet;
+
+    dev->reading = 1;
+    if (usb_read_async (dev->usb, data, UDP_EP_OUT_SIZE,
+                        usb_cdc_read_callback, dev) != USB_STATUS_SUCCESS)
+        dev->reading = 0;
+}
+
+
 /* Checks if at least one character can be read without
    blocking.  */
 bool
 usb_cdc_read_ready_p (usb_cdc_t usb_cdc)
 {
-    return usb_read_ready_p (usb_cdc->usb);
+    usb_cdc_read_next (usb_cdc);
+
+    return !ring_empty_p (&usb_cdc->rx_ring);
 }
 
 
-static int16_t
-usb_cdc_read_nonblock (usb_cdc_t usb_cdc, void *data, uint16_t size)
+/** Return the number of bytes immediately available for reading.  */
+ring_size_t
+usb_cdc_read_num (usb_cdc_t usb_cdc)
 {
-    int ret;
+    return ring_read_num (&usb_cdc->rx_ring);
+}
 
-    ret = usb_read_nonblock (usb_cdc->usb, data, size);
 
-    if (ret == 0)
+/** Read as many bytes as there are available in the ring buffer up to
+    the specifed size.  */
+static ssize_t
+usb_cdc_read_nonblock (usb_cdc_t usb_cdc, void *data, size_t size)
+{
+    ssize_t ret;
+    usb_cdc_dev_t *dev = usb_cdc;
+
+    ret = ring_read (&dev->rx_ring, data, size);
+
+    // Restart reception if it stopped for lack of space.
+    usb_cdc_read_next (dev);
+
+    if (ret == 0 && size != 0)
     {
+        /* Would block.  */
         errno = EAGAIN;
         return -1;
     }
@@ -229,7 +330,7 @@ usb_cdc_write_callback (void *usb_cdc, usb_transfer_t *transfer)
 {
     usb_cdc_dev_t *dev = usb_cdc;
 
-    ring_read_advance (&dev->tx_ring, transfer->transferred);
+    ring_read_release (&dev->tx_ring, transfer->transferred);
     dev->writing = 0;
 
     if (transfer->status != USB_STATUS_SUCCESS)
@@ -242,7 +343,9 @@ usb_cdc_write_callback (void *usb_cdc, usb_transfer_t *transfer)
 static void
 usb_cdc_write_next (usb_cdc_dev_t *dev)
 {
+    ring_segment_t segments[2];
     int read_num;
+    char *data;
 
     // The writing flag indicates aysnc I/O is in operation.   It
     // is cleared by the callback running in interrupt context.
@@ -258,18 +361,56 @@ usb_cdc_write_next (usb_cdc_dev_t *dev)
     if (dev->writing)
         return;
 
-    // Determine number of bytes able to be read without wrap around.
-    read_num = ring_read_num_nowrap (&dev->tx_ring);
+    read_num = ring_read_segments (&dev->tx_ring, USB_CDC_TX_RING_SIZE,
+                                   segments);
     if (read_num == 0)
         return;
 
+    // Hold back a partial packet in case more data follows.
+    if (read_num < UDP_EP_IN_SIZE && dev->tx_polls < USB_CDC_TX_HOLD_POLLS)
+        return;
+
+    data = segments[0].data;
+
+    // Check if the data wraps around.
+    if (segments[1].size)
+    {
+        if (segments[0].size >= UDP_EP_IN_SIZE)
+        {
+            // Send whole packets up to the end of the ring buffer.
+            read_num = segments[0].size - segments[0].size % UDP_EP_IN_SIZE;
+        }
+        else
+        {
+            // Fill a packet from the end and the start of the ring
+            // buffer.  The callback releases the data as usual.
+            read_num = MIN (read_num, UDP_EP_IN_SIZE);
+            memcpy (usb_cdc_tx_packet, data, segments[0].size);
+            memcpy (usb_cdc_tx_packet + segments[0].size, segments[1].data,
+                    read_num - segments[0].size);
+            data = usb_cdc_tx_packet;
+        }
+    }
+
+    dev->tx_polls = 0;
     dev->writing = 1;
-    if (usb_write_async (dev->usb, dev->tx_ring.out, read_num,
+    if (usb_write_async (dev->usb, data, read_num,
                          usb_cdc_write_callback, dev) != USB_STATUS_SUCCESS)
         dev->writing = 0;
 }
 
 
+/** Start sending any data held back in the transmit ring buffer.  */
+void
+usb_cdc_flush (usb_cdc_t usb_cdc)
+{
+    usb_cdc_dev_t *dev = usb_cdc;
+
+    dev->tx_polls = USB_CDC_TX_HOLD_POLLS;
+    usb_cdc_write_next (dev);
+}
+
+
 /** Write up to size bytes but return if have to block.  */
 static ssize_t
 usb_cdc_write_nonblock (usb_cdc_t usb_cdc, const void *data, size_t size)
@@ -290,6 +431,44 @@ usb_cdc_write_nonblock (usb_cdc_t usb_cdc, const void *data, size_t size)
 }
 
 
+/** Reserve size contiguous bytes in the transmit ring buffer.  The
+    data is written directly into the returned space and is sent when
+    usb_cdc_write_commit is called.  This does not block; NULL is
+    returned if the space is not available.  */
+void *
+usb_cdc_write_reserve (usb_cdc_t usb_cdc, size_t size)
+{
+    usb_cdc_dev_t *dev = usb_cdc;
+    ring_segment_t segments[2];
+
+    // If nothing is queued or being sent, start from the top of the
+    // ring buffer so that all of it is contiguous.
+    if (!dev->writing && ring_empty_p (&dev->tx_ring))
+        ring_clear (&dev->tx_ring);
+
+    ring_write_reserve (&dev->tx_ring, size, segments);
+    if (segments[0].size < size)
+    {
+        usb_cdc_write_next (dev);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return segments[0].data;
+}
+
+
+/** Send size bytes written into space given by usb_cdc_write_reserve.
+    size must not be greater than the size reserved.  */
+void
+usb_cdc_write_commit (usb_cdc_t usb_cdc, size_t size)
+{
+    usb_cdc_dev_t *dev = usb_cdc;
+
+    ring_write_commit (&dev->tx_ring, size);
+    usb_cdc_write_next (dev);
+}
+
+
 /** Write size bytes.  Block until all the bytes have been transferred
     to the transmit ring buffer or until timeout occurs.  */
 ssize_t
@@ -309,10 +488,6 @@ usb_cdc_read (void *usb_cdc, void *data, size_t size)
 {
     usb_cdc_dev_t *dev = usb_cdc;
 
-    /* Ignore size and read only one char to avoid timeout resetting
-       endpoint.  */
-    size = 1;
-
     return sys_read_timeout (usb_cdc, data, size, dev->read_timeout_us,
                              (void *)usb_cdc_read_nonblock);
 }
@@ -341,7 +516,10 @@ usb_cdc_init (const usb_cdc_cfg_t *cfg)
     dev->read_timeout_us = cfg->read_timeout_us;
     dev->write_timeout_us = cfg->write_timeout_us;
     dev->writing = 0;
+    dev->reading = 0;
+    dev->rx_bounce = 0;
     dev->connected = 0;
+    dev->tx_polls = 0;
 
     buffer = malloc (USB_CDC_TX_RING_SIZE);
     if (!buffer)
@@ -349,6 +527,12 @@ usb_cdc_init (const usb_cdc_cfg_t *cfg)
 
     ring_init (&dev->tx_ring, buffer, USB_CDC_TX_RING_SIZE);
 
+    buffer = malloc (USB_CDC_RX_RING_SIZE);
+    if (!buffer)
+        return 0;
+
+    ring_init (&dev->rx_ring, buffer, USB_CDC_RX_RING_SIZE);
+
     dev->usb = usb_init (&usb_cdc_descriptors,
                          (void *)usb_cdc_request_handler);
 
@@ -404,6 +588,21 @@ usb_cdc_update (void)
     if (!ret && usb_cdc_dev.connected)
         usb_cdc_dev.connected = 0;
 
+    /* Start reception once configured or after an aborted
+       transfer.  */
+    if (ret)
+        usb_cdc_read_next (&usb_cdc_dev);
+
+    /* Send a held back partial packet once it has waited long
+       enough.  */
+    if (USB_CDC_TX_HOLD_POLLS && !usb_cdc_dev.writing
+        && !ring_empty_p (&usb_cdc_dev.tx_ring))
+    {
+        if (usb_cdc_dev.tx_polls < USB_CDC_TX_HOLD_POLLS)
+            usb_cdc_dev.tx_polls++;
+        usb_cdc_write_next (&usb_cdc_dev);
+    }
+
     return ret;
 }
 
@@ -7,6 +7,7 @@ extern "C" {
     
 
 #include "config.h"
+#include "sys.h"
 #include "usb.h"
 #include "ring.h"
     
@@ -15,10 +16,16 @@ typedef struct usb_cdc_struct
 {
     usb_t usb;
     ring_t tx_ring;
+    ring_t rx_ring;
     uint32_t read_timeout_us;
     uint32_t write_timeout_us;
     volatile bool writing;
+    volatile bool reading;
+    /* Set if receiving into the bounce buffer.  */
+    bool rx_bounce;
     bool connected;
+    /* Number of polls a partial packet has been held back.  */
+    uint16_t tx_polls;
 } usb_cdc_dev_t;
 
 typedef usb_cdc_dev_t *usb_cdc_t;
@@ -43,6 +50,22 @@ ssize_t
 usb_cdc_read (void *usb_cdc, void *buffer, size_t length);
 
 
+/** Reserve size contiguous bytes in the transmit buffer for writing
+    in place.  Return NULL if not available.  */
+void *
+usb_cdc_write_reserve (usb_cdc_t usb_cdc, size_t size);
+
+
+/** Send size bytes written into the reserved space.  */
+void
+usb_cdc_write_commit (usb_cdc_t usb_cdc, size_t size);
+
+
+/** Send any data held back waiting for more to fill a packet.  */
+void
+usb_cdc_flush (usb_cdc_t usb_cdc);
+
+
 bool
 usb_cdc_configured_p (usb_cdc_t dev);
 
@@ -63,6 +86,11 @@ bool
 usb_cdc_read_ready_p (usb_cdc_t usb_cdc);
 
 
+/** Return the number of bytes immediately available for reading.  */
+ring_size_t
+usb_cdc_read_num (usb_cdc_t usb_cdc);
+
+
 /** Read character.  */
 int
 usb_cdc_getc (usb_cdc_t usb_cdc);
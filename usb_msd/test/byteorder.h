@@ -0,0 +1,20 @@
+#ifndef BYTEORDER_H
+#define BYTEORDER_H
+
+/* Big-endian accessors for SCSI command and data fields.  */
+
+#define WORDB(b) ((uint16_t)(((b)[0] << 8) | (b)[1]))
+
+#define DWORDB(b) (((uint32_t)(b)[0] << 24) | ((uint32_t)(b)[1] << 16) \
+                   | ((uint32_t)(b)[2] << 8) | (b)[3])
+
+#define STORE_DWORDB(v, b)                      \
+    do                                          \
+    {                                           \
+        (b)[0] = (uint8_t)((v) >> 24);          \
+        (b)[1] = (uint8_t)((v) >> 16);          \
+        (b)[2] = (uint8_t)((v) >> 8);           \
+        (b)[3] = (uint8_t)(v);                  \
+    } while (0)
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define __packed__ __attribute__((packed))
+#define __unused__ __attribute__((unused))
+
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof ((a)[0]))
+
+#define USB_MSD_VENDOR_STRING {'T', 'e', 's', 't', ' ', ' ', ' ', ' '}
+#define USB_MSD_PRODUCT_STRING {'U', 'S', 'B', ' ', 'M', 'S', 'D', ' ', \
+                                'r', 'e', 'p', 'l', 'a', 'y', ' ', ' '}
+#define USB_MSD_REVISION_STRING {'0', '.', '1', '0'}
+
+/* Flush cached writes sooner so that the test does not take long.  */
+#define USB_MSD_SBC_FLUSH_POLLS 1000
+
+
+#ifdef __cplusplus
+}
+#endif    
+#endif
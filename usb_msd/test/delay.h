@@ -0,0 +1,6 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+#define delay_ms(ms)
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef UDP_H
+#define UDP_H
+
+/* Minimal USB device port definitions for the simulated host in
+   usb_sim.c.  */
+
+#include "config.h"
+#include <sys/types.h>
+
+#define UDP_EP_OUT 1
+#define UDP_EP_IN 2
+#define UDP_EP_DIR_OUT 0x00
+#define UDP_EP_DIR_IN 0x80
+#define UDP_EP_OUT_SIZE 64
+#define UDP_EP_IN_SIZE 64
+#define UDP_EP_CONTROL_SIZE 8
+
+typedef enum
+{
+    UDP_STATUS_SUCCESS,
+    UDP_STATUS_BUSY,
+    UDP_STATUS_ABORTED,
+    UDP_STATUS_RESET,
+    UDP_STATUS_PENDING
+} udp_status_t;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t request;
+    uint16_t value;
+    uint16_t index;
+    uint16_t length;
+} udp_setup_t;
+
+typedef struct
+{
+    udp_status_t status;
+    unsigned int transferred;
+    unsigned int remaining;
+    unsigned int buffered;
+} udp_transfer_t;
+
+typedef void (*udp_callback_t) (void *arg, udp_transfer_t *transfer);
+
+typedef bool (*udp_request_handler_t) (void *arg, udp_setup_t *setup);
+
+typedef struct udp_dev_struct *udp_t;
+
+typedef uint8_t udp_ep_t;
+
+typedef unsigned int udp_size_t;
+
+#endif
@@ -0,0 +1,842 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "usb_msd.h"
+#include "usb_sbc_defs.h"
+#include "usb_sim.h"
+#include "file_msd.h"
+#include "byteorder.h"
+
+/* Drive usb_msd_update with streams of CBWs from a simulated host
+   and report the throughput, the number of state machine iterations
+   per block, and the command latencies.
+
+   Without a filename a set of synthetic workloads is run and the
+   data read back is checked against a reference copy.  Otherwise
+   the file is replayed; it holds raw 31 byte CBWs, as captured from
+   the bulk OUT endpoint.  The data for replayed writes is
+   arbitrary.  */
+
+#define FILENAME "usb_msd_replay.img"
+
+#define BLOCK_SIZE 512
+
+#define BLOCKS 8192
+
+/* Maximum number of blocks per command.  */
+#define M 128
+
+/* Iterations before a command is considered hung.  */
+#define TIMEOUT 10000000
+
+typedef struct
+{
+    uint32_t commands;
+    uint32_t blocks;
+    uint32_t failures;
+    uint64_t iterations;
+    double seconds;
+    double latency_max;
+} stats_t;
+
+
+static uint8_t ref[BLOCKS * BLOCK_SIZE];
+static uint8_t out[M * BLOCK_SIZE];
+static uint8_t in[M * BLOCK_SIZE];
+
+/* Latency statistics for each operation code.  */
+static stats_t op_stats[256];
+
+static uint32_t tag;
+
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void
+stats_add (stats_t *total, const stats_t *stats)
+{
+    total->commands += stats->commands;
+    total->blocks += stats->blocks;
+    total->failures += stats->failures;
+    total->iterations += stats->iterations;
+    total->seconds += stats->seconds;
+    if (stats->latency_max > total->latency_max)
+        total->latency_max = stats->latency_max;
+}
+
+
+/* Send a CBW and poll the device until it returns the CSW.  Return
+   the CSW status or -1 if the device hangs.  */
+static int
+command (usb_msd_cbw_t *cbw, stats_t *stats, uint32_t *bytes)
+{
+    usb_msd_csw_t csw;
+    stats_t one;
+    double start;
+    uint32_t received;
+
+    memset (&one, 0, sizeof (one));
+    cbw->dCBWSignature = MSD_CBW_SIGNATURE;
+    cbw->dCBWTag = ++tag;
+
+    start = now ();
+    usb_sim_command (cbw, out, in, sizeof (in));
+    while (!usb_sim_done_p ())
+    {
+        usb_msd_update ();
+        if (++one.iterations > TIMEOUT)
+        {
+            printf ("Command 0x%02x hung\n", cbw->pCommand[0]);
+            return -1;
+        }
+    }
+    one.seconds = now () - start;
+    one.latency_max = one.seconds;
+    one.commands = 1;
+
+    received = usb_sim_csw_get (&csw);
+    if (bytes)
+        *bytes = received;
+
+    if (csw.dCSWTag != cbw->dCBWTag)
+    {
+        printf ("Command 0x%02x tag mismatch\n", cbw->pCommand[0]);
+        csw.bCSWStatus = MSD_CSW_PHASE_ERROR;
+    }
+
+    if (csw.bCSWStatus != MSD_CSW_COMMAND_PASSED)
+        one.failures = 1;
+    else if (cbw->pCommand[0] == SBC_READ_10
+             || cbw->pCommand[0] == SBC_WRITE_10)
+        one.blocks = cbw->dCBWDataTransferLength / BLOCK_SIZE;
+
+    stats_add (stats, &one);
+    stats_add (&op_stats[cbw->pCommand[0]], &one);
+    return csw.bCSWStatus;
+}
+
+
+static int
+command6 (uint8_t op, uint8_t length, stats_t *stats)
+{
+    usb_msd_cbw_t cbw;
+
+    memset (&cbw, 0, sizeof (cbw));
+    cbw.bCBWCBLength = 6;
+    cbw.dCBWDataTransferLength = length;
+    cbw.bmCBWFlags = length ? MSD_CBW_DEVICE_TO_HOST : 0;
+    cbw.pCommand[0] = op;
+    // Ask for all mode pages as hosts do
+    if (op == SBC_MODE_SENSE_6)
+        cbw.pCommand[2] = SBC_PAGE_RETURN_ALL;
+    cbw.pCommand[4] = length;
+    return command (&cbw, stats, 0);
+}
+
+
+static int
+command10 (uint8_t op, uint32_t block, uint16_t blocks, stats_t *stats)
+{
+    usb_msd_cbw_t cbw;
+
+    memset (&cbw, 0, sizeof (cbw));
+    cbw.bCBWCBLength = 10;
+    cbw.pCommand[0] = op;
+    STORE_DWORDB (block, cbw.pCommand + 2);
+    cbw.pCommand[7] = blocks >> 8;
+    cbw.pCommand[8] = blocks;
+
+    switch (op)
+    {
+    case SBC_READ_CAPACITY_10:
+        cbw.dCBWDataTransferLength = sizeof (S_sbc_read_capacity_10_data);
+        cbw.bmCBWFlags = MSD_CBW_DEVICE_TO_HOST;
+        break;
+
+    case SBC_READ_10:
+        cbw.dCBWDataTransferLength = blocks * BLOCK_SIZE;
+        cbw.bmCBWFlags = MSD_CBW_DEVICE_TO_HOST;
+        break;
+
+    case SBC_WRITE_10:
+        cbw.dCBWDataTransferLength = blocks * BLOCK_SIZE;
+        break;
+
+    default:
+        break;
+    }
+
+    return command (&cbw, stats, 0);
+}
+
+
+/* Send a command with a CDB of any length; in is set if the data is
+   sent to the host.  */
+static int
+command_cdb (const uint8_t *cdb, uint8_t cdb_length, uint32_t length,
+             bool in, stats_t *stats, uint32_t *bytes)
+{
+    usb_msd_cbw_t cbw;
+
+    memset (&cbw, 0, sizeof (cbw));
+    cbw.bCBWCBLength = cdb_length;
+    cbw.dCBWDataTransferLength = length;
+    cbw.bmCBWFlags = length && in ? MSD_CBW_DEVICE_TO_HOST : 0;
+    memcpy (cbw.pCommand, cdb, cdb_length);
+    return command (&cbw, stats, bytes);
+}
+
+
+/* Return the sense key for the previous command and get the
+   additional sense code.  This overwrites the data in in.  */
+static int
+sense_get (uint8_t *asc, stats_t *stats)
+{
+    *asc = 0xff;
+    if (command6 (SBC_REQUEST_SENSE, 18, stats))
+        return -1;
+    *asc = in[12];
+    return in[2] & 0x0f;
+}
+
+
+static int
+check (bool ok, const char *what, int line)
+{
+    if (!ok)
+        printf ("Line %d: %s failed\n", line, what);
+    return !ok;
+}
+
+#define CHECK(ok) check ((ok), #ok, __LINE__)
+
+
+static int
+block_write (uint32_t block, uint16_t blocks, stats_t *stats)
+{
+    unsigned int i;
+
+    for (i = 0; i < blocks * BLOCK_SIZE; i++)
+        out[i] = rand ();
+
+    if (command10 (SBC_WRITE_10, block, blocks, stats))
+        return 1;
+
+    memcpy (ref + block * BLOCK_SIZE, out, blocks * BLOCK_SIZE);
+    return 0;
+}
+
+
+static int
+block_read (uint32_t block, uint16_t blocks, stats_t *stats)
+{
+    if (command10 (SBC_READ_10, block, blocks, stats))
+        return 1;
+
+    return memcmp (ref + block * BLOCK_SIZE, in, blocks * BLOCK_SIZE) != 0;
+}
+
+
+/* Check that the blocks on the media, rather than those seen by the
+   host, match the reference copy.  */
+static bool
+media_p (msd_t *msd, uint32_t block, uint16_t blocks)
+{
+    static uint8_t buffer[M * BLOCK_SIZE];
+
+    return msd_read (msd, block * BLOCK_SIZE, buffer, blocks * BLOCK_SIZE)
+        == blocks * BLOCK_SIZE
+        && !memcmp (ref + block * BLOCK_SIZE, buffer, blocks * BLOCK_SIZE);
+}
+
+
+static void
+report (const char *name, const stats_t *stats)
+{
+    printf ("%-14s %6u cmds %7u blocks %9.0f blocks/s %7.1f iter/block"
+            " %8.1f us/cmd %8.1f us max\n", name,
+            stats->commands, stats->blocks,
+            stats->seconds > 0 ? stats->blocks / stats->seconds : 0.0,
+            stats->blocks ? (double)stats->iterations / stats->blocks : 0.0,
+            stats->commands ? stats->seconds * 1e6 / stats->commands : 0.0,
+            stats->latency_max * 1e6);
+}
+
+
+static void
+op_report (void)
+{
+    unsigned int op;
+    stats_t *stats;
+
+    printf ("\n  op   cmds  failed   iter/cmd     us/cmd     us max\n");
+    for (op = 0; op < ARRAY_SIZE (op_stats); op++)
+    {
+        stats = &op_stats[op];
+        if (!stats->commands)
+            continue;
+        printf ("0x%02x %6u %7u %10.1f %10.1f %10.1f\n", op,
+                stats->commands, stats->failures,
+                (double)stats->iterations / stats->commands,
+                stats->seconds * 1e6 / stats->commands,
+                stats->latency_max * 1e6);
+    }
+}
+
+
+/* Commands sent by a host after connection.  */
+static int
+enumerate_test (int iterations)
+{
+    stats_t stats;
+    int errors = 0;
+    int i;
+
+    memset (&stats, 0, sizeof (stats));
+    for (i = 0; i < iterations; i++)
+    {
+        errors += command6 (SBC_INQUIRY, 36, &stats) != 0;
+        errors += command6 (SBC_TEST_UNIT_READY, 0, &stats) != 0;
+        errors += command10 (SBC_READ_CAPACITY_10, 0, 0, &stats) != 0;
+        errors += command6 (SBC_MODE_SENSE_6, 4, &stats) != 0;
+        errors += command6 (SBC_REQUEST_SENSE, 18, &stats) != 0;
+    }
+    report ("Enumerate", &stats);
+    return errors;
+}
+
+
+/* Sequential reads or writes of the whole medium.  */
+static int
+sequential_test (uint8_t op, uint16_t blocks)
+{
+    stats_t stats;
+    char name[32];
+    uint32_t block;
+    int errors = 0;
+
+    memset (&stats, 0, sizeof (stats));
+    for (block = 0; block + blocks <= BLOCKS; block += blocks)
+    {
+        if (op == SBC_READ_10)
+            errors += block_read (block, blocks, &stats);
+        else
+            errors += block_write (block, blocks, &stats);
+    }
+
+    snprintf (name, sizeof (name), "%s %u",
+              op == SBC_READ_10 ? "Read" : "Write", blocks);
+    report (name, &stats);
+    return errors;
+}
+
+
+/* Random reads and writes of up to M blocks.  */
+static int
+random_test (const char *name, int iterations)
+{
+    stats_t stats;
+    int errors = 0;
+    int i;
+
+    memset (&stats, 0, sizeof (stats));
+    for (i = 0; i < iterations; i++)
+    {
+        uint16_t blocks;
+        uint32_t block;
+
+        blocks = rand () % M + 1;
+        block = rand () % (BLOCKS - blocks);
+
+        if (rand () % 10 < 7)
+            errors += block_read (block, blocks, &stats);
+        else
+            errors += block_write (block, blocks, &stats);
+    }
+    report (name, &stats);
+    return errors;
+}
+
+
+/* INQUIRY with EVPD set for each VPD page.  */
+static int
+vpd_test (stats_t *stats)
+{
+    uint8_t cdb[6] = {SBC_INQUIRY, 1, 0, 0, 255, 0};
+    uint32_t bytes;
+    uint8_t asc;
+    int errors = 0;
+
+    cdb[2] = SBC_VPD_SUPPORTED_PAGES;
+    errors += CHECK (command_cdb (cdb, 6, 255, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 7);
+    errors += CHECK (in[1] == SBC_VPD_SUPPORTED_PAGES && in[3] == 3);
+    errors += CHECK (in[4] == SBC_VPD_SUPPORTED_PAGES
+                     && in[5] == SBC_VPD_BLOCK_LIMITS
+                     && in[6] == SBC_VPD_LOGICAL_BLOCK_PROVISIONING);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_NO_SENSE);
+
+    // The file device supports discard so the UNMAP limits are set
+    cdb[2] = SBC_VPD_BLOCK_LIMITS;
+    errors += CHECK (command_cdb (cdb, 6, 255, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 64);
+    errors += CHECK (in[1] == SBC_VPD_BLOCK_LIMITS && in[3] == 0x3c);
+    errors += CHECK (DWORDB (in + 20) == 8192);
+    errors += CHECK (DWORDB (in + 24) > 0);
+    errors += CHECK (DWORDB (in + 28) == 1);
+
+    cdb[2] = SBC_VPD_LOGICAL_BLOCK_PROVISIONING;
+    errors += CHECK (command_cdb (cdb, 6, 255, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 8);
+    errors += CHECK (in[1] == SBC_VPD_LOGICAL_BLOCK_PROVISIONING
+                     && in[3] == 4);
+    // LBPU set
+    errors += CHECK (in[5] & 0x80);
+    errors += CHECK ((in[6] & 7) == SBC_PROVISIONING_TYPE_RESOURCE);
+
+    // The device identification page is not supported
+    cdb[2] = 0x83;
+    errors += CHECK (command_cdb (cdb, 6, 255, 1, stats, 0)
+                     == MSD_CSW_COMMAND_FAILED);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_ILLEGAL_REQUEST);
+    return errors;
+}
+
+
+static int
+read_capacity16_test (stats_t *stats)
+{
+    uint8_t cdb[16] = {SBC_SERVICE_ACTION_IN_16, SBC_SA_READ_CAPACITY_16};
+    uint32_t bytes;
+    uint8_t asc;
+    int errors = 0;
+
+    cdb[13] = 32;
+    errors += CHECK (command_cdb (cdb, 16, 32, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 32);
+    errors += CHECK (DWORDB (in) == 0 && DWORDB (in + 4) == BLOCKS - 1);
+    errors += CHECK (DWORDB (in + 8) == BLOCK_SIZE);
+    // LBPME set since UNMAP is supported
+    errors += CHECK (in[14] & 0x80);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_NO_SENSE);
+
+    // A short allocation length truncates the data
+    cdb[13] = 8;
+    errors += CHECK (command_cdb (cdb, 16, 8, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 8);
+
+    // Other service actions are not supported
+    cdb[1] = 0x11;
+    errors += CHECK (command_cdb (cdb, 16, 8, 1, stats, 0)
+                     == MSD_CSW_COMMAND_FAILED);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_ILLEGAL_REQUEST);
+    return errors;
+}
+
+
+/* MODE SENSE of the caching page and SYNCHRONIZE CACHE with and
+   without write-back caching.  */
+static int
+cache_test (msd_t *msd, stats_t *stats)
+{
+    uint8_t mode_sense[6] = {SBC_MODE_SENSE_6, 0, SBC_PAGE_CACHING, 0, 255, 0};
+    uint8_t sync[10] = {SBC_SYNCHRONIZE_CACHE_10};
+    uint32_t bytes;
+    uint8_t asc;
+    int errors = 0;
+
+    errors += CHECK (command_cdb (mode_sense, 6, 255, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 24);
+    errors += CHECK (in[0] == 23);
+    errors += CHECK ((in[4] & 0x3f) == SBC_PAGE_CACHING && in[5] == 0x12);
+    // WCE clear by default
+    errors += CHECK (!(in[6] & 0x04));
+
+    errors += CHECK (command_cdb (sync, 10, 0, 0, stats, 0) == 0);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_NO_SENSE);
+
+    msd_write_back_set (msd, 1);
+    errors += CHECK (command_cdb (mode_sense, 6, 255, 1, stats, 0) == 0);
+    errors += CHECK (in[6] & 0x04);
+
+    // A written block is held in the cache until synchronised
+    errors += block_write (200, 1, stats);
+    errors += CHECK (msd_dirty_p (msd));
+    errors += CHECK (command_cdb (sync, 10, 0, 0, stats, 0) == 0);
+    errors += CHECK (!msd_dirty_p (msd));
+    errors += block_read (200, 1, stats);
+    msd_write_back_set (msd, 0);
+
+    // Other pages return no data, as before the caching page was
+    // supported, since Windows asks for them
+    mode_sense[2] = SBC_PAGE_INFORMATIONAL_EXCEPTIONS_CONTROL;
+    errors += CHECK (command_cdb (mode_sense, 6, 255, 1, stats, &bytes) == 0);
+    errors += CHECK (bytes == 0);
+    return errors;
+}
+
+
+/* Fill in an UNMAP parameter list with a single descriptor.  */
+static uint32_t
+unmap_list (uint64_t block, uint32_t blocks)
+{
+    memset (out, 0, 24);
+    out[1] = 22;
+    out[3] = 16;
+    STORE_DWORDB (block >> 32, out + 8);
+    STORE_DWORDB (block, out + 12);
+    STORE_DWORDB (blocks, out + 16);
+    return 24;
+}
+
+
+static int
+unmap_test (stats_t *stats)
+{
+    uint8_t cdb[10] = {SBC_UNMAP};
+    uint32_t length;
+    uint8_t asc;
+    int errors = 0;
+
+    errors += block_write (300, 16, stats);
+    // Read the blocks so that they are cached
+    errors += block_read (300, 16, stats);
+    errors += block_read (304, 1, stats);
+
+    length = unmap_list (302, 8);
+    cdb[8] = length;
+    errors += CHECK (command_cdb (cdb, 10, length, 0, stats, 0) == 0);
+    errors += CHECK (sense_get (&asc, stats) == SBC_SENSE_KEY_NO_SENSE);
+
+    // The file device punches a hole that reads as zeros
+    memset (ref + 302 * BLOCK_SIZE, 0, 8 * BLOCK_SIZE);
+    errors += block_read (304, 1, stats);
+    errors += block_read (300, 16, stats);
+
+    // An empty parameter list does nothing
+    cdb[8] = 0;
+    errors += CHECK (command_cdb (cdb, 10, 0, 0, stats, 0) == 0);
+
+    // Blocks beyond the medium
+    length = unmap_list (BLOCKS - 1, 2);
+    cdb[8] = length;
+    errors += CHECK (command_cdb (cdb, 10, length, 0, stats, 0)
+                     == MSD_CSW_COMMAND_FAILED);
+    errors += CHECK (sense_get (&asc, stats) != SBC_SENSE_KEY_NO_SENSE);
+
+    length = unmap_list (1ULL << 32, 1);
+    errors += CHECK (command_cdb (cdb, 10, length, 0, stats, 0)
+                     == MSD_CSW_COMMAND_FAILED);
+    errors += CHECK (sense_get (&asc, stats) != SBC_SENSE_KEY_NO_SENSE);
+
+    errors += block_read (300, 16, stats);
+    return errors;
+}
+
+
+/* With write-back, WRITE (10) completes before the data reaches the
+   media.  The buffered data is read back by the host and written to
+   the media when needed.  */
+static int
+write_back_test (msd_t *msd, stats_t *stats)
+{
+    uint8_t mode_sense[6] = {SBC_MODE_SENSE_6, 0, SBC_PAGE_CACHING, 0, 255, 0};
+    uint8_t sync[10] = {SBC_SYNCHRONIZE_CACHE_10};
+    uint8_t stop[6] = {SBC_START_STOP_UNIT, 0, 0, 0, 0x02, 0};
+    uint8_t write[10] = {SBC_WRITE_10, 0x08, 0, 0, 2, 78, 0, 0, 1, 0};
+    uint8_t unmap[10] = {SBC_UNMAP};
+    uint32_t length;
+    unsigned int i;
+    int errors = 0;
+
+    usb_msd_write_back_set (0, 1);
+    errors += CHECK (command_cdb (mode_sense, 6, 255, 1, stats, 0) == 0);
+    errors += CHECK (in[6] & 0x04);
+
+    // Consecutive writes are gathered and read back from the buffer
+    errors += block_write (500, 2, stats);
+    errors += block_write (502, 1, stats);
+    errors += CHECK (!media_p (msd, 500, 3));
+    errors += block_read (499, 5, stats);
+    errors += block_write (501, 1, stats);
+    errors += block_read (500, 3, stats);
+    errors += CHECK (command_cdb (sync, 10, 0, 0, stats, 0) == 0);
+    errors += CHECK (media_p (msd, 500, 3));
+
+    // A write elsewhere writes out the buffer first
+    errors += block_write (510, 1, stats);
+    errors += block_write (520, 1, stats);
+    errors += CHECK (media_p (msd, 510, 1));
+    errors += CHECK (!media_p (msd, 520, 1));
+
+    // A long write is written to the media as the buffer fills
+    errors += block_write (530, 16, stats);
+    errors += CHECK (media_p (msd, 520, 1) && media_p (msd, 530, 8));
+
+    // Force unit access to block 590
+    for (i = 0; i < BLOCK_SIZE; i++)
+        out[i] = rand ();
+    errors += CHECK (command_cdb (write, 10, BLOCK_SIZE, 0, stats, 0) == 0);
+    memcpy (ref + 590 * BLOCK_SIZE, out, BLOCK_SIZE);
+    errors += CHECK (media_p (msd, 590, 1) && media_p (msd, 530, 16));
+
+    // The buffer is written when the host is idle
+    errors += block_write (550, 1, stats);
+    for (i = 0; i < USB_MSD_SBC_FLUSH_POLLS / 2; i++)
+        usb_msd_update ();
+    errors += CHECK (!media_p (msd, 550, 1));
+    for (i = 0; i < USB_MSD_SBC_FLUSH_POLLS; i++)
+        usb_msd_update ();
+    errors += CHECK (media_p (msd, 550, 1));
+
+    // Eject
+    errors += block_write (560, 1, stats);
+    errors += CHECK (command_cdb (stop, 6, 0, 0, stats, 0) == 0);
+    errors += CHECK (media_p (msd, 560, 1));
+
+    // Discarding buffered blocks
+    errors += block_write (570, 2, stats);
+    length = unmap_list (570, 2);
+    unmap[8] = length;
+    errors += CHECK (command_cdb (unmap, 10, length, 0, stats, 0) == 0);
+    memset (ref + 570 * BLOCK_SIZE, 0, 2 * BLOCK_SIZE);
+    errors += block_read (570, 2, stats);
+    errors += CHECK (media_p (msd, 570, 2));
+
+    // Disabling write-back writes out the buffer
+    errors += block_write (580, 1, stats);
+    usb_msd_write_back_set (0, 0);
+    errors += CHECK (media_p (msd, 580, 1));
+    errors += CHECK (command_cdb (mode_sense, 6, 255, 1, stats, 0) == 0);
+    errors += CHECK (!(in[6] & 0x04));
+    return errors;
+}
+
+
+/* Writes and discards that do not go through the LUN must not leave
+   stale data in the read-ahead buffer.  */
+static int
+read_ahead_test (msd_t *msd, stats_t *stats)
+{
+    unsigned int i;
+    int errors = 0;
+
+    // Read sequentially so that the following blocks are read ahead
+    errors += block_read (400, 1, stats);
+    errors += block_read (401, 1, stats);
+    errors += block_read (402, 1, stats);
+    for (i = 0; i < 8; i++)
+        usb_msd_update ();
+
+    for (i = 0; i < BLOCK_SIZE; i++)
+        ref[403 * BLOCK_SIZE + i] = rand ();
+    errors += CHECK (msd_write (msd, 403 * BLOCK_SIZE, ref + 403 * BLOCK_SIZE,
+                                BLOCK_SIZE) == BLOCK_SIZE);
+    errors += block_read (403, 1, stats);
+
+    errors += CHECK (msd_discard (msd, 404 * BLOCK_SIZE, BLOCK_SIZE));
+    memset (ref + 404 * BLOCK_SIZE, 0, BLOCK_SIZE);
+    errors += block_read (404, 1, stats);
+    errors += block_read (405, 1, stats);
+    return errors;
+}
+
+
+/* Commands other than reads and writes that check the response
+   data and the sense data.  */
+static int
+scsi_test (msd_t *msd)
+{
+    stats_t stats;
+    int errors = 0;
+
+    memset (&stats, 0, sizeof (stats));
+    errors += vpd_test (&stats);
+    errors += read_capacity16_test (&stats);
+    errors += cache_test (msd, &stats);
+    errors += unmap_test (&stats);
+    errors += write_back_test (msd, &stats);
+    errors += read_ahead_test (msd, &stats);
+    report ("SCSI", &stats);
+    return errors;
+}
+
+
+static int
+replay (const char *filename)
+{
+    usb_msd_cbw_t cbw;
+    stats_t stats;
+    FILE *file;
+    int errors = 0;
+
+    file = fopen (filename, "rb");
+    if (!file)
+    {
+        perror (filename);
+        return 1;
+    }
+
+    memset (&stats, 0, sizeof (stats));
+    memset (&cbw, 0, sizeof (cbw));
+    while (fread (&cbw, MSD_CBW_SIZE, 1, file) == 1)
+    {
+        if (cbw.dCBWSignature != MSD_CBW_SIGNATURE)
+        {
+            printf ("Bad CBW at offset %ld\n", ftell (file) - MSD_CBW_SIZE);
+            errors++;
+            break;
+        }
+        if (cbw.dCBWDataTransferLength > sizeof (in))
+        {
+            printf ("Skipping %u byte transfer\n",
+                    (unsigned int)cbw.dCBWDataTransferLength);
+            continue;
+        }
+        if (command (&cbw, &stats, 0) < 0)
+        {
+            errors++;
+            break;
+        }
+    }
+    fclose (file);
+
+    report (filename, &stats);
+    return errors;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    file_msd_cfg_t cfg;
+    usb_sim_stats_t usb_stats;
+    stats_t stats;
+    msd_t *msd;
+    int failures = 0;
+    int errors;
+    int opt;
+    static const uint16_t sizes[] = {1, 8, 64, M};
+    unsigned int i;
+
+    memset (&cfg, 0, sizeof (cfg));
+    cfg.filename = FILENAME;
+    cfg.media_bytes = sizeof (ref);
+
+    while ((opt = getopt (argc, argv, "d:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            // Emulated media latency
+            cfg.read_delay_us = cfg.write_delay_us = atoi (optarg);
+            break;
+
+        case 'm':
+            cfg.mmap = 1;
+            break;
+
+        default:
+            fprintf (stderr, "Usage: %s [-d delay_us] [-m] [cbw-file]\n",
+                     argv[0]);
+            return 2;
+        }
+    }
+
+    remove (FILENAME);
+    srand (1);
+
+    msd = file_msd_init (&cfg);
+    if (!msd)
+    {
+        printf ("Cannot create %s\n", FILENAME);
+        return 1;
+    }
+    usb_msd_init (&msd, 1);
+
+    if (optind < argc)
+    {
+        failures = replay (argv[optind]);
+    }
+    else
+    {
+        if ((errors = enumerate_test (100)))
+        {
+            printf ("Enumerate test: %d errors\n", errors);
+            failures++;
+        }
+
+        for (i = 0; i < ARRAY_SIZE (sizes); i++)
+        {
+            if ((errors = sequential_test (SBC_WRITE_10, sizes[i])))
+            {
+                printf ("Sequential write test: %d errors\n", errors);
+                failures++;
+            }
+        }
+
+        for (i = 0; i < ARRAY_SIZE (sizes); i++)
+        {
+            if ((errors = sequential_test (SBC_READ_10, sizes[i])))
+            {
+                printf ("Sequential read test: %d errors\n", errors);
+                failures++;
+            }
+        }
+
+        if ((errors = random_test ("Random", 2000)))
+        {
+            printf ("Random test: %d errors\n", errors);
+            failures++;
+        }
+
+        usb_msd_write_back_set (0, 1);
+        errors = random_test ("Random cached", 2000);
+        usb_msd_write_back_set (0, 0);
+        if (errors)
+        {
+            printf ("Random cached test: %d errors\n", errors);
+            failures++;
+        }
+
+        // A read past the end of the medium must fail
+        memset (&stats, 0, sizeof (stats));
+        if (!command10 (SBC_READ_10, BLOCKS - 1, 2, &stats))
+        {
+            printf ("Out of range read not detected\n");
+            failures++;
+        }
+
+        if ((errors = scsi_test (msd)))
+        {
+            printf ("SCSI test: %d errors\n", errors);
+            failures++;
+        }
+    }
+
+    op_report ();
+
+    usb_sim_stats_get (&usb_stats);
+    if (usb_stats.protocol_errors)
+    {
+        printf ("%u BOT protocol errors\n", usb_stats.protocol_errors);
+        failures++;
+    }
+
+    usb_msd_shutdown ();
+    msd_shutdown (msd);
+    remove (FILENAME);
+
+    printf ("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
@@ -0,0 +1,332 @@
+/** @file   usb_sim.c
+    @brief  Simulated USB host for exercising the MSD stack on a host.
+
+   This replaces usb.c and plays the part of the host side of the
+   bulk-only transport: a queued CBW is sent when the device reads the
+   bulk OUT endpoint, data is exchanged in the direction given by the
+   CBW, and the next write after the data phase is taken as the CSW.
+
+   Each call of usb_poll moves one packet so that the number of polls
+   reflects the bus time.  A halted endpoint is cleared immediately,
+   as a host would with CLEAR_FEATURE.  */
+
+#include <string.h>
+#include "usb.h"
+#include "usb_sim.h"
+
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+
+typedef enum
+{
+    USB_SIM_IDLE,
+    USB_SIM_COMMAND,
+    USB_SIM_DATA_IN,
+    USB_SIM_DATA_OUT,
+    USB_SIM_STATUS
+} usb_sim_phase_t;
+
+
+typedef struct
+{
+    bool active;
+    bool read;
+    bool started;
+    uint8_t *buffer;
+    unsigned int length;
+    uint32_t packets;
+    usb_callback_t callback;
+    void *arg;
+    usb_transfer_t transfer;
+} usb_sim_transfer_t;
+
+
+static struct
+{
+    usb_sim_phase_t phase;
+    usb_msd_cbw_t cbw;
+    const uint8_t *out;
+    uint8_t *in;
+    uint32_t in_max;
+    /* Number of data phase bytes transferred.  */
+    uint32_t bytes;
+    usb_msd_csw_t csw;
+    bool done;
+    usb_sim_transfer_t pending;
+    usb_sim_stats_t stats;
+    struct usb_dev_struct dev;
+} sim;
+
+
+static uint32_t
+usb_sim_packets (unsigned int bytes)
+{
+    return bytes ? (bytes + UDP_EP_IN_SIZE - 1) / UDP_EP_IN_SIZE : 1;
+}
+
+
+/* The host has data for a pending read once a CBW is queued or
+   during an OUT data phase.  */
+static bool
+usb_sim_read_start (usb_sim_transfer_t *pending)
+{
+    unsigned int bytes;
+
+    switch (sim.phase)
+    {
+    case USB_SIM_COMMAND:
+        bytes = MIN (pending->length, MSD_CBW_SIZE);
+        memcpy (pending->buffer, &sim.cbw, bytes);
+
+        sim.bytes = 0;
+        if (!sim.cbw.dCBWDataTransferLength)
+            sim.phase = USB_SIM_STATUS;
+        else if (sim.cbw.bmCBWFlags & MSD_CBW_DEVICE_TO_HOST)
+            sim.phase = USB_SIM_DATA_IN;
+        else
+            sim.phase = USB_SIM_DATA_OUT;
+        break;
+
+    case USB_SIM_DATA_OUT:
+        bytes = MIN (pending->length,
+                     sim.cbw.dCBWDataTransferLength - sim.bytes);
+        if (!bytes)
+            return false;
+        memcpy (pending->buffer, sim.out + sim.bytes, bytes);
+        sim.bytes += bytes;
+        if (sim.bytes == sim.cbw.dCBWDataTransferLength)
+            sim.phase = USB_SIM_STATUS;
+        break;
+
+    default:
+        return false;
+    }
+
+    pending->transfer.transferred = bytes;
+    pending->packets = usb_sim_packets (bytes);
+    pending->started = true;
+    return true;
+}
+
+
+static bool
+usb_sim_csw_p (const void *buffer, unsigned int length)
+{
+    return length == MSD_CSW_SIZE
+        && ((const usb_msd_csw_t *)buffer)->dCSWSignature
+        == MSD_CSW_SIGNATURE;
+}
+
+
+static usb_status_t
+usb_sim_transfer (bool read, void *buffer, unsigned int length,
+                  usb_callback_t callback, void *arg)
+{
+    usb_sim_transfer_t *pending = &sim.pending;
+
+    if (pending->active)
+    {
+        sim.stats.protocol_errors++;
+        return USB_STATUS_BUSY;
+    }
+
+    pending->active = true;
+    pending->read = read;
+    pending->started = !read;
+    pending->buffer = buffer;
+    pending->length = length;
+    pending->callback = callback;
+    pending->arg = arg;
+    pending->transfer.status = USB_STATUS_PENDING;
+    pending->transfer.transferred = length;
+    pending->transfer.remaining = 0;
+    pending->transfer.buffered = 0;
+    pending->packets = usb_sim_packets (length);
+    return USB_STATUS_SUCCESS;
+}
+
+
+usb_status_t
+usb_write_async (usb_t usb __unused__, const void *buffer,
+                 unsigned int length, usb_callback_t callback, void *arg)
+{
+    unsigned int bytes;
+
+    // A failed command may send the CSW without finishing the data
+    // phase; the host then sees a short transfer
+    if ((sim.phase == USB_SIM_DATA_IN || sim.phase == USB_SIM_DATA_OUT)
+        && usb_sim_csw_p (buffer, length))
+        sim.phase = USB_SIM_STATUS;
+
+    switch (sim.phase)
+    {
+    case USB_SIM_DATA_IN:
+        bytes = MIN (length, sim.cbw.dCBWDataTransferLength - sim.bytes);
+        if (bytes != length)
+            sim.stats.protocol_errors++;
+        if (sim.bytes < sim.in_max)
+            memcpy (sim.in + sim.bytes, buffer,
+                    MIN (bytes, sim.in_max - sim.bytes));
+        sim.bytes += bytes;
+        if (sim.bytes == sim.cbw.dCBWDataTransferLength)
+            sim.phase = USB_SIM_STATUS;
+        break;
+
+    case USB_SIM_STATUS:
+        if (!usb_sim_csw_p (buffer, length))
+        {
+            sim.stats.protocol_errors++;
+            return USB_STATUS_ABORTED;
+        }
+        memcpy (&sim.csw, buffer, MSD_CSW_SIZE);
+        sim.phase = USB_SIM_IDLE;
+        sim.done = true;
+        break;
+
+    default:
+        sim.stats.protocol_errors++;
+        return USB_STATUS_ABORTED;
+    }
+
+    return usb_sim_transfer (false, (void *)buffer, length, callback, arg);
+}
+
+
+usb_status_t
+usb_read_async (usb_t usb __unused__, void *buffer, unsigned int length,
+                usb_callback_t callback, void *arg)
+{
+    return usb_sim_transfer (true, buffer, length, callback, arg);
+}
+
+
+bool
+usb_poll (usb_t usb __unused__)
+{
+    usb_sim_transfer_t *pending = &sim.pending;
+
+    sim.stats.polls++;
+
+    if (!pending->active)
+        return true;
+
+    // A read waits until the host has something to send
+    if (!pending->started && !usb_sim_read_start (pending))
+        return true;
+
+    sim.stats.packets++;
+    if (--pending->packets)
+        return true;
+
+    pending->active = false;
+    pending->transfer.status = USB_STATUS_SUCCESS;
+    pending->callback (pending->arg, &pending->transfer);
+    return true;
+}
+
+
+bool
+usb_halt (usb_t usb __unused__, udp_ep_t endpoint __unused__, bool halt)
+{
+    if (!halt)
+        return true;
+
+    // A stall ends the data phase
+    sim.stats.halts++;
+    if (sim.phase == USB_SIM_DATA_IN || sim.phase == USB_SIM_DATA_OUT)
+        sim.phase = USB_SIM_STATUS;
+    return true;
+}
+
+
+bool
+usb_halt_p (usb_t usb __unused__, udp_ep_t endpoint __unused__)
+{
+    return false;
+}
+
+
+bool
+usb_configured_p (usb_t usb __unused__)
+{
+    return true;
+}
+
+
+bool
+usb_awake_p (usb_t usb __unused__)
+{
+    return true;
+}
+
+
+void
+usb_control_write (usb_t usb __unused__, const void *data __unused__,
+                   usb_size_t length __unused__)
+{
+}
+
+
+void
+usb_control_write_zlp (usb_t usb __unused__)
+{
+}
+
+
+void
+usb_control_stall (usb_t usb __unused__)
+{
+}
+
+
+usb_t
+usb_init (const usb_descriptors_t *descriptors,
+          udp_request_handler_t request_handler)
+{
+    memset (&sim, 0, sizeof (sim));
+    sim.dev.descriptors = descriptors;
+    sim.dev.request_handler = (usb_request_handler_t)request_handler;
+    return &sim.dev;
+}
+
+
+void
+usb_shutdown (void)
+{
+}
+
+
+void
+usb_sim_command (const usb_msd_cbw_t *cbw, const void *out,
+                 void *in, uint32_t in_max)
+{
+    sim.cbw = *cbw;
+    sim.out = out;
+    sim.in = in;
+    sim.in_max = in_max;
+    sim.done = false;
+    sim.phase = USB_SIM_COMMAND;
+}
+
+
+bool
+usb_sim_done_p (void)
+{
+    return sim.done;
+}
+
+
+uint32_t
+usb_sim_csw_get (usb_msd_csw_t *csw)
+{
+    *csw = sim.csw;
+    return sim.bytes;
+}
+
+
+void
+usb_sim_stats_get (usb_sim_stats_t *stats)
+{
+    *stats = sim.stats;
+}
@@ -0,0 +1,48 @@
+/** @file   usb_sim.h
+    @brief  Simulated USB host for exercising the MSD stack on a host.
+*/
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "config.h"
+#include "usb_msd_defs.h"
+
+
+typedef struct
+{
+    /* Number of usb_poll calls.  */
+    uint32_t polls;
+    /* Number of packets moved over the bulk endpoints.  */
+    uint32_t packets;
+    /* Number of endpoint halts (stalls) by the device.  */
+    uint32_t halts;
+    /* Number of transfers that did not match the BOT protocol.  */
+    uint32_t protocol_errors;
+} usb_sim_stats_t;
+
+
+/* Queue a CBW for the device.  OUT data is taken from out and IN
+   data is stored in in (up to in_max bytes).  */
+void usb_sim_command (const usb_msd_cbw_t *cbw, const void *out,
+                      void *in, uint32_t in_max);
+
+/* Return true when the device has sent the CSW for the command.  */
+bool usb_sim_done_p (void);
+
+/* Get the CSW and the number of bytes of data received from the
+   device.  */
+uint32_t usb_sim_csw_get (usb_msd_csw_t *csw);
+
+void usb_sim_stats_get (usb_sim_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -291,6 +291,7 @@ usb_msd_update (void)
     {
         if (usb_msd->state != USB_MSD_STATE_UNINIT)
         {
+            sbc_flush ();
             ret = USB_MSD_DISCONNECTED;
             usb_msd->state = USB_MSD_STATE_UNINIT;
         }
@@ -314,6 +315,8 @@ usb_msd_update (void)
     case USB_MSD_STATE_COMMAND_READ:
         if (usb_bot_command_read (&usb_msd->command))
             usb_msd->state = USB_MSD_STATE_PREPROCESS;
+        else
+            sbc_idle ();
         break;
 
     case USB_MSD_STATE_PREPROCESS:
@@ -357,6 +360,7 @@ usb_msd_init (msd_t **luns, uint8_t num_luns)
 void 
 usb_msd_shutdown (void)
 {
+    sbc_flush ();
     usb_shutdown ();
     usb_msd->state = USB_MSD_STATE_UNINIT;
 }
@@ -367,3 +371,10 @@ usb_msd_write_protect_set (uint8_t lun_id, bool enable)
 {
     sbc_lun_write_protect_set (lun_id, enable);
 }
+
+
+void 
+usb_msd_write_back_set (uint8_t lun_id, bool enable)
+{
+    sbc_lun_write_back_set (lun_id, enable);
+}
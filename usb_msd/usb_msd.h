@@ -24,6 +24,8 @@ void usb_msd_shutdown (void);
 
 void usb_msd_write_protect_set (uint8_t lun_id, bool enable);
 
+void usb_msd_write_back_set (uint8_t lun_id, bool enable);
+
 
 #ifdef __cplusplus
 }
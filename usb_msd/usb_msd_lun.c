@@ -23,11 +23,80 @@
 #error  USB_MSD_REVISION_STRING undefined in config.h
 #endif
 
+/* Number of blocks to read ahead when the host reads sequentially.
+   The blocks following a read are fetched while waiting for the next
+   command so that a following READ (10) does not wait for the media.
+   Set to 0 to disable.  */
+#ifndef USB_MSD_LUN_READ_AHEAD_BLOCKS
+#define USB_MSD_LUN_READ_AHEAD_BLOCKS 4
+#endif
+
+/* Maximum number of blocks read ahead each time lun_prefetch is
+   called.  This bounds the delay before the next command is seen.  */
+#ifndef USB_MSD_LUN_PREFETCH_BLOCKS
+#define USB_MSD_LUN_PREFETCH_BLOCKS 1
+#endif
+
+/* Number of blocks written by the host that are held in RAM for a LUN
+   with write-back enabled.  The host is sent the status as soon as
+   the data is received; consecutive writes are gathered and written
+   to the media together when the buffer is full, when the host writes
+   elsewhere, or on lun_flush.  Set to 0 to disable.  */
+#ifndef USB_MSD_LUN_WRITE_BACK_BLOCKS
+#define USB_MSD_LUN_WRITE_BACK_BLOCKS 4
+#endif
+
 #ifndef USB_MSD_DATA_STRING
 #define USB_MSD_DATA_STRING {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '}
 #endif
 
 
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+
+#if USB_MSD_LUN_READ_AHEAD_BLOCKS
+/* The read-ahead buffer is shared by all the LUNs.  */
+typedef struct
+{
+    //!< LUN of the last read
+    usb_msd_lun_t *pStream;
+    //!< Block following the last read
+    usb_msd_lun_addr_t next;
+    //!< True if the last read followed on from the one before
+    bool sequential;
+    //!< LUN whose blocks are buffered, NULL if none
+    usb_msd_lun_t *pLun;
+    //!< First buffered block
+    usb_msd_lun_addr_t block;
+    //!< Number of buffered blocks
+    msd_size_t blocks;
+    //!< Change count of the msd when the buffer was started
+    uint32_t changes;
+    uint8_t data[USB_MSD_LUN_READ_AHEAD_BLOCKS * MSD_BLOCK_SIZE_MAX];
+} lun_read_ahead_t;
+
+static lun_read_ahead_t lun_read_ahead;
+#endif
+
+
+#if USB_MSD_LUN_WRITE_BACK_BLOCKS
+/* The write-back buffer is shared by all the LUNs.  */
+typedef struct
+{
+    //!< LUN whose blocks are buffered, NULL if none
+    usb_msd_lun_t *pLun;
+    //!< First buffered block
+    usb_msd_lun_addr_t block;
+    //!< Number of buffered blocks
+    msd_size_t blocks;
+    uint8_t data[USB_MSD_LUN_WRITE_BACK_BLOCKS * MSD_BLOCK_SIZE_MAX];
+} lun_write_back_t;
+
+static lun_write_back_t lun_write_back;
+#endif
+
+
 static usb_msd_lun_t Luns[USB_MSD_LUN_NUM];     //!< LUNs used by the BOT driver
 static uint8_t lun_num = 0;
 
@@ -73,6 +142,8 @@ usb_msd_lun_t *lun_init (msd_t *msd)
     // with byte addresses so this number is independent of msd->block_bytes.
     pLun->block_bytes = 512;
     pLun->write_protect = false;
+    pLun->write_back = false;
+    pLun->write_back_error = false;
 
     block_max = (msd->media_bytes / pLun->block_bytes) - 1;
 
@@ -115,6 +186,323 @@ usb_msd_lun_t *lun_init (msd_t *msd)
 }
 
 
+#if USB_MSD_LUN_READ_AHEAD_BLOCKS
+/**
+ * Checks that the read-ahead buffer holds current data for a LUN.
+ * Any write or discard to the device, whether through the LUN or
+ * not, makes the buffered data stale.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \return True if the buffer is valid
+ */
+static bool
+lun_read_ahead_valid_p (usb_msd_lun_t *pLun)
+{
+    if (lun_read_ahead.pLun != pLun)
+        return false;
+
+    if (lun_read_ahead.changes != pLun->msd->changes)
+    {
+        lun_read_ahead.pLun = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Moves the start of the read-ahead buffer to the specified block
+ * address, keeping any blocks already buffered from there on.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \param  block   First block address to buffer
+ */
+static void
+lun_read_ahead_start (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block)
+{
+    msd_size_t offset;
+
+    if (lun_read_ahead_valid_p (pLun) && block >= lun_read_ahead.block
+        && block <= lun_read_ahead.block + lun_read_ahead.blocks)
+    {
+        offset = block - lun_read_ahead.block;
+        if (!offset)
+            return;
+
+        lun_read_ahead.blocks -= offset;
+        memmove (lun_read_ahead.data,
+                 lun_read_ahead.data + offset * pLun->block_bytes,
+                 lun_read_ahead.blocks * pLun->block_bytes);
+    }
+    else
+    {
+        lun_read_ahead.pLun = pLun;
+        lun_read_ahead.changes = pLun->msd->changes;
+        lun_read_ahead.blocks = 0;
+    }
+    lun_read_ahead.block = block;
+}
+
+
+/**
+ * Reads blocks into the read-ahead buffer following those already
+ * buffered.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \param  blocks  Maximum number of blocks to read
+ * \return True if successful, false at the end of the media or on error
+ */
+static bool
+lun_read_ahead_extend (usb_msd_lun_t *pLun, msd_size_t blocks)
+{
+    usb_msd_lun_addr_t block;
+    usb_msd_lun_addr_t block_end;
+    msd_size_t bytes;
+
+    block = lun_read_ahead.block + lun_read_ahead.blocks;
+
+    // Do not read past the end of the media
+    block_end = pLun->media_bytes / pLun->block_bytes;
+    if (block >= block_end)
+        return false;
+    blocks = MIN (blocks, USB_MSD_LUN_READ_AHEAD_BLOCKS - lun_read_ahead.blocks);
+    blocks = MIN (blocks, block_end - block);
+    bytes = blocks * pLun->block_bytes;
+
+    TRACE_DEBUG (USB_MSD_LUN, "LUN:Read ahead (%u)[%u]\n",
+                 (unsigned int)block, (unsigned int)blocks);
+
+    if (msd_read (pLun->msd, (msd_addr_t)block * pLun->block_bytes,
+                  lun_read_ahead.data
+                  + lun_read_ahead.blocks * pLun->block_bytes,
+                  bytes) != bytes)
+    {
+        lun_read_ahead.pLun = NULL;
+        return false;
+    }
+
+    lun_read_ahead.blocks += blocks;
+    return true;
+}
+
+
+/**
+ * Copies the blocks at the specified address from the read-ahead buffer.
+ * 
+ * \return Number of blocks copied
+ */
+static msd_size_t
+lun_read_ahead_copy (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                     void *buffer, msd_size_t blocks)
+{
+    msd_size_t offset;
+
+    if (!lun_read_ahead_valid_p (pLun) || block < lun_read_ahead.block
+        || block >= lun_read_ahead.block + lun_read_ahead.blocks)
+        return 0;
+
+    offset = block - lun_read_ahead.block;
+    blocks = MIN (blocks, lun_read_ahead.blocks - offset);
+    memcpy (buffer, lun_read_ahead.data + offset * pLun->block_bytes,
+            blocks * pLun->block_bytes);
+    return blocks;
+}
+
+
+/**
+ * Reads as many of the requested blocks as possible via the
+ * read-ahead buffer and notes where the host is reading.
+ * 
+ * \return Number of blocks read
+ */
+static msd_size_t
+lun_read_ahead_read (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                     uint8_t *buffer, msd_size_t blocks)
+{
+    msd_size_t total;
+    msd_size_t copied;
+    bool sequential;
+
+    sequential = lun_read_ahead.pStream == pLun
+        && lun_read_ahead.next == block;
+    lun_read_ahead.pStream = pLun;
+    lun_read_ahead.next = block + blocks;
+    lun_read_ahead.sequential = sequential;
+
+    for (total = 0; total < blocks; total += copied)
+    {
+        copied = lun_read_ahead_copy (pLun, block + total,
+                                      buffer + total * pLun->block_bytes,
+                                      blocks - total);
+        if (copied)
+            continue;
+
+        // Small sequential reads are served via the buffer so that
+        // the media is read in larger chunks
+        if (!sequential || blocks - total >= USB_MSD_LUN_READ_AHEAD_BLOCKS)
+            break;
+        lun_read_ahead_start (pLun, block + total);
+        if (!lun_read_ahead_extend (pLun, USB_MSD_LUN_READ_AHEAD_BLOCKS))
+            break;
+    }
+    return total;
+}
+#else
+#define lun_read_ahead_read(pLun, block, buffer, blocks) 0
+#endif
+
+
+#if USB_MSD_LUN_WRITE_BACK_BLOCKS
+/**
+ * Checks if any of the specified blocks are in the write-back buffer.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \param  block   First block address
+ * \param  blocks  Number of blocks
+ * \return True if any are buffered
+ */
+static bool
+lun_write_back_overlap_p (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                          uint32_t blocks)
+{
+    return lun_write_back.pLun == pLun
+        && block < lun_write_back.block + lun_write_back.blocks
+        && block + blocks > lun_write_back.block;
+}
+
+
+/**
+ * Writes the blocks in the write-back buffer to the media.  The
+ * buffer is emptied even if this fails since the data cannot be
+ * written; the error is reported by the next lun_flush of the LUN.
+ * 
+ * \return True if successful or the buffer is empty
+ */
+static bool
+lun_write_back_flush (void)
+{
+    usb_msd_lun_t *pLun;
+    msd_size_t bytes;
+
+    pLun = lun_write_back.pLun;
+    if (!pLun)
+        return true;
+    lun_write_back.pLun = NULL;
+
+    bytes = lun_write_back.blocks * pLun->block_bytes;
+
+    TRACE_DEBUG (USB_MSD_LUN, "LUN:Write back (%u)[%u]\n",
+                 (unsigned int)lun_write_back.block,
+                 (unsigned int)lun_write_back.blocks);
+
+    if (msd_write (pLun->msd, (msd_addr_t)lun_write_back.block
+                   * pLun->block_bytes, lun_write_back.data, bytes) == bytes)
+        return true;
+
+    TRACE_ERROR (USB_MSD_LUN, "LUN:Write back error\n");
+    pLun->write_back_error = true;
+    return false;
+}
+
+
+/**
+ * Adds blocks to the write-back buffer.  They must overlap or follow
+ * on from the blocks already buffered.
+ * 
+ * \return True if the blocks were buffered
+ */
+static bool
+lun_write_back_add (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                    const void *buffer, msd_size_t blocks)
+{
+    msd_size_t offset;
+
+    if (!lun_write_back.pLun)
+    {
+        lun_write_back.pLun = pLun;
+        lun_write_back.block = block;
+        lun_write_back.blocks = 0;
+    }
+
+    if (lun_write_back.pLun != pLun || block < lun_write_back.block
+        || block > lun_write_back.block + lun_write_back.blocks)
+        return false;
+
+    offset = block - lun_write_back.block;
+    if (offset + blocks > USB_MSD_LUN_WRITE_BACK_BLOCKS)
+    {
+        if (!lun_write_back.blocks)
+            lun_write_back.pLun = NULL;
+        return false;
+    }
+
+    memcpy (lun_write_back.data + offset * pLun->block_bytes, buffer,
+            blocks * pLun->block_bytes);
+    lun_write_back.blocks = MAX (lun_write_back.blocks, offset + blocks);
+    return true;
+}
+
+
+/**
+ * Copies any of the specified blocks that are in the write-back
+ * buffer over data read from the media.
+ */
+static void
+lun_write_back_copy (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                     uint8_t *buffer, msd_size_t blocks)
+{
+    usb_msd_lun_addr_t first;
+    usb_msd_lun_addr_t last;
+
+    if (!lun_write_back_overlap_p (pLun, block, blocks))
+        return;
+
+    first = MAX (block, lun_write_back.block);
+    last = MIN (block + blocks, lun_write_back.block + lun_write_back.blocks);
+    memcpy (buffer + (first - block) * pLun->block_bytes,
+            lun_write_back.data
+            + (first - lun_write_back.block) * pLun->block_bytes,
+            (last - first) * pLun->block_bytes);
+}
+#else
+#define lun_write_back_overlap_p(pLun, block, blocks) 0
+#define lun_write_back_add(pLun, block, buffer, blocks) 0
+#define lun_write_back_copy(pLun, block, buffer, blocks)
+
+static inline bool
+lun_write_back_flush (void)
+{
+    return true;
+}
+#endif
+
+
+/**
+ * Reads ahead of a sequential stream of reads.  This is called while
+ * waiting for the next command so at most USB_MSD_LUN_PREFETCH_BLOCKS
+ * are read each time.
+ */
+void
+lun_prefetch (void)
+{
+#if USB_MSD_LUN_READ_AHEAD_BLOCKS
+    if (!lun_read_ahead.sequential)
+        return;
+
+    lun_read_ahead_start (lun_read_ahead.pStream, lun_read_ahead.next);
+
+    // Already fetched?
+    if (lun_read_ahead.blocks == USB_MSD_LUN_READ_AHEAD_BLOCKS)
+        return;
+
+    // Give up at the end of the media or on error
+    if (!lun_read_ahead_extend (lun_read_ahead.pStream,
+                                USB_MSD_LUN_PREFETCH_BLOCKS))
+        lun_read_ahead.sequential = false;
+#endif
+}
+
+
 /**
  * Reads data from LUN, starting at the specified block address.
  * 
@@ -130,6 +518,8 @@ lun_read (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block, void *buffer,
 {
     msd_size_t bytes;
     msd_size_t result;
+    msd_size_t copied;
+    usb_msd_lun_addr_t addr;
 
     bytes = blocks * pLun->block_bytes;
 
@@ -143,12 +533,26 @@ lun_read (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block, void *buffer,
         return LUN_STATUS_ERROR;
     }
 
-    result = msd_read (pLun->msd, block * pLun->block_bytes, buffer, bytes);
-    if (result == bytes)
-        return LUN_STATUS_SUCCESS;
+    copied = lun_read_ahead_read (pLun, block, buffer, blocks);
+    if (copied < blocks)
+    {
+        addr = block + copied;
+        bytes = (blocks - copied) * pLun->block_bytes;
+
+        result = msd_read (pLun->msd, addr * pLun->block_bytes,
+                           (uint8_t *)buffer + copied * pLun->block_bytes,
+                           bytes);
+        if (result != bytes)
+        {
+            TRACE_ERROR (USB_MSD_LUN, "LUN:Read error %u/%u bytes\n",
+                         result, bytes);
+            return LUN_STATUS_ERROR;
+        }
+    }
 
-    TRACE_ERROR (USB_MSD_LUN, "LUN:Read error %u/%u bytes\n", result, bytes);
-    return LUN_STATUS_ERROR;
+    // Blocks not yet written to the media are newer than those read
+    lun_write_back_copy (pLun, block, buffer, blocks);
+    return LUN_STATUS_SUCCESS;
 }
 
 
@@ -180,6 +584,20 @@ lun_write (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block, const void *buffer,
         return LUN_STATUS_ERROR;
     }
 
+    if (pLun->write_back)
+    {
+        if (lun_write_back_add (pLun, block, buffer, blocks))
+            return LUN_STATUS_SUCCESS;
+
+        // Write out the buffered blocks first so that the writes
+        // reach the media in order
+        if (!lun_write_back_flush ())
+            return LUN_STATUS_ERROR;
+
+        if (lun_write_back_add (pLun, block, buffer, blocks))
+            return LUN_STATUS_SUCCESS;
+    }
+
     result = msd_write (pLun->msd, block * pLun->block_bytes, buffer, bytes);
 
     if (result == bytes)
@@ -190,6 +608,66 @@ lun_write (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block, const void *buffer,
 }
 
 
+/**
+ * Write any data cached for the LUN to its media.  This fails if
+ * buffered data could not be written since the last flush.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \return Operation result code
+ */
+lun_status_t
+lun_flush (usb_msd_lun_t *pLun)
+{
+    TRACE_INFO (USB_MSD_LUN, "LUN:Flush\n");
+
+    lun_write_back_flush ();
+
+    if (msd_flush (pLun->msd) && !pLun->write_back_error)
+        return LUN_STATUS_SUCCESS;
+
+    pLun->write_back_error = false;
+    TRACE_ERROR (USB_MSD_LUN, "LUN:Flush error\n");
+    return LUN_STATUS_ERROR;
+}
+
+
+/**
+ * Discard blocks that the host no longer needs.
+ * 
+ * \param  pLun    Pointer to LUN
+ * \param  block   First block address to discard
+ * \param  blocks  Number of blocks to discard
+ * \return Operation result code
+ */
+lun_status_t
+lun_discard (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block, uint32_t blocks)
+{
+    msd_addr_t bytes;
+
+    bytes = (msd_addr_t)blocks * pLun->block_bytes;
+
+    TRACE_INFO (USB_MSD_LUN, "LUN:Discard (%u)[%u]\n",
+                (unsigned int)block, (unsigned int)blocks);
+
+    // Check that the region is within the media
+    if ((msd_addr_t)block * pLun->block_bytes + bytes > pLun->media_bytes)
+    {
+        TRACE_ERROR (USB_MSD_LUN, "LUN:Discard too big\n");
+        return LUN_STATUS_ERROR;
+    }
+
+    if (lun_write_back_overlap_p (pLun, block, blocks)
+        && !lun_write_back_flush ())
+        return LUN_STATUS_ERROR;
+
+    if (msd_discard (pLun->msd, (msd_addr_t)block * pLun->block_bytes, bytes))
+        return LUN_STATUS_SUCCESS;
+
+    TRACE_ERROR (USB_MSD_LUN, "LUN:Discard error\n");
+    return LUN_STATUS_ERROR;
+}
+
+
 /**
  * Get status of LUN.
  * 
@@ -247,3 +725,26 @@ void lun_write_protect_set (usb_msd_lun_t *pLun, bool enable)
 {
     pLun->write_protect = enable;
 }
+
+
+/**
+ * Enables or disables buffering of the data written to a LUN.  This
+ * is ignored if USB_MSD_LUN_WRITE_BACK_BLOCKS is zero.
+ */
+void lun_write_back_set (usb_msd_lun_t *pLun, bool enable)
+{
+    if (!enable && lun_write_back_overlap_p (pLun, 0, ~0u))
+        lun_write_back_flush ();
+
+    pLun->write_back = enable && USB_MSD_LUN_WRITE_BACK_BLOCKS;
+}
+
+
+/**
+ * Checks if data written to a LUN can be held before it reaches the
+ * media, either by the LUN or by the msd.
+ */
+bool lun_write_cache_p (usb_msd_lun_t *pLun)
+{
+    return pLun->write_back || pLun->msd->flags.write_back;
+}
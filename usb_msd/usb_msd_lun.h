@@ -41,6 +41,10 @@ typedef struct
     //!< LUN status
     uint8_t bMediaStatus;
     bool write_protect;
+    //!< Writes are buffered
+    bool write_back;
+    //!< Buffered data could not be written
+    bool write_back_error;
 } usb_msd_lun_t;
 
 
@@ -54,6 +58,13 @@ lun_status_t lun_write (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
 
 msd_status_t lun_status_get (usb_msd_lun_t *pLun);
 
+lun_status_t lun_flush (usb_msd_lun_t *pLun);
+
+void lun_prefetch (void);
+
+lun_status_t lun_discard (usb_msd_lun_t *pLun, usb_msd_lun_addr_t block,
+                          uint32_t blocks);
+
 void lun_sense_data_update (usb_msd_lun_t *pLun,
                             unsigned char bSenseKey,
                             unsigned char bAdditionalSenseCode,
@@ -65,6 +76,10 @@ uint8_t lun_num_get (void);
 
 void lun_write_protect_set (usb_msd_lun_t *pLun, bool enable);
 
+void lun_write_back_set (usb_msd_lun_t *pLun, bool enable);
+
+bool lun_write_cache_p (usb_msd_lun_t *pLun);
+
 
 #ifdef __cplusplus
 }
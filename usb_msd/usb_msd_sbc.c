@@ -10,9 +10,62 @@
 #include "usb_msd_lun.h"
 #include "usb_sbc_defs.h"
 #include "byteorder.h"
+#include <string.h>
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+/* Number of buffers for READ (10) and WRITE (10) data.  With two or
+   more buffers, the media is accessed while the bus is transferring
+   the other buffer(s).  */
+#ifndef USB_MSD_SBC_BUFFERS
+#define USB_MSD_SBC_BUFFERS 2
+#endif
+
+/* Maximum number of blocks per buffer.  Larger buffers allow
+   multiple block media accesses (for example, CMD18 and CMD25 on an
+   SD card) at the expense of memory.  */
+#ifndef USB_MSD_SBC_BUFFER_BLOCKS
+#define USB_MSD_SBC_BUFFER_BLOCKS 1
+#endif
+
+#define SBC_BUFFER_BYTES (USB_MSD_SBC_BUFFER_BLOCKS * MSD_BLOCK_SIZE_MAX)
+
+#if SBC_BUFFER_BYTES > 65535
+#error USB_MSD_SBC_BUFFER_BLOCKS too large
+#endif
+
+/* Set to 1 to enable write-back for each LUN so that WRITE (10) is
+   completed once the data is in RAM, without waiting for the media;
+   see USB_MSD_LUN_WRITE_BACK_BLOCKS.  It can also be enabled per LUN
+   with usb_msd_write_back_set.  The host is told that there is a
+   write cache and is expected to issue SYNCHRONIZE CACHE (10) before
+   the medium is removed.  Data written but not flushed is lost if the
+   device is unplugged or loses power, so this is off by default.  */
+#ifndef USB_MSD_SBC_WRITE_BACK
+#define USB_MSD_SBC_WRITE_BACK 0
+#endif
+
+/* Number of consecutive sbc_idle polls without a command before
+   cached data is flushed.  This is a count of calls to usb_msd_update
+   while waiting for a command, not a time, so the interval depends on
+   how often the application polls; choose it from the loop rate.  */
+#ifndef USB_MSD_SBC_FLUSH_POLLS
+#define USB_MSD_SBC_FLUSH_POLLS 50000
+#endif
+
+/* Maximum number of blocks the host may discard with one UNMAP
+   command.  This is reported in the block limits VPD page; erasing
+   can be slow and the host will reset the device if a command takes
+   too long.  */
+#ifndef USB_MSD_SBC_UNMAP_BLOCKS
+#define USB_MSD_SBC_UNMAP_BLOCKS 8192
+#endif
+
+/* The UNMAP parameter list is received into the first buffer.  */
+#define SBC_UNMAP_DESCRIPTORS ((SBC_BUFFER_BYTES \
+                                - sizeof (S_sbc_unmap_parameter_list)) \
+                               / sizeof (S_sbc_unmap_block_descriptor))
+
 /**
  * \name Possible states of a SBC command.
  * 
@@ -27,8 +80,146 @@ typedef enum
 } sbc_state_t;
 
 
+/* State of a READ (10) or WRITE (10) command.  The buffers are used
+   as a ring so that the media can be accessed while the previous (or
+   next) chunk of data is being transferred over the bus.  */
+typedef struct
+{
+    //!< Next block address on the media
+    usb_msd_lun_addr_t addr;
+    //!< Number of blocks still to be transferred to or from the media
+    uint32_t blocks;
+    //!< Number of bytes held in each buffer
+    uint16_t bytes[USB_MSD_SBC_BUFFERS];
+    //!< Next buffer to fill
+    uint8_t head;
+    //!< Next buffer to empty
+    uint8_t tail;
+    //!< Number of full buffers
+    uint8_t count;
+    //!< True while a bus transfer is in progress
+    bool busy;
+    //!< Deferred media error
+    usb_bot_status_t error;
+} sbc_pipe_t;
+
+
+//! \brief  Data returned for MODE SENSE (6)
+typedef struct
+{
+    S_sbc_mode_parameter_header_6 sHeader;
+    S_sbc_caching sCaching;
+} __packed__ sbc_mode_sense_data_t;
+
+
+//! \brief  Data returned for INQUIRY with EVPD set
+typedef union
+{
+    S_sbc_vpd_supported_pages sSupportedPages;
+    S_sbc_vpd_block_limits sBlockLimits;
+    S_sbc_vpd_logical_block_provisioning sLogicalBlockProvisioning;
+} __packed__ sbc_vpd_data_t;
+
+
 static sbc_state_t sbc_state;
-static uint8_t sbc_tmp_buffer[MSD_BLOCK_SIZE_MAX];
+static uint32_t sbc_idle_polls;
+static sbc_mode_sense_data_t sbc_mode_sense_data;
+static sbc_vpd_data_t sbc_vpd_data;
+static S_sbc_read_capacity_16_data sbc_read_capacity16_data;
+static sbc_pipe_t sbc_pipe;
+static uint8_t sbc_buffers[USB_MSD_SBC_BUFFERS][SBC_BUFFER_BYTES];
+
+
+/**
+ * Return the size of a supported VPD page or zero if the page is
+ * not supported.
+ *
+ * \param   bPageCode   VPD page code
+ * \return  Size of page in bytes
+ *
+ */
+static uint16_t
+sbc_vpd_page_bytes (uint8_t bPageCode)
+{
+    switch (bPageCode)
+    {
+    case SBC_VPD_SUPPORTED_PAGES:
+        return sizeof (S_sbc_vpd_supported_pages);
+
+    case SBC_VPD_BLOCK_LIMITS:
+        return sizeof (S_sbc_vpd_block_limits);
+
+    case SBC_VPD_LOGICAL_BLOCK_PROVISIONING:
+        return sizeof (S_sbc_vpd_logical_block_provisioning);
+
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * Fills in a VPD page.  The UNMAP limits are only reported if the
+ * LUN's device supports discard.
+ *
+ * \param   bPageCode   VPD page code
+ *
+ */
+static void
+sbc_vpd_page_fill (usb_msd_lun_t *pLun, uint8_t bPageCode)
+{
+    sbc_vpd_data_t *pData = &sbc_vpd_data;
+    bool discard = msd_discard_p (pLun->msd);
+    uint32_t granularity;
+
+    // The data must persist until the transfer completes
+    memset (pData, 0, sizeof (*pData));
+
+    // The header is common to all the pages
+    pData->sSupportedPages.bPeripheralDeviceType
+        = SBC_DIRECT_ACCESS_BLOCK_DEVICE;
+    pData->sSupportedPages.bPeripheralQualifier
+        = SBC_PERIPHERAL_DEVICE_CONNECTED;
+    pData->sSupportedPages.bPageCode = bPageCode;
+    pData->sSupportedPages.pPageLength[1] = sbc_vpd_page_bytes (bPageCode) - 4;
+
+    switch (bPageCode)
+    {
+    case SBC_VPD_SUPPORTED_PAGES:
+        pData->sSupportedPages.pSupportedPages[0] = SBC_VPD_SUPPORTED_PAGES;
+        pData->sSupportedPages.pSupportedPages[1] = SBC_VPD_BLOCK_LIMITS;
+        pData->sSupportedPages.pSupportedPages[2]
+            = SBC_VPD_LOGICAL_BLOCK_PROVISIONING;
+        break;
+
+    case SBC_VPD_BLOCK_LIMITS:
+        if (!discard)
+            break;
+
+        // Discarding less than a device block achieves nothing
+        granularity = pLun->msd->block_bytes / pLun->block_bytes;
+        if (!granularity)
+            granularity = 1;
+
+        STORE_DWORDB (USB_MSD_SBC_UNMAP_BLOCKS,
+                      pData->sBlockLimits.pMaximumUnmapLBACount);
+        STORE_DWORDB (SBC_UNMAP_DESCRIPTORS,
+                      pData->sBlockLimits.pMaximumUnmapBlockDescriptorCount);
+        STORE_DWORDB (granularity,
+                      pData->sBlockLimits.pOptimalUnmapGranularity);
+        break;
+
+    case SBC_VPD_LOGICAL_BLOCK_PROVISIONING:
+        pData->sLogicalBlockProvisioning.isLBPU = discard;
+        if (discard)
+            pData->sLogicalBlockProvisioning.bProvisioningType
+                = SBC_PROVISIONING_TYPE_RESOURCE;
+        break;
+
+    default:
+        break;
+    }
+}
 
 
 /**
@@ -47,21 +238,41 @@ sbc_inquiry (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 {
     usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
     usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
+    S_sbc_inquiry *pCommand = (S_sbc_inquiry *) pCommandState->sCbw.pCommand;
+    void *pData;
+
+    // Vital product data is requested with the EVPD bit
+    if (pCommand->isEVPD)
+        pData = &sbc_vpd_data;
+    else
+        pData = &pLun->sInquiryData;
 
     switch (sbc_state)
     {
     case SBC_STATE_INIT:
-        TRACE_INFO (USB_MSD_SBC, "SBC:Inquiry\n");
         sbc_state = SBC_STATE_WRITE;
-        
-        // Change additional length field of inquiry data
-        pLun->sInquiryData.bAdditionalLength
-            = (uint8_t) (pCommandState->dLength - 5);
+
+        if (pCommand->isEVPD)
+        {
+            TRACE_INFO (USB_MSD_SBC, "SBC:Inquiry VPD 0x%02x\n",
+                        pCommand->bPageCode);
+            if (!sbc_vpd_page_bytes (pCommand->bPageCode))
+                return USB_BOT_STATUS_ERROR_CBW_PARAMETER;
+            sbc_vpd_page_fill (pLun, pCommand->bPageCode);
+        }
+        else
+        {
+            TRACE_INFO (USB_MSD_SBC, "SBC:Inquiry\n");
+
+            // Change additional length field of inquiry data
+            pLun->sInquiryData.bAdditionalLength
+                = (uint8_t) (pCommandState->dLength - 5);
+        }
         /* Fall through...  */
 
     case SBC_STATE_WRITE:
         // Start write operation
-        usb_bot_write (&pLun->sInquiryData, pCommandState->dLength, pTransfer);
+        usb_bot_write (pData, pCommandState->dLength, pTransfer);
         sbc_state = SBC_STATE_WRITE_WAIT;
         break;
 
@@ -131,11 +342,97 @@ sbc_read_capacity10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState
 }
 
 
+/**
+ * Performs a READ CAPACITY (16) command.  Unlike READ CAPACITY (10),
+ * this reports whether the LUN supports UNMAP.
+ * 
+ * This function operates asynchronously and must be called multiple
+ * times to complete. A result code of USB_BOT_STATUS_INCOMPLETE indicates
+ * that at least another call of the method is necessary.
+ * 
+ * \param   pCommandState   Current state of the command
+ * \return  Operation result code (SUCCESS, ERROR, INCOMPLETE, or PARAMETER)
+ * 
+ */
+static usb_bot_status_t 
+sbc_read_capacity16 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
+{
+    usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
+    usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
+    S_sbc_read_capacity_16 *pCommand
+        = (S_sbc_read_capacity_16 *) pCommandState->sCbw.pCommand;
+    S_sbc_read_capacity_16_data *pData = &sbc_read_capacity16_data;
+    usb_msd_lun_capacity_t block_max;
+
+    switch (sbc_state)
+    {
+    case SBC_STATE_INIT:
+        TRACE_INFO (USB_MSD_SBC, "SBC:RdCapacity16\n");
+        if (pCommand->bServiceAction != SBC_SA_READ_CAPACITY_16)
+            return USB_BOT_STATUS_ERROR_CBW_PARAMETER;
+        sbc_state = SBC_STATE_WRITE;
+
+        // The data must persist until the transfer completes
+        memset (pData, 0, sizeof (*pData));
+        block_max = pLun->media_bytes / pLun->block_bytes - 1;
+        STORE_DWORDB (block_max >> 32, pData->pLogicalBlockAddress);
+        STORE_DWORDB (block_max, pData->pLogicalBlockAddress + 4);
+        STORE_DWORDB (pLun->block_bytes, pData->pLogicalBlockLength);
+        pData->isLBPME = msd_discard_p (pLun->msd);
+        /* Fall through...  */
+
+    case SBC_STATE_WRITE:
+        // Start the write operation
+        usb_bot_write (pData, pCommandState->dLength, pTransfer);
+        sbc_state = SBC_STATE_WRITE_WAIT;
+        break;
+
+    case SBC_STATE_WRITE_WAIT:
+        bResult = usb_bot_transfer_status (pTransfer);
+        if (bResult == USB_BOT_STATUS_SUCCESS)
+            pCommandState->dLength -= usb_bot_transfer_bytes (pTransfer);
+        else if (bResult == USB_BOT_STATUS_ERROR_USB_WRITE)
+            TRACE_ERROR (USB_MSD_SBC, "SBC:Capacity error\n");
+        break;
+
+    default:
+        TRACE_ERROR (USB_MSD_SBC, "SBC: Bad state\n");
+        break;
+    }
+
+    return bResult;
+}
+
+
+/**
+ * Starts a READ (10) or WRITE (10) transfer.
+ * 
+ * \param   pCommandState   Current state of the command
+ * 
+ */
+static void
+sbc_pipe_init (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
+{
+    S_sbc_read_10 *pCommand = (S_sbc_read_10 *) pCommandState->sCbw.pCommand;
+
+    /* dLength should be a multiple of the LUN block length.  It may be
+       less than the transfer length requested in the command if the
+       host expects less data.  */
+    sbc_pipe.addr = DWORDB (pCommand->pLogicalBlockAddress);
+    sbc_pipe.blocks = pCommandState->dLength / pLun->block_bytes;
+    sbc_pipe.head = 0;
+    sbc_pipe.tail = 0;
+    sbc_pipe.count = 0;
+    sbc_pipe.busy = false;
+    sbc_pipe.error = USB_BOT_STATUS_SUCCESS;
+}
+
+
 /**
  * Performs a WRITE (10) command on the specified LUN.
  * 
- * The data to write is first received from the USB host and then
- * actually written on the media.
+ * The data to write is received from the USB host into one buffer
+ * while a previously received buffer is written to the media.
  * 
  * This function operates asynchronously and must be called multiple
  * times to complete. A result code of USB_BOT_STATUS_INCOMPLETE indicates
@@ -148,63 +445,89 @@ sbc_read_capacity10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState
 static usb_bot_status_t
 sbc_write10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 {
-    lun_status_t bStatus;
-    usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
+    usb_bot_status_t bResult;
     usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
-    S_sbc_write_10 *pCommand = (S_sbc_write_10 *) pCommandState->sCbw.pCommand;
-    usb_msd_lun_addr_t addr;
+    uint16_t blocks;
 
-    addr = DWORDB (pCommand->pLogicalBlockAddress);
-
-    switch (sbc_state)
+    if (sbc_state == SBC_STATE_INIT)
     {
-    case SBC_STATE_INIT:
         TRACE_INFO (USB_MSD_SBC, "SBC:Write %u @%u\n", 
                     (unsigned int)pCommandState->dLength,
-                    (unsigned int) addr);
-        sbc_state = SBC_STATE_READ;
-        /* Fall through...  */
+                    (unsigned int)DWORDB (((S_sbc_write_10 *)
+                                           pCommandState->sCbw.pCommand)
+                                          ->pLogicalBlockAddress));
+        sbc_pipe_init (pLun, pCommandState);
+        sbc_state = SBC_STATE_WRITE;
+    }
 
-    case SBC_STATE_READ:
-        TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT read start\n");
-        // Read one block of data sent by the host
-        usb_bot_read (sbc_tmp_buffer, pLun->block_bytes, pTransfer);
-        sbc_state = SBC_STATE_READ_WAIT;
-        break;
-        
-    case SBC_STATE_READ_WAIT:
+    if (sbc_pipe.busy)
+    {
         bResult = usb_bot_transfer_status (pTransfer);
-        if (bResult == USB_BOT_STATUS_SUCCESS)
+        if (bResult == USB_BOT_STATUS_INCOMPLETE)
         {
-            TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT read done\n");
-            sbc_state = SBC_STATE_WRITE;            
+            // Nothing to do until the host sends more data
+            if (!sbc_pipe.count)
+                return bResult;
         }
-        break;
-        
-    case SBC_STATE_WRITE:
-    case SBC_STATE_WRITE_WAIT:
-        // Write the block to the media
-        TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN write\n");
-        bStatus = lun_write (pLun, addr, sbc_tmp_buffer, 1);
-
-        if (bStatus != LUN_STATUS_SUCCESS)
+        else if (bResult != USB_BOT_STATUS_SUCCESS)
         {
-            bResult = USB_BOT_STATUS_ERROR_LUN_WRITE;
+            return bResult;
         }
         else
         {
-            TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN write done\n");
-            // Update transfer length and block address
-            pCommandState->dLength -=  pLun->block_bytes;
-            STORE_DWORDB (addr + 1, pCommand->pLogicalBlockAddress);
-            sbc_state = SBC_STATE_READ;
-            if (pCommandState->dLength != 0)
-                bResult = USB_BOT_STATUS_INCOMPLETE;
+            TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT read done\n");
+            sbc_pipe.busy = false;
+            sbc_pipe.bytes[sbc_pipe.head] = usb_bot_transfer_bytes (pTransfer);
+            pCommandState->dLength -= sbc_pipe.bytes[sbc_pipe.head];
+            sbc_pipe.head = (sbc_pipe.head + 1) % USB_MSD_SBC_BUFFERS;
+            sbc_pipe.count++;
         }
-        break;
     }
 
-    return bResult;
+    if (sbc_pipe.error != USB_BOT_STATUS_SUCCESS)
+        return sbc_pipe.busy ? USB_BOT_STATUS_INCOMPLETE : sbc_pipe.error;
+
+    // Receive the next chunk from the host into a free buffer
+    if (!sbc_pipe.busy && pCommandState->dLength
+        && sbc_pipe.count < USB_MSD_SBC_BUFFERS)
+    {
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT read start\n");
+        usb_bot_read (sbc_buffers[sbc_pipe.head],
+                      MIN (pCommandState->dLength, SBC_BUFFER_BYTES),
+                      pTransfer);
+        sbc_pipe.busy = true;
+    }
+
+    // Write the oldest received chunk to the media
+    if (sbc_pipe.count)
+    {
+        blocks = sbc_pipe.bytes[sbc_pipe.tail] / pLun->block_bytes;
+
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN write\n");
+        if (lun_write (pLun, sbc_pipe.addr, sbc_buffers[sbc_pipe.tail],
+                       blocks) != LUN_STATUS_SUCCESS)
+        {
+            sbc_pipe.error = USB_BOT_STATUS_ERROR_LUN_WRITE;
+            return sbc_pipe.busy ? USB_BOT_STATUS_INCOMPLETE : sbc_pipe.error;
+        }
+
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN write done\n");
+        sbc_pipe.addr += blocks;
+        sbc_pipe.blocks -= blocks;
+        sbc_pipe.tail = (sbc_pipe.tail + 1) % USB_MSD_SBC_BUFFERS;
+        sbc_pipe.count--;
+    }
+
+    if (!sbc_pipe.busy && !sbc_pipe.count && !pCommandState->dLength)
+    {
+        // Force unit access requires the data to be on the media
+        if (((S_sbc_write_10 *) pCommandState->sCbw.pCommand)->isFUA
+            && lun_flush (pLun) != LUN_STATUS_SUCCESS)
+            return USB_BOT_STATUS_ERROR_LUN_WRITE;
+        return USB_BOT_STATUS_SUCCESS;
+    }
+
+    return USB_BOT_STATUS_INCOMPLETE;
 }
 
 
@@ -212,7 +535,9 @@ sbc_write10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 /**
  * Performs a READ (10) command on specified LUN.
  * 
- * The data is first read from the media and then sent to the USB host.
+ * The data is read from the media into one buffer while a previously
+ * read buffer is sent to the USB host.
+ *
  * This function operates asynchronously and must be called multiple
  * times to complete. A result code of USB_BOT_STATUS_INCOMPLETE indicates
  * that at least another call of the method is necessary.
@@ -224,70 +549,82 @@ sbc_write10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 static usb_bot_status_t
 sbc_read10 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 {
-    lun_status_t bStatus;
-    usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
-    S_sbc_read_10 *pCommand = (S_sbc_read_10 *) pCommandState->sCbw.pCommand;
+    usb_bot_status_t bResult;
     usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
-    usb_msd_lun_addr_t addr;
-
-    addr = DWORDB (pCommand->pLogicalBlockAddress);
-
-    /* dLength should be a multiple of the LUN block length.  */
+    uint16_t blocks;
 
-    switch (sbc_state)
+    if (sbc_state == SBC_STATE_INIT)
     {
-    case SBC_STATE_INIT:
         TRACE_INFO (USB_MSD_SBC, "SBC:Read %u @%u\n",
                     (unsigned int)pCommandState->dLength,
-                    (unsigned int)addr);
+                    (unsigned int)DWORDB (((S_sbc_read_10 *)
+                                           pCommandState->sCbw.pCommand)
+                                          ->pLogicalBlockAddress));
+        sbc_pipe_init (pLun, pCommandState);
         sbc_state = SBC_STATE_READ;
-        /* Fall through ...  */
-
-    case SBC_STATE_READ:
-    case SBC_STATE_READ_WAIT:
-        TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN read start\n");
+    }
 
-        // Read one block of data from the media
-        bStatus = lun_read (pLun, addr, sbc_tmp_buffer, 1);
-        
-        if (bStatus != LUN_STATUS_SUCCESS)
-        {
-            bResult = USB_BOT_STATUS_ERROR_LUN_READ;
-        }
-        else
-        {
-            sbc_state = SBC_STATE_WRITE;
-        }
-        break;
-        
-    case SBC_STATE_WRITE:
-        TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT write start\n");
-        
-        // Send the block to the host
-        usb_bot_write (sbc_tmp_buffer, pLun->block_bytes, pTransfer);
-        sbc_state = SBC_STATE_WRITE_WAIT;
-        break;
-        
-    case SBC_STATE_WRITE_WAIT:
+    if (sbc_pipe.busy)
+    {
         bResult = usb_bot_transfer_status (pTransfer);
+        if (bResult != USB_BOT_STATUS_SUCCESS
+            && bResult != USB_BOT_STATUS_INCOMPLETE)
+            return bResult;
+
         if (bResult == USB_BOT_STATUS_SUCCESS)
         {
             TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT write done\n");
-            
-            // Update transfer length and block address
+            sbc_pipe.busy = false;
             pCommandState->dLength -= usb_bot_transfer_bytes (pTransfer);
-            STORE_DWORDB (addr + 1, pCommand->pLogicalBlockAddress);
-            
-            sbc_state = SBC_STATE_READ;
-            
-            if (pCommandState->dLength != 0)
-                bResult = USB_BOT_STATUS_INCOMPLETE;
+            sbc_pipe.tail = (sbc_pipe.tail + 1) % USB_MSD_SBC_BUFFERS;
+            sbc_pipe.count--;
+        }
+    }
+
+    if (sbc_pipe.error != USB_BOT_STATUS_SUCCESS)
+        return sbc_pipe.busy ? USB_BOT_STATUS_INCOMPLETE : sbc_pipe.error;
+
+    if (!sbc_pipe.busy && !sbc_pipe.count && !sbc_pipe.blocks)
+        return USB_BOT_STATUS_SUCCESS;
+
+    // Start sending the oldest chunk to the host
+    if (!sbc_pipe.busy && sbc_pipe.count)
+    {
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT write start\n");
+        usb_bot_write (sbc_buffers[sbc_pipe.tail],
+                       sbc_pipe.bytes[sbc_pipe.tail], pTransfer);
+        sbc_pipe.busy = true;
+    }
+
+    // Read the next chunk from the media while the host is busy
+    if (sbc_pipe.blocks && sbc_pipe.count < USB_MSD_SBC_BUFFERS)
+    {
+        blocks = MIN (sbc_pipe.blocks, USB_MSD_SBC_BUFFER_BLOCKS);
+
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:LUN read start\n");
+        if (lun_read (pLun, sbc_pipe.addr, sbc_buffers[sbc_pipe.head],
+                      blocks) != LUN_STATUS_SUCCESS)
+        {
+            sbc_pipe.error = USB_BOT_STATUS_ERROR_LUN_READ;
+            return sbc_pipe.busy ? USB_BOT_STATUS_INCOMPLETE : sbc_pipe.error;
+        }
+
+        sbc_pipe.bytes[sbc_pipe.head] = blocks * pLun->block_bytes;
+        sbc_pipe.addr += blocks;
+        sbc_pipe.blocks -= blocks;
+        sbc_pipe.head = (sbc_pipe.head + 1) % USB_MSD_SBC_BUFFERS;
+        sbc_pipe.count++;
 
+        if (!sbc_pipe.busy)
+        {
+            TRACE_DEBUG (USB_MSD_SBC, "SBC:BOT write start\n");
+            usb_bot_write (sbc_buffers[sbc_pipe.tail],
+                           sbc_pipe.bytes[sbc_pipe.tail], pTransfer);
+            sbc_pipe.busy = true;
         }
-        break;
     }
 
-    return bResult;
+    return USB_BOT_STATUS_INCOMPLETE;
 }
 
 
@@ -307,34 +644,31 @@ sbc_mode_sense6 (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 {
     usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
     usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
-    S_sbc_mode_parameter_header_6 sModeParameterHeader6 =
-        {
-            //!< Length of mode page data is 0x03
-            sizeof (S_sbc_mode_parameter_header_6) - 1,
-            //!< Direct-access block device
-            SBC_MEDIUM_TYPE_DIRECT_ACCESS_BLOCK_DEVICE,
-            //!< Reserved bits
-            0,
-            //!< DPO/FUA not supported
-            false,
-            //!< Reserved bits
-            0,
-            //!< Write-protect status
-            pLun->write_protect,
-            //!< No block descriptor
-            0
-        };
+    sbc_mode_sense_data_t *pData = &sbc_mode_sense_data;
 
     switch (sbc_state)
     {
     case SBC_STATE_INIT:
         TRACE_INFO (USB_MSD_SBC, "SBC:ModeSense\n");
         sbc_state = SBC_STATE_WRITE;
+
+        // The data must persist until the transfer completes
+        memset (pData, 0, sizeof (*pData));
+        pData->sHeader.bModeDataLength = sizeof (*pData) - 1;
+        pData->sHeader.bMediumType = SBC_MEDIUM_TYPE_DIRECT_ACCESS_BLOCK_DEVICE;
+        // DPO is ignored and FUA is honoured
+        pData->sHeader.isDPOFUA = true;
+        pData->sHeader.isWP = pLun->write_protect;
+
+        // Report whether writes are cached
+        pData->sCaching.bPageCode = SBC_PAGE_CACHING;
+        pData->sCaching.bPageLength = sizeof (pData->sCaching) - 2;
+        pData->sCaching.isWCE = lun_write_cache_p (pLun);
         /* Fall through...  */
 
     case SBC_STATE_WRITE:
         // Start transfer
-        usb_bot_write (&sModeParameterHeader6, pCommandState->dLength, pTransfer);
+        usb_bot_write (pData, pCommandState->dLength, pTransfer);
         sbc_state = SBC_STATE_WRITE_WAIT;
         break;
     
@@ -401,6 +735,162 @@ sbc_request_sense (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
 }
 
 
+/**
+ * Performs a SYNCHRONIZE CACHE (10) command.
+ *
+ * The whole cache is written to the media regardless of the block
+ * range requested.
+ *
+ * \return  Operation result code
+ *
+ */
+static usb_bot_status_t
+sbc_synchronize_cache10 (usb_msd_lun_t *pLun)
+{
+    TRACE_INFO (USB_MSD_SBC, "SBC:SyncCache\n");
+
+    if (lun_flush (pLun) != LUN_STATUS_SUCCESS)
+        return USB_BOT_STATUS_ERROR_LUN_WRITE;
+
+    return USB_BOT_STATUS_SUCCESS;
+}
+
+
+/**
+ * Discards the blocks listed in an UNMAP parameter list.  The host
+ * is expected to respect the limits in the block limits VPD page.
+ *
+ * \param   pData   Parameter list
+ * \param   bytes   Number of bytes in the parameter list
+ * \return  Operation result code
+ *
+ */
+static usb_bot_status_t
+sbc_unmap_descriptors (usb_msd_lun_t *pLun, const uint8_t *pData,
+                       uint16_t bytes)
+{
+    const S_sbc_unmap_parameter_list *pList
+        = (const S_sbc_unmap_parameter_list *) pData;
+    const S_sbc_unmap_block_descriptor *pDescriptor
+        = (const S_sbc_unmap_block_descriptor *) (pList + 1);
+    uint16_t length;
+    uint32_t blocks;
+
+    if (bytes < sizeof (*pList))
+        return USB_BOT_STATUS_SUCCESS;
+
+    length = MIN (WORDB (pList->pBlockDescriptorDataLength),
+                  bytes - sizeof (*pList));
+
+    for (; length >= sizeof (*pDescriptor); length -= sizeof (*pDescriptor),
+             pDescriptor++)
+    {
+        blocks = DWORDB (pDescriptor->pNumberOfLogicalBlocks);
+        if (!blocks)
+            continue;
+
+        // Block addresses are only 32 bits
+        if (DWORDB (pDescriptor->pLogicalBlockAddress))
+            return USB_BOT_STATUS_ERROR_LUN_WRITE;
+
+        if (lun_discard (pLun, DWORDB (pDescriptor->pLogicalBlockAddress + 4),
+                         blocks) != LUN_STATUS_SUCCESS)
+            return USB_BOT_STATUS_ERROR_LUN_WRITE;
+    }
+
+    return USB_BOT_STATUS_SUCCESS;
+}
+
+
+/**
+ * Performs an UNMAP command.
+ *
+ * The parameter list is received from the host and the listed blocks
+ * are discarded so that a flash device can reclaim them.
+ *
+ * This function operates asynchronously and must be called multiple
+ * times to complete. A result code of USB_BOT_STATUS_INCOMPLETE indicates
+ * that at least another call of the method is necessary.
+ *
+ * \param   pCommandState   Current state of the command
+ * \return  Operation result code (SUCCESS, ERROR, INCOMPLETE, or PARAMETER)
+ *
+ */
+static usb_bot_status_t
+sbc_unmap (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
+{
+    usb_bot_status_t bResult = USB_BOT_STATUS_INCOMPLETE;
+    usb_bot_transfer_t *pTransfer = &pCommandState->sTransfer;
+    uint16_t bytes;
+
+    switch (sbc_state)
+    {
+    case SBC_STATE_INIT:
+        TRACE_INFO (USB_MSD_SBC, "SBC:Unmap %u\n",
+                    (unsigned int)pCommandState->dLength);
+
+        if (!msd_discard_p (pLun->msd)
+            || pCommandState->dLength > SBC_BUFFER_BYTES)
+            return USB_BOT_STATUS_ERROR_CBW_PARAMETER;
+
+        // An empty parameter list is not an error
+        if (!pCommandState->dLength)
+            return USB_BOT_STATUS_SUCCESS;
+
+        sbc_state = SBC_STATE_READ;
+        /* Fall through...  */
+
+    case SBC_STATE_READ:
+        // Receive the parameter list
+        usb_bot_read (sbc_buffers[0], pCommandState->dLength, pTransfer);
+        sbc_state = SBC_STATE_READ_WAIT;
+        break;
+
+    case SBC_STATE_READ_WAIT:
+        bResult = usb_bot_transfer_status (pTransfer);
+        if (bResult == USB_BOT_STATUS_SUCCESS)
+        {
+            bytes = usb_bot_transfer_bytes (pTransfer);
+            pCommandState->dLength -= bytes;
+            bResult = sbc_unmap_descriptors (pLun, sbc_buffers[0], bytes);
+        }
+        else if (bResult == USB_BOT_STATUS_ERROR_USB_READ)
+            TRACE_ERROR (USB_MSD_SBC, "SBC:Unmap error\n");
+        break;
+
+    default:
+        TRACE_ERROR (USB_MSD_SBC, "SBC: Bad state\n");
+        break;
+    }
+
+    return bResult;
+}
+
+
+/**
+ * Performs a START STOP UNIT command.
+ *
+ * Stopping or ejecting the medium flushes the cache.
+ *
+ * \return  Operation result code
+ *
+ */
+static usb_bot_status_t
+sbc_start_stop_unit (usb_msd_lun_t *pLun, S_usb_bot_command_state *pCommandState)
+{
+    S_sbc_start_stop_unit *pCommand
+        = (S_sbc_start_stop_unit *) pCommandState->sCbw.pCommand;
+
+    TRACE_INFO (USB_MSD_SBC, "SBC:StartStop %d\n", pCommand->isStart);
+
+    if (!pCommand->isStart && !pCommand->isNoFlush
+        && lun_flush (pLun) != LUN_STATUS_SUCCESS)
+        return USB_BOT_STATUS_ERROR_LUN_WRITE;
+
+    return USB_BOT_STATUS_SUCCESS;
+}
+
+
 /**
  * Performs a TEST UNIT READY COMMAND command.
  * 
@@ -463,16 +953,29 @@ sbc_get_command_information (usb_msd_cbw_t *pCbw, uint32_t *pLength, uint8_t *pT
     
         // Allocation length is stored in big-endian format
         *pLength = WORDB (pSbcCommand->sInquiry.pAllocationLength);
+
+        if (pSbcCommand->sInquiry.isEVPD)
+        {
+            *pLength = MIN (*pLength, sbc_vpd_page_bytes
+                            (pSbcCommand->sInquiry.bPageCode));
+            if (!sbc_vpd_page_bytes (pSbcCommand->sInquiry.bPageCode))
+            {
+                TRACE_INFO (USB_MSD_SBC, "SBC:Bad VPD page 0X%02x\n",
+                            pSbcCommand->sInquiry.bPageCode);
+                isCommandSupported = false;
+            }
+        }
         break;
     
     case SBC_MODE_SENSE_6:
-        // Linux requests 192 bytes but we only supply 4
+        // Linux requests 192 bytes but we only supply 24
         *pType = USB_BOT_DEVICE_TO_HOST;
-        *pLength = MIN (sizeof (S_sbc_mode_parameter_header_6),
+        *pLength = MIN (sizeof (sbc_mode_sense_data_t),
                         pSbcCommand->sModeSense6.bAllocationLength);
     
-        // Only "return all pages" command is supported
-        if (pSbcCommand->sModeSense6.bPageCode != SBC_PAGE_RETURN_ALL)
+        // Only the caching page is supported
+        if (pSbcCommand->sModeSense6.bPageCode != SBC_PAGE_RETURN_ALL
+            && pSbcCommand->sModeSense6.bPageCode != SBC_PAGE_CACHING)
         {
             // Unsupported page, Windows sends this
             TRACE_INFO (USB_MSD_SBC, "SBC:Bad page code 0X%02x\n",
@@ -516,6 +1019,36 @@ sbc_get_command_information (usb_msd_cbw_t *pCbw, uint32_t *pLength, uint8_t *pT
         *pType = USB_BOT_NO_TRANSFER;
         break;
     
+    case SBC_SYNCHRONIZE_CACHE_10:
+    case SBC_START_STOP_UNIT:
+        *pType = USB_BOT_NO_TRANSFER;
+        break;
+
+    case SBC_SERVICE_ACTION_IN_16:
+        *pType = USB_BOT_DEVICE_TO_HOST;
+        *pLength = MIN (sizeof (S_sbc_read_capacity_16_data),
+                        DWORDB (pSbcCommand->sReadCapacity16.pAllocationLength));
+
+        if (pSbcCommand->sReadCapacity16.bServiceAction
+            != SBC_SA_READ_CAPACITY_16)
+        {
+            isCommandSupported = false;
+            *pLength = 0;
+        }
+        break;
+
+    case SBC_UNMAP:
+        *pType = USB_BOT_HOST_TO_DEVICE;
+        *pLength = WORDB (pSbcCommand->sUnmap.pParameterListLength);
+
+        // The parameter list must fit in a buffer
+        if (!msd_discard_p (pLun->msd) || *pLength > SBC_BUFFER_BYTES)
+        {
+            isCommandSupported = false;
+            *pLength = 0;
+        }
+        break;
+    
     default:
         isCommandSupported = false;
     }
@@ -552,6 +1085,8 @@ sbc_process_command (S_usb_bot_command_state *pCommandState)
     if (!pLun)
         return USB_BOT_STATUS_ERROR_CBW_PARAMETER;
 
+    sbc_idle_polls = 0;
+
     // Identify command
     switch (pCommand->bOperationCode)
     {
@@ -595,6 +1130,22 @@ sbc_process_command (S_usb_bot_command_state *pCommandState)
         bResult = USB_BOT_STATUS_SUCCESS;
         break;
 
+    case SBC_SYNCHRONIZE_CACHE_10:
+        bResult = sbc_synchronize_cache10 (pLun);
+        break;
+
+    case SBC_START_STOP_UNIT:
+        bResult = sbc_start_stop_unit (pLun, pCommandState);
+        break;
+
+    case SBC_SERVICE_ACTION_IN_16:
+        bResult = sbc_read_capacity16 (pLun, pCommandState);
+        break;
+
+    case SBC_UNMAP:
+        bResult = sbc_unmap (pLun, pCommandState);
+        break;
+
     default:
         bResult = USB_BOT_STATUS_ERROR_CBW_PARAMETER;
     }
@@ -665,7 +1216,42 @@ sbc_process_command (S_usb_bot_command_state *pCommandState)
 void
 sbc_lun_init (msd_t *msd)
 {
-    lun_init (msd);
+    usb_msd_lun_t *pLun;
+
+    pLun = lun_init (msd);
+    if (pLun)
+        lun_write_back_set (pLun, USB_MSD_SBC_WRITE_BACK);
+}
+
+
+/* Write cached data for all the LUNs to their media.  */
+void
+sbc_flush (void)
+{
+    uint8_t i;
+
+    for (i = 0; i < lun_num_get (); i++)
+        lun_flush (lun_get (i));
+}
+
+
+/* This is called while waiting for a command.  Sequential reads are
+   continued in anticipation of the next READ (10).  Cached data is
+   flushed if the host has been quiet for a while in case the medium
+   is removed without warning.  */
+void
+sbc_idle (void)
+{
+    lun_prefetch ();
+
+    if (sbc_idle_polls > USB_MSD_SBC_FLUSH_POLLS)
+        return;
+
+    if (++sbc_idle_polls > USB_MSD_SBC_FLUSH_POLLS)
+    {
+        TRACE_DEBUG (USB_MSD_SBC, "SBC:Idle flush\n");
+        sbc_flush ();
+    }
 }
 
 
@@ -693,3 +1279,15 @@ void  sbc_lun_write_protect_set (uint8_t lun_id, bool enable)
     
     lun_write_protect_set (pLun, enable);
 }
+
+
+void sbc_lun_write_back_set (uint8_t lun_id, bool enable)
+{
+    usb_msd_lun_t *pLun;
+    
+    pLun = lun_get (lun_id);
+    if (!pLun)
+        return;
+    
+    lun_write_back_set (pLun, enable);
+}
@@ -24,12 +24,18 @@ void sbc_update_sense_data (S_sbc_request_sense_data *pRequestSenseData,
 
 void sbc_reset (void);
 
+void sbc_flush (void);
+
+void sbc_idle (void);
+
 void sbc_lun_init (msd_t *msd);
 
 uint8_t sbc_lun_num_get (void);
 
 void sbc_lun_write_protect_set (uint8_t lun_id, bool enable);
 
+void sbc_lun_write_back_set (uint8_t lun_id, bool enable);
+
 
 #ifdef __cplusplus
 }
@@ -34,9 +34,38 @@ typedef enum
  */
     SBC_PREVENT_ALLOW_MEDIUM_REMOVAL = 0x1E,
     SBC_MODE_SENSE_6 = 0x1A,
-    SBC_VERIFY_10 = 0x2F
+    SBC_VERIFY_10 = 0x2F,
+/**
+ * \name Optional commands
+ */
+    SBC_START_STOP_UNIT = 0x1B,
+    SBC_SYNCHRONIZE_CACHE_10 = 0x35,
+    SBC_UNMAP = 0x42,
+    SBC_SERVICE_ACTION_IN_16 = 0x9E
 } sbc_command_t;
 
+/**
+ * \name  Service actions for SERVICE ACTION IN (16)
+ * \see   sbc3r25.pdf - Section 5.16
+ */
+#define SBC_SA_READ_CAPACITY_16                         0x10
+
+/**
+ * \name  Vital product data page codes
+ * \see   S_sbc_inquiry
+ * \see   sbc3r25.pdf - Section 6.5
+ */
+#define SBC_VPD_SUPPORTED_PAGES                         0x00
+#define SBC_VPD_BLOCK_LIMITS                            0xB0
+#define SBC_VPD_LOGICAL_BLOCK_PROVISIONING              0xB2
+
+/**
+ * \name  Provisioning types of the logical block provisioning VPD page
+ */
+#define SBC_PROVISIONING_TYPE_FULL                      0x0
+#define SBC_PROVISIONING_TYPE_RESOURCE                  0x1
+#define SBC_PROVISIONING_TYPE_THIN                      0x2
+
 /**
  * \name  Peripheral qualifier values specified in the INQUIRY data
  * \see   spc4r06.pdf - Section 6.4.2 - Table 83
@@ -170,6 +199,7 @@ typedef enum
  */
 //@{
 #define SBC_PAGE_READ_WRITE_ERROR_RECOVERY            0x01
+#define SBC_PAGE_CACHING                              0x08
 #define SBC_PAGE_INFORMATIONAL_EXCEPTIONS_CONTROL     0x1C
 #define SBC_PAGE_RETURN_ALL                           0x3F
 #define SBC_PAGE_VENDOR_SPECIFIC                      0x00
@@ -273,6 +303,40 @@ typedef struct
 } S_sbc_read_capacity_10_data;
 
 
+//! \brief  Structure for the READ CAPACITY (16) command
+//! \see    sbc3r25.pdf - Section 5.16.1 - Table 63
+typedef struct
+{
+    uint8_t bOperationCode;          //!< 0x9E : SBC_SERVICE_ACTION_IN_16
+    uint8_t bServiceAction:5,        //!< 0x10 : SBC_SA_READ_CAPACITY_16
+            bReserved1:3;            //!< Reserved bits
+    uint8_t pLogicalBlockAddress[8]; //!< Block to evaluate if PMI is set
+    uint8_t pAllocationLength[4];    //!< Size of host buffer
+    uint8_t isPMI:1,                 //!< Partial medium indicator bit
+            bReserved2:7;            //!< Reserved bits
+    uint8_t bControl;                //!< 0x00
+} __packed__ S_sbc_read_capacity_16;
+
+
+//! \brief  Data returned by the device after a READ CAPACITY (16) command
+//! \see    sbc3r25.pdf - Section 5.16.2 - Table 64
+typedef struct
+{
+    uint8_t pLogicalBlockAddress[8]; //!< Address of last logical block
+    uint8_t pLogicalBlockLength[4];  //!< Length of last logical block
+    uint8_t isProtEn:1,              //!< Protection enabled ?
+            bPType:3,                //!< Protection type
+            bReserved1:4;            //!< Reserved bits
+    uint8_t bLogicalBlocksPerPhysicalBlockExponent:4, //!< Physical block size
+            bPIExponent:4;           //!< Protection information intervals
+    uint8_t bLowestAlignedLBA1:6,    //!< Lowest aligned block (high bits)
+            isLBPRZ:1,               //!< Unmapped blocks read as zero ?
+            isLBPME:1;               //!< Logical block provisioning enabled ?
+    uint8_t bLowestAlignedLBA0;      //!< Lowest aligned block (low bits)
+    uint8_t pReserved2[16];          //!< Reserved bytes
+} __packed__ S_sbc_read_capacity_16_data;
+
+
 //! \brief  Structure for the REQUEST SENSE command
 //! \see    spc4r06.pdf - Section 6.26 - Table 170
 typedef struct
@@ -382,6 +446,169 @@ typedef struct
 } __packed__ S_sbc_mode_parameter_header_6;
 
 
+//! \brief  Structure for the START STOP UNIT command
+//! \see    sbc3r07.pdf - Section 5.17 - Table 52
+typedef struct
+{
+    uint8_t bOperationCode;    //!< 0x1B : SBC_START_STOP_UNIT
+    uint8_t isImmed:1,         //!< Return status before completion ?
+            bReserved1:7;      //!< Reserved bits
+    uint8_t bReserved2;        //!< Reserved byte
+    uint8_t bPowerConditionModifier:4, //!< Power condition modifier
+            bReserved3:4;      //!< Reserved bits
+    uint8_t isStart:1,         //!< Start (1) or stop (0) the medium
+            isLoEj:1,          //!< Load (start) or eject (stop) the medium
+            isNoFlush:1,       //!< Do not flush the cache when stopping
+            bReserved4:1,      //!< Reserved bit
+            bPowerCondition:4; //!< Power condition
+    uint8_t bControl;          //!< 0x00
+} __packed__ S_sbc_start_stop_unit;
+
+
+//! \brief  Structure for the SYNCHRONIZE CACHE (10) command
+//! \see    sbc3r07.pdf - Section 5.18 - Table 54
+typedef struct
+{
+    uint8_t bOperationCode;          //!< 0x35 : SBC_SYNCHRONIZE_CACHE_10
+    uint8_t bReserved1:1,            //!< Reserved bit
+            isImmed:1,               //!< Return status before completion ?
+            isSyncNV:1,              //!< Obsolete
+            bReserved2:5;            //!< Reserved bits
+    uint8_t pLogicalBlockAddress[4]; //!< First block to synchronize
+    uint8_t bGroupNumber:5,          //!< Information grouping
+            bReserved3:3;            //!< Reserved bits
+    uint8_t pNumberOfBlocks[2];      //!< Number of blocks, 0 for all
+    uint8_t bControl;                //!< 0x00
+} __packed__ S_sbc_synchronize_cache_10;
+
+
+//! \brief  Structure for the UNMAP command
+//! \see    sbc3r25.pdf - Section 5.28.1 - Table 116
+typedef struct
+{
+    uint8_t bOperationCode;          //!< 0x42 : SBC_UNMAP
+    uint8_t isAnchor:1,              //!< Anchor the blocks rather than unmap
+            bReserved1:7;            //!< Reserved bits
+    uint8_t pReserved2[4];           //!< Reserved bytes
+    uint8_t bGroupNumber:5,          //!< Information grouping
+            bReserved3:3;            //!< Reserved bits
+    uint8_t pParameterListLength[2]; //!< Number of bytes of parameter data
+    uint8_t bControl;                //!< 0x00
+} __packed__ S_sbc_unmap;
+
+
+//! \brief  Header of the UNMAP parameter list
+//! \see    sbc3r25.pdf - Section 5.28.2 - Table 117
+typedef struct
+{
+    uint8_t pUnmapDataLength[2];          //!< Bytes following this field
+    uint8_t pBlockDescriptorDataLength[2];//!< Bytes of block descriptors
+    uint8_t pReserved1[4];                //!< Reserved bytes
+} __packed__ S_sbc_unmap_parameter_list;
+
+
+//! \brief  UNMAP block descriptor
+//! \see    sbc3r25.pdf - Section 5.28.2 - Table 118
+typedef struct
+{
+    uint8_t pLogicalBlockAddress[8];  //!< First block to unmap
+    uint8_t pNumberOfLogicalBlocks[4];//!< Number of blocks to unmap
+    uint8_t pReserved1[4];            //!< Reserved bytes
+} __packed__ S_sbc_unmap_block_descriptor;
+
+
+//! \brief  Supported VPD pages VPD page
+//! \see    spc4r36.pdf - Section 7.8.16 - Table 667
+typedef struct
+{
+    uint8_t bPeripheralDeviceType:5, //!< Peripheral device type
+            bPeripheralQualifier:3;  //!< Peripheral qualifier
+    uint8_t bPageCode;               //!< 0x00 : SBC_VPD_SUPPORTED_PAGES
+    uint8_t pPageLength[2];          //!< Number of supported pages
+    uint8_t pSupportedPages[3];      //!< Supported page codes, ascending
+} __packed__ S_sbc_vpd_supported_pages;
+
+
+//! \brief  Block limits VPD page
+//! \see    sbc3r25.pdf - Section 6.5.3 - Table 185
+typedef struct
+{
+    uint8_t bPeripheralDeviceType:5, //!< Peripheral device type
+            bPeripheralQualifier:3;  //!< Peripheral qualifier
+    uint8_t bPageCode;               //!< 0xB0 : SBC_VPD_BLOCK_LIMITS
+    uint8_t pPageLength[2];          //!< Length of page data (0x3C)
+    uint8_t isWSNZ:1,                //!< WRITE SAME requires non-zero length
+            bReserved1:7;            //!< Reserved bits
+    uint8_t bMaximumCompareAndWriteLength; //!< 0 if not supported
+    uint8_t pOptimalTransferLengthGranularity[2]; //!< Blocks
+    uint8_t pMaximumTransferLength[4];     //!< Blocks, 0 if not reported
+    uint8_t pOptimalTransferLength[4];     //!< Blocks, 0 if not reported
+    uint8_t pMaximumPrefetchLength[4];     //!< Blocks
+    uint8_t pMaximumUnmapLBACount[4];      //!< Blocks per UNMAP command
+    uint8_t pMaximumUnmapBlockDescriptorCount[4]; //!< Per UNMAP command
+    uint8_t pOptimalUnmapGranularity[4];   //!< Blocks
+    uint8_t pUnmapGranularityAlignment[4]; //!< Blocks; bit 31 is UGAVALID
+    uint8_t pMaximumWriteSameLength[8];    //!< Blocks
+    uint8_t pReserved2[20];                //!< Reserved bytes
+} __packed__ S_sbc_vpd_block_limits;
+
+
+//! \brief  Logical block provisioning VPD page
+//! \see    sbc3r25.pdf - Section 6.5.4 - Table 189
+typedef struct
+{
+    uint8_t bPeripheralDeviceType:5, //!< Peripheral device type
+            bPeripheralQualifier:3;  //!< Peripheral qualifier
+    uint8_t bPageCode;               //!< 0xB2 : SBC_VPD_LOGICAL_BLOCK_PROVISIONING
+    uint8_t pPageLength[2];          //!< Length of page data (0x04)
+    uint8_t bThresholdExponent;      //!< Threshold set size
+    uint8_t isDP:1,                  //!< Provisioning group descriptor ?
+            isANC_SUP:1,             //!< ANCHOR supported ?
+            isLBPRZ:1,               //!< Unmapped blocks read as zero ?
+            bReserved1:2,            //!< Reserved bits
+            isLBPWS10:1,             //!< WRITE SAME (10) unmap supported ?
+            isLBPWS:1,               //!< WRITE SAME (16) unmap supported ?
+            isLBPU:1;                //!< UNMAP supported ?
+    uint8_t bProvisioningType:3,     //!< SBC_PROVISIONING_TYPE_...
+            bReserved2:5;            //!< Reserved bits
+    uint8_t bReserved3;              //!< Reserved byte
+} __packed__ S_sbc_vpd_logical_block_provisioning;
+
+
+//! \brief  Caching mode page
+//! \see    sbc3r07.pdf - Section 6.3.3 - Table 117
+typedef struct
+{
+    uint8_t bPageCode:6,       //!< 0x08 : SBC_PAGE_CACHING
+            isSPF:1,           //!< Page or subpage data format
+            isPS:1;            //!< Parameters saveable ?
+    uint8_t bPageLength;       //!< Length of page data (0x12)
+    uint8_t isRCD:1,           //!< Read cache disable bit
+            isMF:1,            //!< Multiplication factor bit
+            isWCE:1,           //!< Write cache enable bit
+            isSIZE:1,          //!< Size enable bit
+            isDISC:1,          //!< Discontinuity bit
+            isCAP:1,           //!< Caching analysis permitted bit
+            isABPF:1,          //!< Abort prefetch bit
+            isIC:1;            //!< Initiator control bit
+    uint8_t bWriteRetentionPriority:4, //!< Write retention priority
+            bReadRetentionPriority:4;  //!< Read retention priority
+    uint8_t pDisablePrefetchTransferLength[2]; //!< Prefetch limit
+    uint8_t pMinimumPrefetch[2];       //!< Minimum blocks to prefetch
+    uint8_t pMaximumPrefetch[2];       //!< Maximum blocks to prefetch
+    uint8_t pMaximumPrefetchCeiling[2];//!< Prefetch ceiling
+    uint8_t bReserved1:3,      //!< Vendor specific bits
+            isVS:2,            //!< Vendor specific bits
+            isDRA:1,           //!< Disable read ahead bit
+            isLBCSS:1,         //!< Logical block cache segment size bit
+            isFSW:1;           //!< Force sequential write bit
+    uint8_t bNumberOfCacheSegments;    //!< Number of cache segments
+    uint8_t pCacheSegmentSize[2];      //!< Cache segment size
+    uint8_t bReserved2;        //!< Reserved byte
+    uint8_t pObsolete1[3];     //!< Obsolete bytes
+} __packed__ S_sbc_caching;
+
+
 //! \brief  Informational exceptions control mode page
 //! \see    spc4r06.pdf - Section 7.4.11 - Table 285
 typedef struct
@@ -448,6 +675,10 @@ typedef union
     S_sbc_write_10         sWrite10;        //!< WRITE (10) command
     S_sbc_medium_removal   sMediumRemoval;  //!< PREVENT/ALLOW MEDIUM REMOVAL command
     S_sbc_mode_sense_6     sModeSense6;     //!< MODE SENSE (6) command
+    S_sbc_start_stop_unit  sStartStopUnit;  //!< START STOP UNIT command
+    S_sbc_synchronize_cache_10 sSynchronizeCache10; //!< SYNCHRONIZE CACHE (10)
+    S_sbc_unmap            sUnmap;          //!< UNMAP command
+    S_sbc_read_capacity_16 sReadCapacity16; //!< READ CAPACITY (16) command
 } __packed__ S_sbc_command;
 
 